@@ -0,0 +1,242 @@
+#include "flv_synth.h"
+#include "put_bits.h"
+#include <cstring>
+
+namespace nx {
+
+static const uint8_t  kStartCode[]     = { 0, 0, 0, 1 };
+static const uint32_t kLog2MaxPocLsb   = 8;
+static const uint32_t kLog2MaxFrameNum = 4;
+
+void flv_synth_escape_rbsp( const uint8_t *rbsp, size_t size, std::vector<uint8_t> &out ) {
+    int zeros = 0;
+    for ( size_t i = 0; i < size; i++ ) {
+        uint8_t byte = rbsp[i];
+        if ( zeros >= 2 && byte <= 3 ) {
+            out.push_back( 3 );
+            zeros = 0;
+        }
+        out.push_back( byte );
+        zeros = byte ? 0 : zeros + 1;
+    }
+}
+
+static bool high_profile( uint8_t profileIdc ) {
+    return profileIdc == 100 || profileIdc == 110 || profileIdc == 122 || profileIdc == 244;
+}
+
+static void append_nalu( std::vector<uint8_t> &out, const std::vector<uint8_t> &nalu ) {
+    out.insert( out.end(), kStartCode, kStartCode + 4 );
+    out.insert( out.end(), nalu.begin(), nalu.end() );
+}
+
+FlvSynthVideo::FlvSynthVideo( const FlvSynthVideoConfig &config ) : cfg( config ), random( config.seed ) {
+    if ( !cfg.fps ) cfg.fps = 30;
+    if ( !cfg.gopLength ) cfg.gopLength = 1;
+    if ( !cfg.slicesPerFrame ) cfg.slicesPerFrame = 1;
+    cfg.cropLeft &= ~1u;
+    cfg.cropTop &= ~1u;
+    mbCount = ( ( cfg.width + cfg.cropLeft + 15 ) / 16 ) * ( ( cfg.height + cfg.cropTop + 15 ) / 16 );
+    pocLsb  = cfg.bFrames && cfg.profileIdc != 66;
+    if ( cfg.slicesPerFrame > mbCount ) cfg.slicesPerFrame = mbCount;
+
+    // groups of a reference frame and bFrames non reference frames after the key frame, p frames for the rest
+    uint32_t groupSize = cfg.bFrames + 1;
+    fullGroups         = cfg.bFrames ? ( cfg.gopLength - 1 ) / groupSize : 0;
+    reorderSize        = pocLsb ? cfg.bFrames : 0;
+    uint32_t nonRef    = fullGroups * cfg.bFrames;
+    uint32_t ref       = cfg.gopLength - 1 - nonRef;
+    double   gopBytes  = (double)cfg.bitrate / 8 * cfg.gopLength / cfg.fps;
+    interBytes         = gopBytes / ( cfg.keyFrameRatio + ref + nonRef / 2.0 );
+
+    make_sps();
+    make_pps();
+}
+
+void FlvSynthVideo::make_sps() {
+    uint8_t        rbsp[64] = { 0 };
+    PutBitsContext context  = PutBitsContext( rbsp, sizeof( rbsp ) );
+    context.put_bits( 8, cfg.profileIdc );
+    // constraint_set flags, baseline streams are also main compatible
+    context.put_bits( 8, cfg.profileIdc == 66 ? 0xC0 : cfg.profileIdc == 77 ? 0x40 : 0 );
+    context.put_bits( 8, cfg.levelIdc );
+    context.put_ue_golomb( 0 ); // seq_parameter_set_id
+    if ( high_profile( cfg.profileIdc ) ) {
+        context.put_ue_golomb( 1 ); // chroma_format_idc, 4:2:0
+        context.put_ue_golomb( 0 ); // bit_depth_luma_minus8
+        context.put_ue_golomb( 0 ); // bit_depth_chroma_minus8
+        context.put_bits( 1, 0 );   // qpprime_y_zero_transform_bypass_flag
+        context.put_bits( 1, 0 );   // seq_scaling_matrix_present_flag
+    }
+    context.put_ue_golomb( kLog2MaxFrameNum - 4 );
+    context.put_ue_golomb( pocLsb ? 0 : 2 ); // pic_order_cnt_type
+    if ( pocLsb ) context.put_ue_golomb( kLog2MaxPocLsb - 4 );
+    context.put_ue_golomb( pocLsb ? 2 : 1 ); // max_num_ref_frames
+    context.put_bits( 1, 0 );                // gaps_in_frame_num_value_allowed_flag
+    uint32_t mbWidth  = ( cfg.width + cfg.cropLeft + 15 ) / 16;
+    uint32_t mbHeight = ( cfg.height + cfg.cropTop + 15 ) / 16;
+    context.put_ue_golomb( mbWidth - 1 );
+    context.put_ue_golomb( mbHeight - 1 );
+    context.put_bits( 1, 1 ); // frame_mbs_only_flag
+    context.put_bits( 1, 1 ); // direct_8x8_inference_flag
+    // in chroma samples, 2 pixels for 4:2:0 frames
+    uint32_t cropRight  = mbWidth * 16 - cfg.width - cfg.cropLeft;
+    uint32_t cropBottom = mbHeight * 16 - cfg.height - cfg.cropTop;
+    bool     cropping   = cfg.cropLeft || cfg.cropTop || cropRight || cropBottom;
+    context.put_bits( 1, cropping ? 1 : 0 );
+    if ( cropping ) {
+        context.put_ue_golomb( cfg.cropLeft / 2 );
+        context.put_ue_golomb( cropRight / 2 );
+        context.put_ue_golomb( cfg.cropTop / 2 );
+        context.put_ue_golomb( cropBottom / 2 );
+    }
+    context.put_bits( 1, 0 ); // vui_parameters_present_flag
+    context.put_rbsp_trailing_bits();
+
+    spsNalu = { 0x67 };
+    flv_synth_escape_rbsp( rbsp, context.size(), spsNalu );
+}
+
+void FlvSynthVideo::make_pps() {
+    uint8_t        rbsp[16] = { 0 };
+    PutBitsContext context  = PutBitsContext( rbsp, sizeof( rbsp ) );
+    context.put_ue_golomb( 0 );                          // pic_parameter_set_id
+    context.put_ue_golomb( 0 );                          // seq_parameter_set_id
+    context.put_bits( 1, cfg.profileIdc == 66 ? 0 : 1 ); // entropy_coding_mode_flag, cabac above baseline
+    context.put_bits( 1, 0 );                            // bottom_field_pic_order_in_frame_present_flag
+    context.put_ue_golomb( 0 );                          // num_slice_groups_minus1
+    context.put_ue_golomb( 0 );                          // num_ref_idx_l0_default_active_minus1
+    context.put_ue_golomb( 0 );                          // num_ref_idx_l1_default_active_minus1
+    context.put_bits( 1, 0 );                            // weighted_pred_flag
+    context.put_bits( 2, 0 );                            // weighted_bipred_idc
+    context.put_se_golomb( 0 );                          // pic_init_qp_minus26
+    context.put_se_golomb( 0 );                          // pic_init_qs_minus26
+    context.put_se_golomb( 0 );                          // chroma_qp_index_offset
+    context.put_bits( 1, 0 );                            // deblocking_filter_control_present_flag
+    context.put_bits( 1, 0 );                            // constrained_intra_pred_flag
+    context.put_bits( 1, 0 );                            // redundant_pic_cnt_present_flag
+    if ( high_profile( cfg.profileIdc ) ) {
+        context.put_bits( 1, 1 );   // transform_8x8_mode_flag
+        context.put_bits( 1, 0 );   // pic_scaling_matrix_present_flag
+        context.put_se_golomb( 0 ); // second_chroma_qp_index_offset
+    }
+    context.put_rbsp_trailing_bits();
+
+    ppsNalu = { 0x68 };
+    flv_synth_escape_rbsp( rbsp, context.size(), ppsNalu );
+}
+
+uint32_t FlvSynthVideo::frame_bytes( bool key, bool disposable ) {
+    double bytes = key ? interBytes * cfg.keyFrameRatio : disposable ? interBytes / 2 : interBytes;
+    if ( cfg.sizeJitter ) {
+        uint32_t jitter = cfg.sizeJitter < 100 ? cfg.sizeJitter : 99;
+        bytes           = bytes * ( 100 - jitter + random.below( 2 * jitter + 1 ) ) / 100;
+    }
+    return bytes < 16 ? 16 : (uint32_t)bytes;
+}
+
+void FlvSynthVideo::append_slice( std::vector<uint8_t> &out, uint8_t nalHeader, uint32_t sliceType, uint32_t firstMb, uint32_t frameNum,
+                                  uint32_t poc, uint32_t bytes ) {
+    std::vector<uint8_t> rbsp( bytes + 32 );
+    PutBitsContext       context = PutBitsContext( &rbsp[0], (int)rbsp.size() );
+    context.put_ue_golomb( firstMb );
+    context.put_ue_golomb( sliceType );
+    context.put_ue_golomb( 0 ); // pic_parameter_set_id
+    context.put_bits( kLog2MaxFrameNum, frameNum );
+    if ( ( nalHeader & 0x1F ) == 5 ) context.put_ue_golomb( idrPicId );
+    if ( pocLsb ) context.put_bits( kLog2MaxPocLsb, poc );
+    // the rest of the header and the slice data are random, from a byte boundary
+    while ( !context.byte_aligned() ) context.put_bits( 1, 1 );
+    size_t header = context.size();
+    if ( header + 4 > bytes ) bytes = (uint32_t)header + 4;
+    rbsp.resize( bytes );
+    for ( size_t i = header; i < bytes; i += 8 ) {
+        uint64_t value = random.next();
+        memcpy( &rbsp[i], &value, bytes - i < 8 ? bytes - i : 8 );
+    }
+    // zero runs an encoder would escape, 00 00 0x
+    if ( cfg.escapeInterval ) {
+        for ( size_t i = header + random.below( 2 * cfg.escapeInterval ); i + 4 < bytes; i += 1 + random.below( 2 * cfg.escapeInterval ) ) {
+            rbsp[i]     = 0;
+            rbsp[i + 1] = 0;
+            rbsp[i + 2] = (uint8_t)random.below( 4 );
+        }
+    }
+    // rbsp_slice_trailing_bits
+    rbsp[bytes - 1] |= 0x01;
+
+    out.insert( out.end(), kStartCode, kStartCode + 4 );
+    out.push_back( nalHeader );
+    flv_synth_escape_rbsp( &rbsp[0], rbsp.size(), out );
+}
+
+void FlvSynthVideo::next( FlvSynthFrame &frame ) {
+    if ( gopIndex == cfg.gopLength ) {
+        gopIndex = 0;
+        gopStart = frameCount;
+        idrPicId = ( idrPicId + 1 ) % 65536;
+    }
+    // display index in the gop, and reference or not
+    uint32_t k          = gopIndex;
+    uint32_t groupSize  = cfg.bFrames + 1;
+    bool     key        = k == 0;
+    bool     disposable = false;
+    uint32_t display    = k;
+    if ( !key && k <= fullGroups * groupSize ) {
+        uint32_t group = ( k - 1 ) / groupSize;
+        uint32_t pos   = ( k - 1 ) % groupSize;
+        disposable     = pos != 0;
+        if ( reorderSize ) display = pos ? group * groupSize + pos : ( group + 1 ) * groupSize;
+    }
+
+    frame.data.clear();
+    frame.isKeyFrame = key;
+    frame.disposable = disposable;
+    frame.dts        = (uint32_t)( frameCount * 1000 / cfg.fps );
+    frame.pts        = (uint32_t)( ( gopStart + display + reorderSize ) * 1000 / cfg.fps );
+
+    if ( cfg.aud ) {
+        // primary_pic_type, 0: I, 1: I P, 2: I P B
+        uint8_t picType = key ? 0 : disposable && reorderSize ? 2 : 1;
+        append_nalu( frame.data, { 0x09, (uint8_t)( picType << 5 | 0x10 ) } );
+    }
+    if ( key && ( cfg.repeatParameterSets || frameCount == 0 ) ) {
+        append_nalu( frame.data, spsNalu );
+        append_nalu( frame.data, ppsNalu );
+    }
+
+    // I 2, P 0, B 1, non reference frames have nal_ref_idc 0
+    uint32_t sliceType = key ? 2 : disposable && reorderSize ? 1 : 0;
+    uint8_t  nalHeader = key ? 0x65 : disposable ? 0x01 : 0x41;
+    if ( key ) frameNum = 0;
+    uint32_t num   = key ? 0 : ( frameNum + 1 ) % ( 1 << kLog2MaxFrameNum );
+    uint32_t poc   = ( 2 * display ) % ( 1 << kLog2MaxPocLsb );
+    uint32_t bytes = frame_bytes( key, disposable );
+    for ( uint32_t i = 0; i < cfg.slicesPerFrame; i++ ) {
+        uint32_t firstMb = (uint32_t)( (uint64_t)mbCount * i / cfg.slicesPerFrame );
+        append_slice( frame.data, nalHeader, sliceType, firstMb, num, poc, bytes / cfg.slicesPerFrame );
+    }
+    if ( !disposable ) frameNum = num;
+
+    gopIndex += 1;
+    frameCount += 1;
+}
+
+FlvSynthAudio::FlvSynthAudio( const FlvSynthAudioConfig &config ) : cfg( config ), random( config.seed ) {
+    if ( !cfg.sampleRate ) cfg.sampleRate = 48000;
+}
+
+void FlvSynthAudio::next( FlvSynthFrame &frame ) {
+    int         rawSize = (int)( (uint64_t)cfg.bitrate / 8 * 1024 / cfg.sampleRate );
+    adts_header header  = adts_header( cfg.profile, cfg.sampleRate, cfg.channels, rawSize );
+    frame.data.resize( 7 + rawSize );
+    header.to_buf( &frame.data[0] );
+    for ( size_t i = 7; i < frame.data.size(); i++ ) frame.data[i] = (uint8_t)random.next();
+    frame.pts        = (uint32_t)( frameCount * 1024 * 1000 / cfg.sampleRate );
+    frame.dts        = frame.pts;
+    frame.isKeyFrame = false;
+    frame.disposable = false;
+    frameCount += 1;
+}
+
+}; // namespace nx
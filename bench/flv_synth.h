@@ -0,0 +1,159 @@
+#ifndef __FLV_SYNTH_H__
+#define __FLV_SYNTH_H__
+
+/*
+ Synthetic H.264 / AAC elementary streams for the benchmarks and the soak tests.
+
+ The sps and pps are real parameter sets for the chosen profile, level, resolution and cropping,
+ written with PutBitsContext, so the parsers see what an encoder produces. The slices start with
+ a real slice header, followed by random slice data with planted zero runs, so the nalus carry
+ emulation prevention bytes. The output is fully determined by the configuration and its seed.
+*/
+
+#include <cstdint>
+#include <vector>
+
+#include "aac.h"
+
+namespace nx {
+
+// xorshift64
+struct FlvSynthRandom {
+    uint64_t state;
+    explicit FlvSynthRandom( uint64_t seed ) : state( seed ? seed : 0x9E3779B97F4A7C15ull ) {}
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    // [0, range)
+    uint32_t below( uint32_t range ) {
+        return range ? (uint32_t)( next() % range ) : 0;
+    }
+};
+
+struct FlvSynthVideoConfig {
+    // 66 baseline, 77 main, 100 high
+    uint8_t profileIdc = 66;
+    uint8_t levelIdc   = 40;
+    // displayed size, the coded size is rounded up to macroblocks and cropped back
+    uint32_t width  = 1280;
+    uint32_t height = 720;
+    // extra cropping at the left and top, in pixels, even
+    uint32_t cropLeft = 0;
+    uint32_t cropTop  = 0;
+
+    uint32_t fps     = 30;
+    uint32_t bitrate = 2500000; // bits per second
+    // frames from a key frame to the next one
+    uint32_t gopLength = 60;
+    // non reference frames between reference frames, reordered b frames above baseline, p frames in baseline
+    uint32_t bFrames = 0;
+    // size of a key frame in inter frames, non reference frames are half an inter frame
+    uint32_t keyFrameRatio = 5;
+    // random variation of the frame sizes, percent
+    uint32_t sizeJitter = 0;
+
+    uint32_t slicesPerFrame = 1;
+    // average rbsp bytes between planted 00 00 0x runs, which need an emulation prevention byte, 0: none
+    uint32_t escapeInterval = 2048;
+    // sps and pps in front of every key frame
+    bool repeatParameterSets = true;
+    // access unit delimiter in front of every frame
+    bool aud = false;
+
+    uint64_t seed = 1;
+};
+
+struct FlvSynthFrame {
+    // annex-b, 4 bytes start codes
+    std::vector<uint8_t> data;
+    uint32_t             pts        = 0;
+    uint32_t             dts        = 0;
+    bool                 isKeyFrame = false;
+    // not used for reference, nal_ref_idc 0
+    bool disposable = false;
+};
+
+/**
+ * @brief H.264 stream in decoding order, gops of key frame, reference frames and non reference frames.
+ * With bFrames above baseline, the reference frame of a group is sent before the b frames displayed before it,
+ * and pts is delayed by bFrames frames. Baseline streams are never reordered.
+ */
+class FlvSynthVideo {
+public:
+    explicit FlvSynthVideo( const FlvSynthVideoConfig &config );
+
+    // nalus without start code
+    const std::vector<uint8_t> &sps() const {
+        return spsNalu;
+    }
+    const std::vector<uint8_t> &pps() const {
+        return ppsNalu;
+    }
+    const FlvSynthVideoConfig &config() const {
+        return cfg;
+    }
+    /**
+     * @brief the next frame in decoding order.
+     */
+    void next( FlvSynthFrame &frame );
+
+private:
+    void     make_sps();
+    void     make_pps();
+    void     append_slice( std::vector<uint8_t> &out, uint8_t nalHeader, uint32_t sliceType, uint32_t firstMb, uint32_t frameNum,
+                           uint32_t poc, uint32_t bytes );
+    uint32_t frame_bytes( bool key, bool disposable );
+
+    FlvSynthVideoConfig  cfg;
+    FlvSynthRandom       random;
+    std::vector<uint8_t> spsNalu;
+    std::vector<uint8_t> ppsNalu;
+    uint32_t             mbCount;
+    bool                 pocLsb;
+
+    // frames emitted, and position in the gop
+    uint64_t frameCount  = 0;
+    uint32_t gopIndex    = 0;
+    uint64_t gopStart    = 0;
+    uint32_t frameNum    = 0;
+    uint32_t idrPicId    = 0;
+    double   interBytes  = 0;
+    uint32_t fullGroups  = 0;
+    uint32_t reorderSize = 0;
+};
+
+struct FlvSynthAudioConfig {
+    adts_header::Profile profile    = adts_header::Profile::LC;
+    uint32_t             sampleRate = 48000;
+    uint8_t              channels   = 2;
+    uint32_t             bitrate    = 128000;
+
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief AAC in ADTS, 1024 samples per frame, random raw data blocks at the bitrate.
+ */
+class FlvSynthAudio {
+public:
+    explicit FlvSynthAudio( const FlvSynthAudioConfig &config );
+
+    void next( FlvSynthFrame &frame );
+
+private:
+    FlvSynthAudioConfig cfg;
+    FlvSynthRandom      random;
+    uint64_t            frameCount = 0;
+};
+
+/**
+ * @brief rbsp to nalu payload, appends out with emulation_prevention_three_byte inserted.
+ */
+void flv_synth_escape_rbsp( const uint8_t *rbsp, size_t size, std::vector<uint8_t> &out );
+
+};     // namespace nx
+
+#endif // __FLV_SYNTH_H__
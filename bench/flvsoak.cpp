@@ -0,0 +1,280 @@
+/*
+ Soak test of the muxer on synthetic, deterministic input from flv_synth.h.
+
+ usage: flvsoak [-d seconds] [-s seed] [-r WxH] [-b bitrate] [-p profile_idc] [-g gop] [-B bframes]
+                [-S slices] [-c gops] [-n slack] [-i seconds]
+   -d  wall clock duration, default 60, muxing runs as fast as it can
+   -s  seed of the streams, default 1
+   -r  resolution, default 1280x720
+   -b  video bitrate in bits per second, default 2500000
+   -p  profile_idc, 66 baseline, 77 main, 100 high, default 66
+   -g  gop length in frames, default 60
+   -B  non reference frames between reference frames, default 0
+   -S  slices per frame, default 1
+   -c  switch to a new resolution every n gops, a new sequence header mid stream, default 0: never
+   -n  mux the video nal unit by nal unit, streamed to an append only sink, the sizeHint of the i-th frame
+       is its size plus i % slack bytes. 1 to 5 bytes cannot be padded, such a frame must fail and
+       the frames up to the next key frame must be dropped. Default 0: mux_avc
+   -i  report interval, default 10
+
+ Every tag is checked as it is muxed: the tag header and tag size, monotonic timestamps,
+ composition times and the avcc nalu lengths, of the tags streamed in parts as well. The resident memory is reported with the throughput,
+ it must stay flat. Exits with 1 on the first error.
+*/
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "avc.h"
+#include "flv_reader.h"
+#include "flv_synth.h"
+#include "flvmuxer.h"
+
+using namespace nx;
+
+namespace {
+
+struct SoakChecker : public FlvMuxerDataHandler {
+    uint64_t bytes       = 0;
+    uint64_t audioTags   = 0;
+    uint64_t videoTags   = 0;
+    uint64_t keyFrames   = 0;
+    uint32_t lastAudioTs = 0;
+    uint32_t lastVideoTs = 0;
+    bool     failed      = false;
+    // take the video tags of begin_video_frame in parts, assembled here
+    bool                 streaming = false;
+    std::vector<uint8_t> parts;
+
+    void fail( const char *what, uint32_t timestamp ) {
+        if ( !failed ) fprintf( stderr, "error at %u ms: %s\n", timestamp, what );
+        failed = true;
+    }
+
+    void onMuxedFlvHeader( void *context, uint8_t *data, size_t bytes ) override {
+        bool hasAudio = false;
+        bool hasVideo = false;
+        if ( bytes != FlvFileHeaderSize || flv_parse_header( data, bytes, &hasAudio, &hasVideo ) < 0 ) fail( "bad flv header", 0 );
+        this->bytes += bytes;
+    }
+    void onMuxedData( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) override {
+        check_tag( type, data, bytes, timestamp );
+    }
+    void onMuxedBatch( void *context, const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) override {
+        for ( size_t i = 0; i < count; i++ ) {
+            check_tag( tags[i].type, data + tags[i].offset, tags[i].bytes, tags[i].timestamp );
+        }
+    }
+    void onUpdateMuxedData( void *context, size_t offsetFromStart, const uint8_t *data, size_t bytes ) override {}
+    void onEndMuxing() override {}
+    int  onStreamingSupport( void *context ) override {
+        return streaming ? FlvSinkStreamingAppend : FlvSinkStreamingNone;
+    }
+    void onMuxedDataPart( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) override {
+        parts.insert( parts.end(), data, data + bytes );
+        if ( !last ) return;
+        check_tag( type, &parts[0], parts.size(), timestamp );
+        parts.clear();
+    }
+
+    void check_tag( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        this->bytes += bytes;
+        FlvTagInfo tag;
+        if ( flv_parse_tag_header( data, bytes, tag ) < 0 || tag.size() != bytes || tag.type != type || tag.timestamp != timestamp ) {
+            fail( "bad tag header", timestamp );
+            return;
+        }
+        const uint8_t *end     = data + bytes;
+        uint32_t       tagSize = (uint32_t)end[-4] << 24 | (uint32_t)end[-3] << 16 | (uint32_t)end[-2] << 8 | end[-1];
+        if ( tagSize != bytes - 4 ) fail( "bad tag size", timestamp );
+        if ( type == 8 ) {
+            if ( audioTags && timestamp < lastAudioTs ) fail( "audio timestamp going backwards", timestamp );
+            lastAudioTs = timestamp;
+            audioTags += 1;
+        }
+        else if ( type == 9 ) {
+            if ( tag.dataSize < 5 ) {
+                fail( "short video tag", timestamp );
+                return;
+            }
+            if ( videoTags && timestamp < lastVideoTs ) fail( "video timestamp going backwards", timestamp );
+            lastVideoTs = timestamp;
+            videoTags += 1;
+            if ( tag.packetType != 1 ) return;
+            keyFrames += tag.isKeyFrame ? 1 : 0;
+            const uint8_t *avc = data + FlvTagHeaderSize;
+            int32_t        cts = (int32_t)( (uint32_t)avc[2] << 24 | (uint32_t)avc[3] << 16 | (uint32_t)avc[4] << 8 ) >> 8;
+            if ( cts < 0 ) fail( "negative composition time", timestamp );
+            // avcc, 4 bytes lengths covering the tag data exactly
+            const uint8_t *nalu    = avc + 5;
+            const uint8_t *dataEnd = avc + tag.dataSize;
+            while ( nalu < dataEnd ) {
+                if ( dataEnd - nalu < 5 ) {
+                    fail( "truncated nalu length", timestamp );
+                    return;
+                }
+                uint32_t length = (uint32_t)nalu[0] << 24 | (uint32_t)nalu[1] << 16 | (uint32_t)nalu[2] << 8 | nalu[3];
+                if ( !length || length > (size_t)( dataEnd - nalu - 4 ) || ( nalu[4] & 0x80 ) ) {
+                    fail( "bad nalu", timestamp );
+                    return;
+                }
+                nalu += 4 + length;
+            }
+        }
+    }
+};
+
+uint64_t resident_bytes() {
+#if defined( __linux__ )
+    FILE *file = fopen( "/proc/self/statm", "r" );
+    if ( !file ) return 0;
+    unsigned long size = 0, resident = 0;
+    int           n    = fscanf( file, "%lu %lu", &size, &resident );
+    fclose( file );
+    return n == 2 ? (uint64_t)resident * 4096 : 0;
+#else
+    return 0;
+#endif
+}
+
+void usage( const char *name ) {
+    fprintf( stderr,
+             "usage: %s [-d seconds] [-s seed] [-r WxH] [-b bitrate] [-p profile_idc] [-g gop] [-B bframes] [-S slices] [-c gops] [-n slack] [-i seconds]\n",
+             name );
+}
+
+} // namespace
+
+int main( int argc, char **argv ) {
+    FlvSynthVideoConfig video;
+    FlvSynthAudioConfig audio;
+    double              durationS  = 60;
+    double              intervalS  = 10;
+    uint32_t            changeGops = 0;
+    uint32_t            slackCycle = 0;
+    video.sizeJitter               = 20;
+    for ( int i = 1; i < argc; i++ ) {
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if ( !value || argv[i][0] != '-' || strlen( argv[i] ) != 2 ) {
+            usage( argv[0] );
+            return 1;
+        }
+        switch ( argv[i][1] ) {
+        case 'd': durationS = atof( value ); break;
+        case 's': video.seed = strtoull( value, nullptr, 10 ); break;
+        case 'b': video.bitrate = (uint32_t)atoi( value ); break;
+        case 'p': video.profileIdc = (uint8_t)atoi( value ); break;
+        case 'g': video.gopLength = (uint32_t)atoi( value ); break;
+        case 'B': video.bFrames = (uint32_t)atoi( value ); break;
+        case 'S': video.slicesPerFrame = (uint32_t)atoi( value ); break;
+        case 'c': changeGops = (uint32_t)atoi( value ); break;
+        case 'n': slackCycle = (uint32_t)atoi( value ); break;
+        case 'i': intervalS = atof( value ); break;
+        case 'r':
+            if ( sscanf( value, "%ux%u", &video.width, &video.height ) != 2 || !video.width || !video.height ) {
+                usage( argv[0] );
+                return 1;
+            }
+            break;
+        default: usage( argv[0] ); return 1;
+        }
+        i += 1;
+    }
+    audio.seed = video.seed + 1;
+
+    auto                           checker = std::make_shared<SoakChecker>();
+    std::unique_ptr<FlvMuxer>      muxer( new FlvMuxer( true, true, checker ) );
+    std::unique_ptr<FlvSynthVideo> videoSource( new FlvSynthVideo( video ) );
+    FlvSynthAudio                  audioSource( audio );
+    FlvSynthFrame                  videoFrame;
+    FlvSynthFrame                  audioFrame;
+    videoSource->next( videoFrame );
+    audioSource.next( audioFrame );
+    checker->streaming = slackCycle != 0;
+
+    typedef std::chrono::steady_clock clock;
+    auto                              begin      = clock::now();
+    double                            nextReport = intervalS;
+    uint64_t                          frames     = 0;
+    uint64_t                          gops       = 0;
+    // frames given to the incremental api, and a broken frame drops the rest of its gop
+    uint64_t               framesIn   = 0;
+    bool                   brokenGop  = false;
+    std::vector<NaluRange> nalus;
+    // the video timestamps continue across a resolution change
+    uint32_t videoOffset = 0;
+    uint64_t startRss    = resident_bytes();
+    while ( !checker->failed ) {
+        if ( audioFrame.dts <= videoFrame.dts + videoOffset ) {
+            muxer->mux_aac( &audioFrame.data[0], audioFrame.data.size(), audioFrame.pts );
+            audioSource.next( audioFrame );
+            continue;
+        }
+        uint32_t lastDts = videoFrame.dts + videoOffset;
+        if ( !slackCycle ) {
+            muxer->mux_avc( &videoFrame.data[0], videoFrame.data.size(), videoFrame.pts + videoOffset, lastDts, videoFrame.isKeyFrame );
+            frames += 1;
+        }
+        else {
+            nalus.clear();
+            find_nalus( &videoFrame.data[0], (uint32_t)videoFrame.data.size(), nalus );
+            size_t frameBytes = 0;
+            for ( size_t i = 0; i < nalus.size(); i++ ) {
+                frameBytes += 4 + nalus[i].size;
+            }
+            size_t slack  = framesIn % slackCycle;
+            int    result = muxer->begin_video_frame( videoFrame.pts + videoOffset, lastDts, videoFrame.isKeyFrame, frameBytes + slack );
+            for ( size_t i = 0; i < nalus.size(); i++ ) {
+                result |= muxer->add_nalu( nalus[i].buf, nalus[i].size );
+            }
+            result |= muxer->end_video_frame();
+            framesIn += 1;
+            if ( videoFrame.isKeyFrame ) brokenGop = false;
+            bool kept   = !brokenGop;
+            bool broken = kept && slack >= 1 && slack <= 5;
+            if ( broken != ( result < 0 ) ) checker->fail( broken ? "a frame which cannot be padded is not reported" : "incremental api failed", lastDts );
+            brokenGop = brokenGop || broken;
+            frames += kept ? 1 : 0;
+        }
+        videoSource->next( videoFrame );
+        if ( !videoFrame.isKeyFrame ) continue;
+
+        gops += 1;
+        if ( changeGops && gops % changeGops == 0 ) {
+            // alternate between the configured size and a cropped, smaller one
+            FlvSynthVideoConfig next = videoSource->config();
+            bool                half = next.width == video.width && next.height == video.height;
+            next.width               = half ? ( video.width / 2 + 15 ) & ~15u : video.width;
+            next.height              = half ? ( video.height / 2 + 1 ) & ~1u : video.height;
+            next.seed += 1;
+            videoOffset = lastDts + 1000 / next.fps;
+            videoSource.reset( new FlvSynthVideo( next ) );
+            videoSource->next( videoFrame );
+        }
+
+        double elapsed = std::chrono::duration<double>( clock::now() - begin ).count();
+        if ( elapsed >= nextReport || elapsed >= durationS ) {
+            printf( "%8.1f s: %" PRIu64 " frames, %" PRIu64 " gops, media %.1f s, %.1f MB, %.1f MB/s, rss %.1f MB (%+.1f MB)\n", elapsed, frames, gops,
+                    lastDts / 1000.0, checker->bytes / 1e6, checker->bytes / 1e6 / elapsed, resident_bytes() / 1e6,
+                    ( (double)resident_bytes() - (double)startRss ) / 1e6 );
+            fflush( stdout );
+            nextReport += intervalS;
+            if ( elapsed >= durationS ) break;
+        }
+    }
+    muxer.reset();
+
+    if ( checker->videoTags < frames || checker->keyFrames < gops ) {
+        fprintf( stderr, "error: %" PRIu64 " video tags, %" PRIu64 " key frames for %" PRIu64 " frames, %" PRIu64 " gops\n", checker->videoTags,
+                 checker->keyFrames, frames, gops );
+        checker->failed = true;
+    }
+    printf( "%s: %" PRIu64 " audio tags, %" PRIu64 " video tags, %" PRIu64 " key frames, %" PRIu64 " bytes\n", checker->failed ? "failed" : "ok",
+            checker->audioTags, checker->videoTags, checker->keyFrames, checker->bytes );
+    return checker->failed ? 1 : 0;
+}
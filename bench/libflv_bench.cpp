@@ -0,0 +1,444 @@
+/*
+ Microbenchmarks of the libflv hot functions.
+
+ usage: libflv_bench [--json] [--filter <substring>] [--min-time <ms>]
+
+ Every benchmark runs on synthetic, deterministic input from flv_synth.h. Each case is calibrated to run for
+ at least min-time, repeated 5 times, and the fastest run is reported.
+ Allocations are counted by interposing malloc/calloc/realloc on glibc, n/a elsewhere.
+*/
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aac.h"
+#include "amf.h"
+#include "avc.h"
+#include "flv_synth.h"
+#include "flvmuxer.h"
+#include "get_bits.h"
+#include "put_bits.h"
+
+#if defined( __GLIBC__ )
+#define BENCH_COUNT_ALLOCS 1
+static uint64_t g_allocs = 0;
+extern "C" {
+void *__libc_malloc( size_t size );
+void *__libc_calloc( size_t count, size_t size );
+void *__libc_realloc( void *ptr, size_t size );
+void *malloc( size_t size ) {
+    g_allocs++;
+    return __libc_malloc( size );
+}
+void *calloc( size_t count, size_t size ) {
+    g_allocs++;
+    return __libc_calloc( count, size );
+}
+void *realloc( void *ptr, size_t size ) {
+    g_allocs++;
+    return __libc_realloc( ptr, size );
+}
+}
+#else
+#define BENCH_COUNT_ALLOCS 0
+static uint64_t g_allocs = 0;
+#endif
+
+using namespace nx;
+
+namespace {
+
+struct Options {
+    bool        json      = false;
+    std::string filter    = "";
+    double      minTimeMs = 200;
+};
+
+struct Result {
+    std::string name;
+    uint64_t    iterations;
+    double      nsPerOp;
+    double      gbPerSecond;
+    double      allocsPerOp;
+};
+
+volatile uint64_t g_sink = 0;
+
+/**
+ * @brief run fn in batches until minTimeMs is reached, repeat 5 times and keep the fastest.
+ *
+ * @param bytesPerOp bytes processed by one call of fn, 0 if throughput is meaningless.
+ */
+Result run( const Options &options, const std::string &name, size_t bytesPerOp, const std::function<void()> &fn ) {
+    typedef std::chrono::steady_clock clock;
+    // calibrate
+    uint64_t iterations = 1;
+    while ( true ) {
+        auto begin = clock::now();
+        for ( uint64_t i = 0; i < iterations; i++ ) fn();
+        double elapsed = std::chrono::duration<double, std::milli>( clock::now() - begin ).count();
+        if ( elapsed >= options.minTimeMs / 5 || iterations >= ( 1ull << 32 ) ) break;
+        iterations *= elapsed > 0 ? std::min<uint64_t>( 10, (uint64_t)( options.minTimeMs / 5 / elapsed ) + 1 ) : 10;
+    }
+
+    double   best   = 1e300;
+    uint64_t allocs = 0;
+    for ( int repeat = 0; repeat < 5; repeat++ ) {
+        uint64_t allocsBefore = g_allocs;
+        auto     begin        = clock::now();
+        for ( uint64_t i = 0; i < iterations; i++ ) fn();
+        double elapsed = std::chrono::duration<double, std::nano>( clock::now() - begin ).count();
+        allocs         = g_allocs - allocsBefore;
+        if ( elapsed < best ) best = elapsed;
+    }
+
+    Result result;
+    result.name        = name;
+    result.iterations  = iterations;
+    result.nsPerOp     = best / iterations;
+    result.gbPerSecond = bytesPerOp ? bytesPerOp / result.nsPerOp : 0;
+    result.allocsPerOp = BENCH_COUNT_ALLOCS ? (double)allocs / iterations : -1;
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------
+// synthetic h264 / aac input
+
+struct VideoProfile {
+    const char *name;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    bitrate; // bits per second
+};
+
+const VideoProfile kProfiles[] = {
+    { "360p", 640, 360, 800000 },
+    { "720p", 1280, 720, 2500000 },
+    { "1080p", 1920, 1080, 5000000 },
+    { "2160p", 3840, 2160, 20000000 },
+};
+
+const int kFps = 30;
+const int kGop = 60;
+
+struct VideoStream {
+    std::vector<uint8_t>              sps;
+    std::vector<uint8_t>              pps;
+    std::vector<std::vector<uint8_t>> frames; // one gop, annex-b, frame 0 carries sps and pps
+};
+
+// key frame is 5 times an inter frame, one gop matches the profile bitrate
+VideoStream make_video( const VideoProfile &profile, uint64_t seed ) {
+    FlvSynthVideoConfig config;
+    config.width     = profile.width;
+    config.height    = profile.height;
+    config.bitrate   = profile.bitrate;
+    config.fps       = kFps;
+    config.gopLength = kGop;
+    config.seed      = seed;
+    FlvSynthVideo video( config );
+
+    VideoStream stream;
+    stream.sps = video.sps();
+    stream.pps = video.pps();
+    FlvSynthFrame frame;
+    for ( int i = 0; i < kGop; i++ ) {
+        video.next( frame );
+        stream.frames.push_back( frame.data );
+    }
+    return stream;
+}
+
+// 48kHz stereo, 128 kbps, 1024 samples per frame
+std::vector<std::vector<uint8_t>> make_audio( int count, uint64_t seed ) {
+    FlvSynthAudioConfig config;
+    config.seed = seed;
+    FlvSynthAudio                     audio( config );
+    std::vector<std::vector<uint8_t>> frames;
+    FlvSynthFrame                     frame;
+    for ( int i = 0; i < count; i++ ) {
+        audio.next( frame );
+        frames.push_back( frame.data );
+    }
+    return frames;
+}
+
+struct NullHandler : public FlvMuxerDataHandler {
+    uint64_t bytes = 0;
+    void     onMuxedFlvHeader( void *context, uint8_t *data, size_t bytes ) override {
+        this->bytes += bytes;
+    }
+    void onMuxedData( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) override {
+        this->bytes += bytes + data[bytes - 1];
+    }
+    void onUpdateMuxedData( void *context, size_t offsetFromStart, const uint8_t *data, size_t bytes ) override {}
+    void onEndMuxing() override {}
+    void onMuxedBatch( void *context, const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) override {
+        this->bytes += bytes + data[bytes - 1];
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+
+void print_result( const Options &options, const Result &result, bool first ) {
+    if ( options.json ) {
+        printf( "%s\n  {\"name\": \"%s\", \"iterations\": %" PRIu64 ", \"ns_per_op\": %.3f, \"gb_per_s\": %.4f, \"allocs_per_op\": %.3f}",
+                first ? "" : ",", result.name.c_str(), result.iterations, result.nsPerOp, result.gbPerSecond, result.allocsPerOp );
+    }
+    else {
+        char allocs[32];
+        if ( result.allocsPerOp < 0 )
+            snprintf( allocs, sizeof( allocs ), "n/a" );
+        else
+            snprintf( allocs, sizeof( allocs ), "%.2f", result.allocsPerOp );
+        printf( "%-40s %14.1f %10.3f %12s\n", result.name.c_str(), result.nsPerOp, result.gbPerSecond, allocs );
+    }
+    fflush( stdout );
+}
+
+} // namespace
+
+int main( int argc, char **argv ) {
+    Options options;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( !strcmp( argv[i], "--json" ) ) {
+            options.json = true;
+        }
+        else if ( !strcmp( argv[i], "--filter" ) && i + 1 < argc ) {
+            options.filter = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--min-time" ) && i + 1 < argc ) {
+            options.minTimeMs = atof( argv[++i] );
+        }
+        else {
+            fprintf( stderr, "usage: %s [--json] [--filter <substring>] [--min-time <ms>]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::pair<size_t, std::function<void()>>>> cases;
+    auto add = [&]( const std::string &name, size_t bytes, std::function<void()> fn ) {
+        if ( name.find( options.filter ) == std::string::npos ) return;
+        cases.push_back( std::make_pair( name, std::make_pair( bytes, fn ) ) );
+    };
+
+    std::vector<VideoStream> streams;
+    for ( const auto &profile : kProfiles ) streams.push_back( make_video( profile, profile.width ) );
+
+    // avc_find_startcode, scan a whole slice which contains no start code
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        std::vector<uint8_t> &frame = streams[p].frames[1];
+        add( std::string( "avc_find_startcode/" ) + kProfiles[p].name, frame.size() - 4, [&frame]() {
+            uint8_t *found = avc_find_startcode( &frame[4], &frame[0] + frame.size() - 1 );
+            g_sink = g_sink + (uintptr_t)found;
+        } );
+    }
+    // split_nalus
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        std::vector<uint8_t> &key   = streams[p].frames[0];
+        std::vector<uint8_t> &inter = streams[p].frames[1];
+        add( std::string( "split_nalus/key/" ) + kProfiles[p].name, key.size(), [&key]() {
+            std::vector<NaluBuffer> nalus;
+            split_nalus( &key[0], (uint32_t)key.size(), nalus );
+            g_sink = g_sink + nalus.size();
+        } );
+        add( std::string( "split_nalus/inter/" ) + kProfiles[p].name, inter.size(), [&inter]() {
+            std::vector<NaluBuffer> nalus;
+            split_nalus( &inter[0], (uint32_t)inter.size(), nalus );
+            g_sink = g_sink + nalus.size();
+        } );
+    }
+    // avc_extract_rbsp_from_nalu on a slice
+    {
+        std::vector<uint8_t> &frame = streams[2].frames[1];
+        add( "avc_extract_rbsp_from_nalu/1080p", frame.size() - 4, [&frame]() {
+            uint32_t rbspSize = 0;
+            uint8_t *rbsp     = avc_extract_rbsp_from_nalu( &frame[4], (uint32_t)frame.size() - 4, &rbspSize );
+            g_sink = g_sink + rbspSize;
+            free( rbsp );
+        } );
+        // into a reused buffer, the bulk path of large sei payloads
+        auto rbsp = std::make_shared<std::vector<uint8_t>>( frame.size() );
+        add( "avc_unescape_rbsp/1080p", frame.size() - 5, [&frame, rbsp]() {
+            g_sink = g_sink + avc_unescape_rbsp( &frame[5], frame.size() - 5, &( *rbsp )[0] );
+        } );
+    }
+    // avc_decode_sps
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        std::vector<uint8_t> &sps = streams[p].sps;
+        add( std::string( "avc_decode_sps/" ) + kProfiles[p].name, sps.size(), [&sps]() {
+            H264SPS h264sps;
+            avc_decode_sps( &h264sps, &sps[0], (uint32_t)sps.size() );
+            g_sink = g_sink + h264sps.pic_width_in_mbs;
+        } );
+    }
+    // put_bits / get_bits, 1 KiB of mixed width fields
+    {
+        static uint8_t   bits[1024];
+        static const int widths[] = { 1, 3, 8, 13, 5, 2, 16, 24 };
+        add( "put_bits/1KiB", sizeof( bits ), []() {
+            PutBitsContext context = PutBitsContext( bits, sizeof( bits ) );
+            // 72 bits per round, 113 rounds fill 1017 bytes
+            for ( int round = 0; round < 113; round++ ) {
+                for ( int w : widths ) context.put_bits( w, (uint32_t)( round * 2654435761u ) );
+            }
+        } );
+        add( "get_bits/1KiB", sizeof( bits ), []() {
+            GetBitContext context = GetBitContext( bits, sizeof( bits ) );
+            uint32_t      sum     = 0;
+            for ( int round = 0; round < 113; round++ ) {
+                for ( int w : widths ) sum += context.get_bits( w );
+            }
+            g_sink = g_sink + sum;
+        } );
+    }
+    // amf writers, the onMetaData properties
+    {
+        add( "amf_put_named_double/x16", 16 * 8, []() {
+            AMF_BUFFER buf;
+            for ( int i = 0; i < 16; i++ ) amf_put_named_double( "audiosamplerate", 48000.0 + i, buf );
+            g_sink = g_sink + buf.size();
+        } );
+        add( "amf_put_named_ecma_array/onMetaData", 0, []() {
+            AMF_BUFFER elems;
+            amf_put_named_double( "duration", 3600, elems );
+            amf_put_named_double( "filesize", 1e9, elems );
+            amf_put_named_double( "audiocodecid", 10, elems );
+            amf_put_named_bool( "stereo", true, elems );
+            amf_put_named_double( "videocodecid", 7, elems );
+            amf_put_named_double( "width", 1920, elems );
+            amf_put_named_double( "height", 1080, elems );
+            amf_put_named_string( "encoder", "libflv", elems );
+            AMF_BUFFER buf;
+            amf_put_named_ecma_array( "onMetaData", 8, elems, buf );
+            g_sink = g_sink + buf.size();
+        } );
+    }
+    // mux_aac
+    {
+        auto audio   = std::make_shared<std::vector<std::vector<uint8_t>>>( make_audio( 64, 1 ) );
+        auto handler = std::make_shared<NullHandler>();
+        auto muxer   = std::make_shared<FlvMuxer>( true, false, handler );
+        auto index   = std::make_shared<uint32_t>( 0 );
+        add( "mux_aac/48k_128kbps", ( *audio )[0].size(), [audio, handler, muxer, index]() {
+            uint32_t              i     = *index;
+            std::vector<uint8_t> &frame = ( *audio )[i % audio->size()];
+            muxer->mux_aac( &frame[0], frame.size(), (uint32_t)( (uint64_t)i * 1024 * 1000 / 48000 ) );
+            *index = i + 1;
+        } );
+    }
+    // mux_avc, one call per frame cycling through a gop
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        VideoStream *stream = &streams[p];
+        size_t       bytes  = 0;
+        for ( auto &frame : stream->frames ) bytes += frame.size();
+        auto handler = std::make_shared<NullHandler>();
+        auto muxer   = std::make_shared<FlvMuxer>( false, true, handler );
+        auto index   = std::make_shared<uint32_t>( 0 );
+        add( std::string( "mux_avc/" ) + kProfiles[p].name, bytes / stream->frames.size(), [stream, handler, muxer, index]() {
+            uint32_t              i     = *index;
+            std::vector<uint8_t> &frame = stream->frames[i % kGop];
+            uint32_t              ts    = (uint32_t)( (uint64_t)i * 1000 / kFps );
+            muxer->mux_avc( &frame[0], frame.size(), ts, ts, i % kGop == 0 );
+            *index = i + 1;
+        } );
+    }
+    // mux_batch, a whole gop per call, compare GB/s with mux_avc
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        VideoStream *stream = &streams[p];
+        size_t       bytes  = 0;
+        for ( auto &frame : stream->frames ) bytes += frame.size();
+        auto handler = std::make_shared<NullHandler>();
+        auto muxer   = std::make_shared<FlvMuxer>( false, true, handler );
+        auto index   = std::make_shared<uint32_t>( 0 );
+        auto batch   = std::make_shared<std::vector<FlvFrame>>( kGop );
+        add( std::string( "mux_batch/gop/" ) + kProfiles[p].name, bytes, [stream, handler, muxer, index, batch]() {
+            for ( int j = 0; j < kGop; j++ ) {
+                uint32_t              i     = *index + j;
+                std::vector<uint8_t> &frame = stream->frames[j];
+                uint32_t              ts    = (uint32_t)( (uint64_t)i * 1000 / kFps );
+                ( *batch )[j]               = { 9, &frame[0], frame.size(), ts, ts, j == 0 };
+            }
+            muxer->mux_batch( &( *batch )[0], kGop );
+            *index += kGop;
+        } );
+    }
+    // mux_avc with the tag and nalu buffers reused from a pool
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        VideoStream *stream = &streams[p];
+        size_t       bytes  = 0;
+        for ( auto &frame : stream->frames ) bytes += frame.size();
+        auto pool    = std::make_shared<FlvPoolResource>( 4 << 20 );
+        auto handler = std::make_shared<NullHandler>();
+        // the deleter keeps the pool alive until the muxer is gone
+        auto muxer = std::shared_ptr<FlvMuxer>( new FlvMuxer( false, true, handler, pool.get() ), [pool]( FlvMuxer *muxer ) { delete muxer; } );
+        auto index = std::make_shared<uint32_t>( 0 );
+        add( std::string( "mux_avc/pool/" ) + kProfiles[p].name, bytes / stream->frames.size(), [stream, handler, muxer, index]() {
+            uint32_t              i     = *index;
+            std::vector<uint8_t> &frame = stream->frames[i % kGop];
+            uint32_t              ts    = (uint32_t)( (uint64_t)i * 1000 / kFps );
+            muxer->mux_avc( &frame[0], frame.size(), ts, ts, i % kGop == 0 );
+            *index = i + 1;
+        } );
+    }
+    // mux_avc with an inlined memory sink instead of the weak_ptr and virtual handler, compare with mux_avc
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        VideoStream *stream = &streams[p];
+        size_t       bytes  = 0;
+        for ( auto &frame : stream->frames ) bytes += frame.size();
+        auto output = std::make_shared<std::vector<uint8_t>>();
+        // the deleter keeps the output alive until the muxer is gone
+        auto muxer = std::shared_ptr<BasicFlvMuxer<FlvMemorySink>>( new BasicFlvMuxer<FlvMemorySink>( false, true, FlvMemorySink( *output ) ), [output]( BasicFlvMuxer<FlvMemorySink> *muxer ) { delete muxer; } );
+        auto index = std::make_shared<uint32_t>( 0 );
+        add( std::string( "mux_avc/memory/" ) + kProfiles[p].name, bytes / stream->frames.size(), [stream, output, muxer, index]() {
+            uint32_t              i     = *index;
+            std::vector<uint8_t> &frame = stream->frames[i % kGop];
+            uint32_t              ts    = (uint32_t)( (uint64_t)i * 1000 / kFps );
+            output->clear();
+            muxer->mux_avc( &frame[0], frame.size(), ts, ts, i % kGop == 0 );
+            *index = i + 1;
+        } );
+    }
+    // pull mode mux_avc into one reused output buffer, no callback and no tag buffer
+    for ( size_t p = 0; p < streams.size(); p++ ) {
+        VideoStream *stream = &streams[p];
+        size_t       bytes  = 0;
+        for ( auto &frame : stream->frames ) bytes += frame.size();
+        auto muxer  = std::make_shared<FlvPullMuxer>( false, true );
+        auto output = std::make_shared<std::vector<uint8_t>>( 1 << 20 );
+        auto index  = std::make_shared<uint32_t>( 0 );
+        add( std::string( "mux_avc/pull/" ) + kProfiles[p].name, bytes / stream->frames.size(), [stream, muxer, output, index]() {
+            uint32_t              i     = *index;
+            std::vector<uint8_t> &frame = stream->frames[i % kGop];
+            uint32_t              ts    = (uint32_t)( (uint64_t)i * 1000 / kFps );
+            int64_t               n     = muxer->mux_avc( &frame[0], frame.size(), ts, ts, i % kGop == 0, &( *output )[0], output->size() );
+            if ( n < 0 ) {
+                output->resize( -n );
+                n = muxer->mux_avc( &frame[0], frame.size(), ts, ts, i % kGop == 0, &( *output )[0], output->size() );
+            }
+            g_sink = g_sink + n;
+            *index = i + 1;
+        } );
+    }
+
+    if ( options.json ) {
+        printf( "{\"benchmarks\": [" );
+    }
+    else {
+        printf( "%-40s %14s %10s %12s\n", "benchmark", "ns/op", "GB/s", "allocs/op" );
+    }
+    bool first = true;
+    for ( auto &item : cases ) {
+        Result result = run( options, item.first, item.second.first, item.second.second );
+        print_result( options, result, first );
+        first = false;
+    }
+    if ( options.json ) printf( "\n]}\n" );
+    return 0;
+}
@@ -162,4 +162,22 @@ void AudioSpecificConfig::to_buf( uint8_t buf[2] ) {
     context.put_bits( 1, extensionFlag );
 }
 
+int AudioSpecificConfig::parse( const uint8_t *buf, size_t size ) {
+    if ( size < 2 ) return -1;
+    GetBitContext context        = GetBitContext( buf, 2 );
+    this->audioObjectType        = context.get_bits( 5 );
+    this->samplingFrequencyIndex = context.get_bits( 4 );
+    this->channelConfiguration   = context.get_bits( 4 );
+    this->frameLengthFlag        = context.get_bits( 1 );
+    this->dependsOnCoreCoder     = context.get_bits( 1 );
+    this->extensionFlag          = context.get_bits( 1 );
+    return samplingFrequencyIndex < 12 ? 0 : -1;
+}
+
+uint32_t AudioSpecificConfig::sampleRate() const {
+    adts_header header;
+    header.fixed_header.sampling_frequency_index = samplingFrequencyIndex;
+    return adts_header::sampleRate( header );
+}
+
 }; // namespace nx
@@ -1,6 +1,7 @@
 #ifndef __AAC_H__
 #define __AAC_H__
 
+#include <cstdint>
 #include <cstdlib>
 
 namespace nx {
@@ -124,6 +125,13 @@ struct AudioSpecificConfig {
     AudioSpecificConfig() = default;
     AudioSpecificConfig( uint8_t adts_header_buf[7] );
     void to_buf( uint8_t buf[2] );
+    /**
+     * @brief parse the first 2 bytes, e.g. the body of an aac sequence header tag.
+     *
+     * @return 0: success, <0: too short or unknown sampling frequency index.
+     */
+    int      parse( const uint8_t *buf, size_t size );
+    uint32_t sampleRate() const;
 };
 
 };     // namespace nx
@@ -1,4 +1,5 @@
 #include "amf.h"
+#include <cstring>
 
 namespace nx {
 void amf_put_double( double value, AMF_BUFFER &buf ) {
@@ -69,6 +70,23 @@ void amf_put_named_string( const char *name, const char *value, AMF_BUFFER &buf
     amf_put_string( value, buf );
 }
 
+void amf_put_named_double_array( const char *name, const std::vector<double> &values, AMF_BUFFER &buf ) {
+    amf_put_string_without_type( name, buf );
+    // type
+    uint8_t type = AMFType::StrictArray;
+    buf.push_back( type );
+    // big endian length
+    uint32_t length = (uint32_t)values.size();
+    uint8_t *p      = (uint8_t *)&length;
+    for ( int i = 0; i < 4; i++ ) {
+        buf.push_back( p[4 - i - 1] );
+    }
+    // content
+    for ( double value : values ) {
+        amf_put_double( value, buf );
+    }
+}
+
 void amf_put_named_object( const char *name, const AMF_BUFFER &obj, AMF_BUFFER &buf ) {
     amf_put_string_without_type( name, buf );
     // type
@@ -93,4 +111,110 @@ void amf_put_named_ecma_array( const char *name, uint32_t length, const AMF_BUFF
     // obj end
     amf_put_obj_end( buf );
 }
+
+static double amf_read_double( const uint8_t *p ) {
+    // from big endian double
+    double   value;
+    uint8_t *v = (uint8_t *)&value;
+    for ( int i = 0; i < 8; i++ ) {
+        v[i] = p[8 - i - 1];
+    }
+    return value;
+}
+
+static uint32_t amf_read_u32( const uint8_t *p ) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+struct AMFSearch {
+    const char          *name;
+    std::vector<double> &values;
+    bool                 found;
+};
+
+/**
+ * @brief parse the value at p, look for search.name in it.
+ *
+ * @param key  property name of the value, null for array elements and top level values
+ * @return end of the value, null if malformed
+ */
+static const uint8_t *amf_search_value( const uint8_t *p, const uint8_t *end, const char *key, size_t keyLength, AMFSearch &search, int depth ) {
+    if ( p >= end || depth > 16 ) return nullptr;
+    uint8_t type = *p++;
+    switch ( type ) {
+    case AMFType::Number:
+        return end - p >= 8 ? p + 8 : nullptr;
+    case AMFType::Boolean:
+        return end - p >= 1 ? p + 1 : nullptr;
+    case AMFType::String: {
+        if ( end - p < 2 ) return nullptr;
+        size_t length = (size_t)p[0] << 8 | p[1];
+        return (size_t)( end - p ) >= 2 + length ? p + 2 + length : nullptr;
+    }
+    case AMFType::LongString: {
+        if ( end - p < 4 ) return nullptr;
+        size_t length = amf_read_u32( p );
+        return (size_t)( end - p ) >= 4 + length ? p + 4 + length : nullptr;
+    }
+    case AMFType::Null:
+    case AMFType::Undefined:
+        return p;
+    case AMFType::Reference:
+        return end - p >= 2 ? p + 2 : nullptr;
+    case AMFType::Date:
+        // double and 2 bytes time zone
+        return end - p >= 10 ? p + 10 : nullptr;
+    case AMFType::ECMAArray:
+        // the count is a hint, the properties end with object end like an object
+        if ( end - p < 4 ) return nullptr;
+        p += 4;
+        // fall through
+    case AMFType::Object:
+        while ( true ) {
+            if ( end - p < 3 ) return nullptr;
+            size_t length = (size_t)p[0] << 8 | p[1];
+            if ( length == 0 && p[2] == AMFType::ObjEnd ) return p + 3;
+            if ( (size_t)( end - p ) < 2 + length ) return nullptr;
+            const char *name = (const char *)p + 2;
+            p                = amf_search_value( p + 2 + length, end, name, length, search, depth + 1 );
+            if ( !p || search.found ) return p;
+        }
+    case AMFType::StrictArray: {
+        if ( end - p < 4 ) return nullptr;
+        uint32_t count   = amf_read_u32( p );
+        bool     matched = key && keyLength == strlen( search.name ) && memcmp( key, search.name, keyLength ) == 0;
+        p += 4;
+        if ( matched ) search.values.clear();
+        for ( uint32_t i = 0; i < count; i++ ) {
+            if ( matched && p < end && *p == AMFType::Number && end - p >= 9 ) {
+                search.values.push_back( amf_read_double( p + 1 ) );
+            }
+            else {
+                matched = false;
+            }
+            p = amf_search_value( p, end, nullptr, 0, search, depth + 1 );
+            if ( !p || search.found ) return p;
+        }
+        search.found = matched;
+        return p;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+int amf_get_named_double_array( const uint8_t *buf, size_t size, const char *name, std::vector<double> &values ) {
+    AMFSearch      search = { name, values, false };
+    const uint8_t *p      = buf;
+    const uint8_t *end    = buf + size;
+    while ( p && p < end && !search.found ) {
+        p = amf_search_value( p, end, nullptr, 0, search, 0 );
+    }
+    if ( !search.found ) {
+        values.clear();
+        return -1;
+    }
+    return 0;
+}
+
 } // namespace nx
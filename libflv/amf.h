@@ -1,8 +1,12 @@
 #ifndef __AMF_H__
 #define __AMF_H__
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+#include "flv_memory.h"
+
 // refer to: https://rtmp.veriskope.com/pdf/amf0-file-format-specification.pdf
 
 namespace nx {
@@ -24,7 +28,8 @@ enum AMFType {
     LongString
 };
 
-using AMF_BUFFER = std::vector<uint8_t>;
+// allocated from the default resource, or from the resource given to the constructor, e.g. AMF_BUFFER buf( resource )
+using AMF_BUFFER = std::vector<uint8_t, FlvAllocator<uint8_t>>;
 
 void amf_put_double( double value, AMF_BUFFER &buf );
 void amf_put_bool( bool value, AMF_BUFFER &buf );
@@ -34,6 +39,14 @@ void amf_put_obj_end( AMF_BUFFER &buf );
 void amf_put_named_double( const char *name, double value, AMF_BUFFER &buf );
 void amf_put_named_bool( const char *name, bool value, AMF_BUFFER &buf );
 void amf_put_named_string( const char *name, const char *value, AMF_BUFFER &buf );
+/**
+ * @brief put strict array of numbers in buf
+ *
+ * @param name strict array name
+ * @param values numbers of the array
+ * @param buf dst buf
+ */
+void amf_put_named_double_array( const char *name, const std::vector<double> &values, AMF_BUFFER &buf );
 /**
  * @brief put amf object in buf
  *
@@ -52,6 +65,18 @@ void amf_put_named_object( const char *name, const AMF_BUFFER &obj, AMF_BUFFER &
  */
 void amf_put_named_ecma_array( const char *name, uint32_t length, const AMF_BUFFER &properties, AMF_BUFFER &buf );
 
+/**
+ * @brief find a strict array of numbers by name, objects and ecma arrays are searched recursively.
+ * e.g. keyframes.filepositions in onMetaData.
+ *
+ * @param buf amf values, e.g. the data of a script tag
+ * @param size buf length
+ * @param name strict array name
+ * @param values numbers of the array
+ * @return 0: found, <0: not found or malformed amf data
+ */
+int amf_get_named_double_array( const uint8_t *buf, size_t size, const char *name, std::vector<double> &values );
+
 };     // namespace nx
 
 #endif // __AMF_H__
@@ -1,6 +1,11 @@
 #include "avc.h"
 #include "get_bits.h"
+#include <cassert>
+#include <cstdlib>
 #include <memory>
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
 
 namespace nx {
 
@@ -45,6 +50,18 @@ AVCDecoderConfigurationRecord::AVCDecoderConfigurationRecord( uint8_t *spsNalu,
     assert( ret == 0 );
     if ( ret < 0 ) return;
 
+    init( h264sps, spsNalu, spsLength, ppsNalu, ppsLength );
+}
+
+AVCDecoderConfigurationRecord::AVCDecoderConfigurationRecord( const H264SPS &h264sps,
+                                                              uint8_t *spsNalu, uint16_t spsLength,
+                                                              uint8_t *ppsNalu, uint16_t ppsLength ) {
+    init( h264sps, spsNalu, spsLength, ppsNalu, ppsLength );
+}
+
+void AVCDecoderConfigurationRecord::init( const H264SPS &h264sps,
+                                          uint8_t *spsNalu, uint16_t spsLength,
+                                          uint8_t *ppsNalu, uint16_t ppsLength ) {
     this->AVCProfileIndication  = h264sps.profile_idc;
     this->profile_compatibility = h264sps.compatibility;
     this->AVCLevelIndication    = h264sps.level_idc;
@@ -164,7 +181,11 @@ uint8_t *avc_find_startcode( uint8_t *p, uint8_t *end ) {
     return NULL;
 }
 
-void split_nalus( uint8_t *buf, uint32_t size, std::vector<NaluBuffer> &nalus ) {
+/**
+ * @brief call add( nalu, size ) for each nal unit of an annex-b buffer, without trailing zeros.
+ */
+template <typename Add>
+static void for_each_nalu( uint8_t *buf, uint32_t size, Add add ) {
     uint8_t *startCode = avc_find_startcode( buf, buf + size - 1 );
     if ( !startCode ) return;
     while ( startCode ) {
@@ -187,33 +208,73 @@ void split_nalus( uint8_t *buf, uint32_t size, std::vector<NaluBuffer> &nalus )
         // save buffer
         {
             intptr_t nalLength = naluEnd - naluStart + 1;
-            nalus.emplace_back( naluStart, nalLength );
+            add( naluStart, (uint32_t)nalLength );
         }
         // update cur start code
         startCode = nextStartCode;
     }
 }
 
-uint8_t *avc_extract_rbsp_from_nalu( const uint8_t *nalu, uint32_t nalu_size, uint32_t *rbsp_size ) {
-    uint8_t *rbsp = (uint8_t *)calloc( nalu_size, 1 );
-    if ( !rbsp ) return NULL;
-    uint32_t i   = 1; // skip nalu header 1 byte
-    uint32_t len = 0;
-    while ( i + 2 < nalu_size ) {
-        // 00 00 03， 03 should be skipped
-        if ( !nalu[i] && !nalu[i + 1] && nalu[i + 2] == 3 ) {
-            rbsp[len++] = nalu[i++];
-            rbsp[len++] = nalu[i++];
-            i++; // remove emulation_prevention_three_byte
+void split_nalus( uint8_t *buf, uint32_t size, std::vector<NaluBuffer> &nalus ) {
+    for_each_nalu( buf, size, [&nalus]( uint8_t *nalu, uint32_t naluSize ) {
+        nalus.emplace_back( nalu, naluSize );
+    } );
+}
+
+void split_nalus( uint8_t *buf, uint32_t size, NaluBufferList &nalus ) {
+    FlvMemoryResource *resource = nalus.get_allocator().resource;
+    for_each_nalu( buf, size, [&nalus, resource]( uint8_t *nalu, uint32_t naluSize ) {
+        nalus.emplace_back( nalu, naluSize, resource );
+    } );
+}
+
+void find_nalus( uint8_t *buf, uint32_t size, std::vector<NaluRange> &nalus ) {
+    for_each_nalu( buf, size, [&nalus]( uint8_t *nalu, uint32_t naluSize ) {
+        nalus.push_back( { nalu, naluSize } );
+    } );
+}
+
+void find_nalus( uint8_t *buf, uint32_t size, NaluRangeList &nalus ) {
+    for_each_nalu( buf, size, [&nalus]( uint8_t *nalu, uint32_t naluSize ) {
+        nalus.push_back( { nalu, naluSize } );
+    } );
+}
+
+size_t avc_unescape_rbsp( const uint8_t *src, size_t size, uint8_t *dst ) {
+    size_t i     = 0;
+    size_t len   = 0;
+    int    zeros = 0;
+    while ( i < size ) {
+#if defined( __SSE2__ )
+        // 16 bytes without a zero byte cannot contain an escape, copy them at once
+        if ( !zeros && i + 16 <= size ) {
+            __m128i block = _mm_loadu_si128( (const __m128i *)( src + i ) );
+            int     mask  = _mm_movemask_epi8( _mm_cmpeq_epi8( block, _mm_setzero_si128() ) );
+            // len <= i, so dst has room for the whole block
+            _mm_storeu_si128( (__m128i *)( dst + len ), block );
+            int bytes = mask ? __builtin_ctz( mask ) : 16;
+            i += bytes;
+            len += bytes;
+            if ( !mask ) continue;
         }
-        else {
-            rbsp[len++] = nalu[i++];
+#endif
+        uint8_t byte = src[i++];
+        // 00 00 03, 03 should be skipped
+        if ( zeros >= 2 && byte == 3 ) {
+            zeros = 0;
+            continue;
         }
+        dst[len++] = byte;
+        zeros      = byte ? 0 : zeros + 1;
     }
-    while ( i < nalu_size ) {
-        rbsp[len++] = nalu[i++];
-    }
-    *rbsp_size = len;
+    return len;
+}
+
+uint8_t *avc_extract_rbsp_from_nalu( const uint8_t *nalu, uint32_t nalu_size, uint32_t *rbsp_size ) {
+    uint8_t *rbsp = (uint8_t *)malloc( nalu_size ? nalu_size : 1 );
+    if ( !rbsp ) return NULL;
+    // skip nalu header 1 byte
+    *rbsp_size = nalu_size ? (uint32_t)avc_unescape_rbsp( nalu + 1, nalu_size - 1, rbsp ) : 0;
     return rbsp;
 }
 /*
@@ -221,28 +282,32 @@ refer to ffmpeg: libavformat/avc.c
 int ff_avc_decode_sps(H264SPS *sps, const uint8_t *buf, int buf_size)
 */
 int avc_decode_sps( H264SPS *sps, const uint8_t *sps_nalu, uint32_t sps_nalu_size ) {
-    uint32_t dst_len = 0;
-    uint8_t *rbsp    = avc_extract_rbsp_from_nalu( sps_nalu, sps_nalu_size, &dst_len );
-    if ( !rbsp ) return -1;
+    if ( sps_nalu_size < 2 ) return -1;
     memset( sps, 0, sizeof( *sps ) );
 
-    GetBitContext bitContext = GetBitContext( rbsp, dst_len );
+    // read in place, skip the nalu header and the emulation prevention bytes
+    GetBitContext bitContext = GetBitContext( sps_nalu + 1, sps_nalu_size - 1, true );
+    uint8_t separate_colour_plane_flag = 0;
     // profile
     sps->profile_idc = bitContext.get_bits( 8 );
     // compatibility
     sps->compatibility = bitContext.get_bits( 8 );
     // level
     sps->level_idc = bitContext.get_bits( 8 );
-    // id
-    sps->id = bitContext.get_ue_golomb();
+    // id, checked before it is narrowed to the field
+    uint32_t id = bitContext.get_ue_golomb();
+    if ( id > 31 ) return -1;
+    sps->id = (uint8_t)id;
 
     if ( sps->profile_idc == 100 || sps->profile_idc == 110 || sps->profile_idc == 122 || sps->profile_idc == 244 || sps->profile_idc == 44 || sps->profile_idc == 83 || sps->profile_idc == 86 || sps->profile_idc == 118 || sps->profile_idc == 128 || sps->profile_idc == 138 || sps->profile_idc == 139 || sps->profile_idc == 134 ) {
         sps->chroma_format_idc = bitContext.get_ue_golomb();
+        if ( sps->chroma_format_idc > 3 ) return -1;
         if ( sps->chroma_format_idc == 3 ) {
-            bitContext.skip_bits( 1 ); // separate_colour_plane_flag
+            separate_colour_plane_flag = bitContext.get_bit1();
         }
         sps->bit_depth_luma_minus8   = bitContext.get_ue_golomb();
         sps->bit_depth_chroma_minus8 = bitContext.get_ue_golomb();
+        if ( sps->bit_depth_luma_minus8 > 6 || sps->bit_depth_chroma_minus8 > 6 ) return -1;
         // qpprime_y_zero_transform_bypass_flag
         bitContext.skip_bits( 1 );
         uint8_t seq_scaling_matrix_present_flag = bitContext.get_bit1();
@@ -270,11 +335,15 @@ int avc_decode_sps( H264SPS *sps, const uint8_t *sps_nalu, uint32_t sps_nalu_siz
         // offset_for_top_to_bottom_field
         bitContext.get_se_golomb();
         uint32_t num_ref_frames_in_pic_order_cnt_cycle = bitContext.get_ue_golomb();
+        if ( num_ref_frames_in_pic_order_cnt_cycle > 255 ) return -1;
         for ( int i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; i++ ) {
             // offset_for_ref_frame
             bitContext.get_se_golomb();
         }
     }
+    else if ( pic_order_cnt_type != 2 ) {
+        return -1;
+    }
     // max_num_ref_frames
     bitContext.get_ue_golomb();
     // gaps_in_frame_num_value_allowed_flag
@@ -287,6 +356,7 @@ int avc_decode_sps( H264SPS *sps, const uint8_t *sps_nalu, uint32_t sps_nalu_siz
     }
 
     uint8_t frame_mbs_only_flag = bitContext.get_bit1();
+    sps->frame_mbs_only_flag    = frame_mbs_only_flag;
     if ( !frame_mbs_only_flag ) {
         // mb_adaptive_frame_field_flag
         bitContext.get_bit1();
@@ -295,15 +365,60 @@ int avc_decode_sps( H264SPS *sps, const uint8_t *sps_nalu, uint32_t sps_nalu_siz
     bitContext.get_bit1();
     uint8_t frame_cropping_flag = bitContext.get_bit1();
     if ( frame_cropping_flag ) {
+        // the offsets are in chroma samples, 7.4.2.1.1 CropUnitX and CropUnitY
+        uint32_t crop_unit_x = 1;
+        uint32_t crop_unit_y = 2 - frame_mbs_only_flag;
+        if ( !separate_colour_plane_flag && sps->chroma_format_idc ) {
+            crop_unit_x = sps->chroma_format_idc == 3 ? 1 : 2;
+            crop_unit_y *= sps->chroma_format_idc == 1 ? 2 : 1;
+        }
+        sps->frame_crop_left_offset   = crop_unit_x * bitContext.get_ue_golomb();
+        sps->frame_crop_right_offset  = crop_unit_x * bitContext.get_ue_golomb();
+        sps->frame_crop_top_offset    = crop_unit_y * bitContext.get_ue_golomb();
+        sps->frame_crop_bottom_offset = crop_unit_y * bitContext.get_ue_golomb();
+    }
+    // truncated or corrupt
+    if ( bitContext.has_error() ) return -1;
+    return 0;
+}
 
-        sps->frame_crop_left_offset   = bitContext.get_ue_golomb();
-        sps->frame_crop_right_offset  = bitContext.get_ue_golomb();
-        sps->frame_crop_top_offset    = bitContext.get_ue_golomb();
-        sps->frame_crop_bottom_offset = bitContext.get_ue_golomb();
+int avc_parse_sei( const uint8_t *sei_nalu, uint32_t sei_nalu_size, AvcSeiMessage *messages, int maxMessages ) {
+    if ( sei_nalu_size < 2 ) return -1;
+    const uint8_t *end        = sei_nalu + sei_nalu_size;
+    GetBitContext  bitContext = GetBitContext( sei_nalu + 1, sei_nalu_size - 1, true );
+    int            count      = 0;
+    while ( count < maxMessages ) {
+        // more_rbsp_data, only the rbsp_trailing_bits are left
+        const uint8_t *p = bitContext.position();
+        if ( p == end || ( p + 1 == end && *p == 0x80 ) ) break;
+        // ff bytes, then the last byte
+        uint32_t payloadType = 0;
+        uint32_t payloadSize = 0;
+        uint32_t byte;
+        while ( ( byte = bitContext.get_bits( 8 ) ) == 0xFF && !bitContext.has_error() ) payloadType += 255;
+        payloadType += byte;
+        while ( ( byte = bitContext.get_bits( 8 ) ) == 0xFF && !bitContext.has_error() ) payloadSize += 255;
+        payloadSize += byte;
+        if ( bitContext.has_error() || payloadSize > bitContext.bytes_left() ) return -1;
+
+        const uint8_t *data = bitContext.position();
+        bitContext.skip_bytes( payloadSize );
+        if ( bitContext.has_error() ) return -1;
+        messages[count].payloadType = payloadType;
+        messages[count].payloadSize = payloadSize;
+        messages[count].data        = data;
+        messages[count].size        = (uint32_t)( bitContext.position() - data );
+        count += 1;
     }
+    return count;
+}
 
-    free( rbsp );
-    return 0;
+int avc_decode_avcc_sps( H264SPS *sps, const uint8_t *avcc, uint32_t avcc_size ) {
+    // 5 bytes before numOfSequenceParameterSets, then 2 bytes sequenceParameterSetLength
+    if ( avcc_size < 8 || !( avcc[5] & 0x1F ) ) return -1;
+    uint32_t spsLength = (uint32_t)avcc[6] << 8 | avcc[7];
+    if ( !spsLength || 8 + spsLength > avcc_size ) return -1;
+    return avc_decode_sps( sps, avcc + 8, spsLength );
 }
 
 }; // namespace nx
@@ -8,6 +8,8 @@
 #include <cstring>
 #include <vector>
 
+#include "flv_memory.h"
+
 namespace nx {
 
 // Rec. ITU-T H.264 (02/2014)
@@ -39,6 +41,8 @@ struct H264SPS {
 
     uint32_t pic_width_in_mbs        = 0;
     uint32_t pic_height_in_map_units = 0;
+    // map units are field macroblock pairs when 0
+    uint8_t frame_mbs_only_flag = 1;
 
     uint32_t frame_crop_left_offset   = 0; /* pixels */
     uint32_t frame_crop_right_offset  = 0; /* pixels */
@@ -48,42 +52,77 @@ struct H264SPS {
     void get_resolution( uint32_t &width, uint32_t &height ) {
         const int MACROBLOCK_SIZE = 16;
         width                     = MACROBLOCK_SIZE * pic_width_in_mbs - frame_crop_left_offset - frame_crop_right_offset;
-        height                    = MACROBLOCK_SIZE * pic_height_in_map_units - frame_crop_top_offset - frame_crop_bottom_offset;
+        height                    = MACROBLOCK_SIZE * pic_height_in_map_units * ( 2 - frame_mbs_only_flag ) - frame_crop_top_offset - frame_crop_bottom_offset;
     }
 };
 
+/**
+ * @brief owned copy of a byte range, allocated from a memory resource.
+ * buf is null and size is 0 when the allocation fails.
+ */
 template <typename T>
 struct Buffer {
-    uint8_t *buf;
-    T        size;
-    Buffer( uint8_t *buf, T size ) {
-        this->buf  = (uint8_t *)malloc( size );
-        this->size = size;
-        memcpy( this->buf, buf, size );
+    uint8_t           *buf;
+    T                  size;
+    FlvMemoryResource *resource;
+    Buffer( const uint8_t *buf, T size, FlvMemoryResource *resource = flv_default_resource() ) {
+        this->resource = resource;
+        copy( buf, size );
     }
     Buffer( const Buffer &buffer ) {
-        this->buf  = (uint8_t *)malloc( buffer.size );
-        this->size = buffer.size;
-        memcpy( this->buf, buffer.buf, buffer.size );
+        this->resource = buffer.resource;
+        copy( buffer.buf, buffer.size );
     }
     Buffer &operator=( const Buffer &buffer ) {
-        this->buf  = (uint8_t *)malloc( buffer.size );
-        this->size = buffer.size;
-        memcpy( this->buf, buffer.buf, buffer.size );
+        if ( this == &buffer ) return *this;
+        resource->deallocate( this->buf, this->size );
+        this->resource = buffer.resource;
+        copy( buffer.buf, buffer.size );
         return *this;
     }
     Buffer( Buffer &&buffer ) {
-        this->buf  = buffer.buf;
-        this->size = buffer.size;
+        this->buf      = buffer.buf;
+        this->size     = buffer.size;
+        this->resource = buffer.resource;
 
         buffer.buf  = nullptr;
         buffer.size = 0;
     }
+    Buffer &operator=( Buffer &&buffer ) {
+        if ( this == &buffer ) return *this;
+        resource->deallocate( this->buf, this->size );
+        this->buf      = buffer.buf;
+        this->size     = buffer.size;
+        this->resource = buffer.resource;
+
+        buffer.buf  = nullptr;
+        buffer.size = 0;
+        return *this;
+    }
     ~Buffer() {
-        if ( buf ) free( buf );
+        resource->deallocate( buf, size );
+    }
+
+private:
+    void copy( const uint8_t *buf, T size ) {
+        this->buf  = (uint8_t *)resource->allocate( size );
+        this->size = this->buf ? size : 0;
+        if ( this->buf ) memcpy( this->buf, buf, size );
     }
 };
 using NaluBuffer = Buffer<uint32_t>;
+// nalus whose vector and buffers are allocated from the resource of the allocator
+using NaluBufferList = std::vector<NaluBuffer, FlvAllocator<NaluBuffer>>;
+
+/**
+ * @brief a nal unit in the buffer of the caller, nothing is copied.
+ */
+struct NaluRange {
+    uint8_t *buf;
+    uint32_t size;
+};
+// nal units whose vector is allocated from the resource of the allocator
+using NaluRangeList = std::vector<NaluRange, FlvAllocator<NaluRange>>;
 
 /*
 ISO/IEC 14496-15:2010(E) 5.2.4.1.1 Syntax (p16)
@@ -162,8 +201,21 @@ struct AVCDecoderConfigurationRecord {
 
     AVCDecoderConfigurationRecord( uint8_t *spsNalu, uint16_t spsLength,
                                    uint8_t *ppsNalu, uint16_t ppsLength );
+    /**
+     * @brief construct from an already decoded sps, avoid decoding the sps nalu again.
+     *
+     * @param h264sps decoded sps of spsNalu
+     */
+    AVCDecoderConfigurationRecord( const H264SPS &h264sps,
+                                   uint8_t *spsNalu, uint16_t spsLength,
+                                   uint8_t *ppsNalu, uint16_t ppsLength );
 
     std::vector<uint8_t> to_buf();
+
+private:
+    void init( const H264SPS &h264sps,
+               uint8_t *spsNalu, uint16_t spsLength,
+               uint8_t *ppsNalu, uint16_t ppsLength );
 };
 
 /**
@@ -182,6 +234,25 @@ uint8_t *avc_find_startcode( uint8_t *p, uint8_t *end );
  * @param nalus nal units splited from the avc frame.
  */
 void split_nalus( uint8_t *buf, uint32_t size, std::vector<NaluBuffer> &nalus );
+/**
+ * @brief split a avc frame to nal units, the nal units are allocated from the resource of the list.
+ * A nal unit whose allocation failed has a null buf.
+ */
+void split_nalus( uint8_t *buf, uint32_t size, NaluBufferList &nalus );
+/**
+ * @brief find the nal units of a avc frame without copying them.
+ */
+void find_nalus( uint8_t *buf, uint32_t size, std::vector<NaluRange> &nalus );
+void find_nalus( uint8_t *buf, uint32_t size, NaluRangeList &nalus );
+/**
+ * @brief remove the emulation_prevention_three_bytes of escaped nalu data, SSE2 when available.
+ *
+ * @param src  escaped data, e.g. a nalu without its header or a sei payload
+ * @param size  bytes of src
+ * @param dst  rbsp, at least size bytes, not overlapping src
+ * @return bytes of the rbsp
+ */
+size_t avc_unescape_rbsp( const uint8_t *src, size_t size, uint8_t *dst );
 /**
  * @brief Extract rbsb from nalu. Remove emulation_prevention_three_byte and nalu header.
  *
@@ -199,6 +270,33 @@ uint8_t *avc_extract_rbsp_from_nalu( const uint8_t *nalu, uint32_t nalu_size, ui
 /// @return 0: success, <0: failed.
 int avc_decode_sps( H264SPS *sps, const uint8_t *sps_nalu, uint32_t sps_nalu_size );
 
+/**
+ * @brief a message of a sei nalu.
+ */
+struct AvcSeiMessage {
+    uint32_t payloadType;
+    // bytes of the payload, without emulation prevention bytes
+    uint32_t payloadSize;
+    // the payload in the nalu, escaped, avc_unescape_rbsp gives the payloadSize bytes of it
+    const uint8_t *data;
+    uint32_t       size;
+};
+
+/// @brief Parse the messages of a sei nal unit in place, without allocation.
+/// @param sei_nalu sei nal unit buf, with its header.
+/// @param sei_nalu_size sei nal unit buf length.
+/// @param messages filled with the messages.
+/// @param maxMessages parsing stops after this many messages.
+/// @return number of messages, <0: malformed.
+int avc_parse_sei( const uint8_t *sei_nalu, uint32_t sei_nalu_size, AvcSeiMessage *messages, int maxMessages );
+
+/// @brief Decode the first sps of an AVCDecoderConfigurationRecord, e.g. the body of an avc sequence header tag.
+/// @param sps the H264SPS struct pointer to be filled with data.
+/// @param avcc AVCDecoderConfigurationRecord buf.
+/// @param avcc_size AVCDecoderConfigurationRecord buf length.
+/// @return 0: success, <0: failed.
+int avc_decode_avcc_sps( H264SPS *sps, const uint8_t *avcc, uint32_t avcc_size );
+
 };     // namespace nx
 
 #endif // __AVC_H__
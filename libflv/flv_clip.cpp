@@ -0,0 +1,255 @@
+#include "flv_clip.h"
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "amf.h"
+#include "flv_io.h"
+#include "flv_metadata.h"
+
+namespace nx {
+
+namespace {
+
+// the tags of the clip in the input, and the sequence headers in effect at its first key frame
+struct ClipRange {
+    bool     found          = false;
+    uint64_t start          = 0;
+    uint64_t end            = 0;
+    uint32_t startTimestamp = 0;
+    // whole tags, tag header + data + tag size
+    std::vector<uint8_t> avcHeader;
+    std::vector<uint8_t> aacHeader;
+};
+
+} // namespace
+
+static uint32_t read_u32( const uint8_t *p ) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * @brief parse the tag header at offset, the tag size is not checked.
+ */
+static int peek_tag( int fd, uint64_t offset, FlvTagInfo &tag ) {
+    uint8_t header[FlvTagHeaderSize + 2];
+    if ( flv_pread_all( fd, header, sizeof( header ), offset ) < 0 || flv_parse_tag_header( header, sizeof( header ), tag ) < 0 ) return -1;
+    tag.offset = offset;
+    return 0;
+}
+
+static int read_tag( int fd, const FlvTagInfo &tag, std::vector<uint8_t> &buf ) {
+    buf.resize( tag.size() );
+    return flv_pread_all( fd, &buf[0], buf.size(), tag.offset );
+}
+
+static bool is_video_key_frame( const FlvTagInfo &tag ) {
+    return tag.type == 9 && tag.isKeyFrame && tag.packetType == 1;
+}
+
+/**
+ * @brief find the clip with the keyframes index of onMetaData.
+ *
+ * @return 0: found, <0: no index, or the index does not match the file.
+ */
+static int find_range_with_index( int fd, uint64_t fileSize, const FlvTagInfo &metadataTag, uint32_t fromMs, uint32_t toMs, ClipRange &range ) {
+    if ( metadataTag.dataSize > 16 << 20 ) return -1;
+    std::vector<uint8_t> data( metadataTag.dataSize );
+    std::vector<double>  times;
+    std::vector<double>  positions;
+    if ( data.empty() || flv_pread_all( fd, &data[0], data.size(), metadataTag.offset + FlvTagHeaderSize ) < 0 ) return -1;
+    if ( amf_get_named_double_array( &data[0], data.size(), "times", times ) < 0 || amf_get_named_double_array( &data[0], data.size(), "filepositions", positions ) < 0 ) return -1;
+    if ( times.empty() || times.size() != positions.size() ) return -1;
+
+    // the last key frame at or before fromMs, and the first key frame after toMs
+    size_t first = 0;
+    while ( first + 1 < times.size() && llround( times[first + 1] * 1000 ) <= fromMs ) {
+        first++;
+    }
+    size_t last = first + 1;
+    while ( last < times.size() && llround( times[last] * 1000 ) <= toMs ) {
+        last++;
+    }
+    FlvTagInfo tag;
+    if ( positions[first] < FlvFileHeaderSize || positions[first] >= fileSize ) return -1;
+    if ( peek_tag( fd, (uint64_t)positions[first], tag ) < 0 || !is_video_key_frame( tag ) || tag.timestamp > toMs ) return -1;
+    range.start          = tag.offset;
+    range.startTimestamp = tag.timestamp;
+    range.end            = fileSize;
+    if ( last < times.size() ) {
+        if ( positions[last] <= range.start || positions[last] >= fileSize ) return -1;
+        if ( peek_tag( fd, (uint64_t)positions[last], tag ) < 0 || !is_video_key_frame( tag ) ) return -1;
+        range.end = tag.offset;
+    }
+    range.found = true;
+    return 0;
+}
+
+/**
+ * @brief find the last sequence headers before offset, walking back the PreviousTagSize chain.
+ */
+static int find_sequence_headers( int fd, uint64_t offset, bool needAudio, bool needVideo, ClipRange &range ) {
+    while ( offset > FlvFileHeaderSize && ( ( needVideo && range.avcHeader.empty() ) || ( needAudio && range.aacHeader.empty() ) ) ) {
+        uint8_t sizeBuf[4];
+        if ( flv_pread_all( fd, sizeBuf, 4, offset - 4 ) < 0 ) return -1;
+        uint32_t previous = read_u32( sizeBuf );
+        if ( previous < FlvTagHeaderSize || previous + 4 > offset - FlvFileHeaderSize ) return -1;
+        FlvTagInfo tag;
+        if ( peek_tag( fd, offset - 4 - previous, tag ) < 0 || FlvTagHeaderSize + tag.dataSize != previous ) return -1;
+        if ( tag.type != 18 && tag.packetType == 0 ) {
+            std::vector<uint8_t> &header = tag.type == 9 ? range.avcHeader : range.aacHeader;
+            if ( header.empty() && read_tag( fd, tag, header ) < 0 ) return -1;
+        }
+        offset = tag.offset;
+    }
+    return 0;
+}
+
+/**
+ * @brief sequence headers just before the next key frame belong to the next gop, leave them out of the clip.
+ *
+ * @return the end of the last tag which is not a sequence header
+ */
+static uint64_t trim_sequence_headers( int fd, uint64_t start, uint64_t end ) {
+    while ( end > start ) {
+        uint8_t sizeBuf[4];
+        if ( flv_pread_all( fd, sizeBuf, 4, end - 4 ) < 0 ) break;
+        uint32_t   previous = read_u32( sizeBuf );
+        FlvTagInfo tag;
+        if ( previous < FlvTagHeaderSize || previous + 4 > end - start ) break;
+        if ( peek_tag( fd, end - 4 - previous, tag ) < 0 || tag.type == 18 || tag.packetType != 0 ) break;
+        end = tag.offset;
+    }
+    return end;
+}
+
+/**
+ * @brief find the clip with a scan of the tag headers from the start of the file.
+ *
+ * @return 0: found, <0: no key frame at or before toMs.
+ */
+static int find_range_by_scan( int fd, uint64_t fileSize, uint32_t fromMs, uint32_t toMs, ClipRange &range ) {
+    // a small buffer, the payloads of large tags are skipped
+    FlvFileReader        reader( fd, FlvFileHeaderSize, fileSize, 4096 );
+    FlvTagInfo           tag;
+    std::vector<uint8_t> avcHeader;
+    std::vector<uint8_t> aacHeader;
+    while ( reader.next( tag, nullptr ) > 0 ) {
+        if ( tag.type != 18 && tag.packetType == 0 ) {
+            if ( read_tag( fd, tag, tag.type == 9 ? avcHeader : aacHeader ) < 0 ) return -1;
+            continue;
+        }
+        if ( !is_video_key_frame( tag ) ) continue;
+        if ( tag.timestamp > toMs ) {
+            if ( !range.found ) return -1;
+            range.end = tag.offset;
+            return 0;
+        }
+        if ( !range.found || tag.timestamp <= fromMs ) {
+            range.found          = true;
+            range.start          = tag.offset;
+            range.startTimestamp = tag.timestamp;
+            range.avcHeader      = avcHeader;
+            range.aacHeader      = aacHeader;
+        }
+    }
+    // end of file or the first invalid tag
+    range.end = reader.position();
+    return range.found ? 0 : -1;
+}
+
+int flv_clip_file( const char *input, const char *output, uint32_t fromMs, uint32_t toMs, const FlvClipOptions &options, FlvClipReport *report ) {
+    if ( fromMs > toMs ) return -1;
+    int fd = open( input, O_RDONLY );
+    if ( fd < 0 ) return -1;
+    struct stat st;
+    uint8_t     header[FlvFileHeaderSize];
+    bool        hasAudio = false;
+    bool        hasVideo = false;
+    if ( fstat( fd, &st ) < 0 || flv_pread_all( fd, header, FlvFileHeaderSize, 0 ) < 0 || flv_parse_header( header, FlvFileHeaderSize, &hasAudio, &hasVideo ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+    uint64_t      fileSize = st.st_size;
+    FlvClipReport result;
+    ClipRange     range;
+
+    // key frames from the index, or from a scan
+    FlvTagInfo tag;
+    if ( peek_tag( fd, FlvFileHeaderSize, tag ) == 0 && tag.type == 18 && find_range_with_index( fd, fileSize, tag, fromMs, toMs, range ) == 0 ) {
+        result.usedIndex = true;
+        if ( find_sequence_headers( fd, range.start, hasAudio, hasVideo, range ) < 0 ) {
+            close( fd );
+            return -1;
+        }
+    }
+    else {
+        range = ClipRange();
+        if ( find_range_by_scan( fd, fileSize, fromMs, toMs, range ) < 0 ) {
+            close( fd );
+            return -1;
+        }
+    }
+
+    range.end = trim_sequence_headers( fd, range.start, range.end );
+
+    // the tags of the clip, up to the first invalid tag
+    uint32_t             base = options.rebaseTimestamps ? range.startTimestamp : 0;
+    FlvMetaDataCollector collector( options.keyframeIndex, base );
+    for ( std::vector<uint8_t> *sequenceHeader : { &range.avcHeader, &range.aacHeader } ) {
+        if ( sequenceHeader->empty() ) continue;
+        flv_parse_tag_header( &( *sequenceHeader )[0], sequenceHeader->size(), tag );
+        collector.add_tag( tag, &( *sequenceHeader )[FlvTagHeaderSize] );
+        flv_set_tag_timestamp( &( *sequenceHeader )[0], range.startTimestamp - base );
+    }
+    FlvFileReader        reader( fd, range.start, range.end, 4096 );
+    const uint8_t       *data = nullptr;
+    std::vector<uint8_t> body;
+    while ( reader.next( tag, &data ) > 0 ) {
+        if ( tag.type != 18 && tag.packetType == 0 && !data ) {
+            body.resize( tag.dataSize );
+            if ( reader.read_at( tag.offset + FlvTagHeaderSize, &body[0], tag.dataSize ) < 0 ) break;
+            data = &body[0];
+        }
+        collector.add_tag( tag, data );
+    }
+    uint64_t end = reader.position();
+
+    // header, onMetaData and sequence headers, then the tags
+    FlvMetaData metaData;
+    metaData.hasAudio = hasAudio;
+    metaData.hasVideo = hasVideo;
+    collector.fill( metaData, 0 );
+    uint64_t dataStart = FlvFileHeaderSize + metadata_to_buf( metaData ).size() + range.avcHeader.size() + range.aacHeader.size();
+    collector.fill( metaData, (int64_t)dataStart - (int64_t)range.start );
+    metaData.filesize = (double)( dataStart + end - range.start );
+
+    std::vector<uint8_t> prefix( header, header + FlvFileHeaderSize );
+    auto metadata = metadata_to_buf( metaData );
+    prefix.insert( prefix.end(), metadata.begin(), metadata.end() );
+    prefix.insert( prefix.end(), range.avcHeader.begin(), range.avcHeader.end() );
+    prefix.insert( prefix.end(), range.aacHeader.begin(), range.aacHeader.end() );
+
+    int ret = -1;
+    int out = open( output, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    // audio interleaved after the key frame may be a few milliseconds earlier, it is clamped to 0
+    if ( out >= 0 && flv_write_all( out, &prefix[0], prefix.size() ) == 0 && flv_copy_tags( fd, range.start, end - range.start, out, -(int64_t)base ) == 0 ) {
+        ret = 0;
+    }
+    if ( out >= 0 ) close( out );
+    close( fd );
+    if ( ret < 0 ) return -1;
+
+    result.startOffset    = range.start;
+    result.endOffset      = end;
+    result.startTimestamp = range.startTimestamp;
+    result.duration       = metaData.duration;
+    result.bytes          = dataStart + end - range.start;
+    if ( report ) *report = result;
+    return 0;
+}
+
+}; // namespace nx
@@ -0,0 +1,48 @@
+#ifndef __FLV_CLIP_H__
+#define __FLV_CLIP_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nx {
+
+struct FlvClipOptions {
+    // start the clip timestamps at 0, only the tag headers are rewritten, see flv_copy_tags for the cost.
+    // Without it the tags are moved with a single copy_file_range
+    bool rebaseTimestamps = true;
+    // write a keyframes index to onMetaData
+    bool keyframeIndex = false;
+};
+
+struct FlvClipReport {
+    // the range of tags copied from the input
+    uint64_t startOffset = 0;
+    uint64_t endOffset   = 0;
+    // timestamp of the first key frame of the clip in the input
+    uint32_t startTimestamp = 0;
+    // seconds
+    double   duration = 0;
+    uint64_t bytes    = 0;
+    // the key frames were found with the keyframes index of onMetaData, not by a scan
+    bool usedIndex = false;
+};
+
+/**
+ * @brief cut a clip at key frames, from the last key frame at or before fromMs, to the first key frame after toMs.
+ * The key frames are found with the keyframes index of onMetaData, or with a scan of the tag headers.
+ * The clip gets a new header, onMetaData and the sequence headers in effect at its first key frame,
+ * the tags are moved with copy_file_range or sendfile, and only the timestamps in the tag headers are rewritten,
+ * the payloads do not go through user space but for small tags.
+ *
+ * @param input  flv file path
+ * @param output  clip path, created or truncated
+ * @param fromMs  start time in milliseconds, in the timestamps of the input
+ * @param toMs  end time in milliseconds
+ * @param report  can be null
+ * @return 0: success, <0: io error, not a flv file, or no key frame in the range.
+ */
+int flv_clip_file( const char *input, const char *output, uint32_t fromMs, uint32_t toMs, const FlvClipOptions &options, FlvClipReport *report );
+
+};     // namespace nx
+
+#endif // __FLV_CLIP_H__
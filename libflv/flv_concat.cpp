@@ -0,0 +1,211 @@
+#include "flv_concat.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "flv_io.h"
+#include "flv_metadata.h"
+#include "flv_tag.h"
+
+namespace nx {
+
+namespace {
+
+// tags copied from an input, [begin, end) in the input
+struct Segment {
+    size_t   input;
+    uint64_t begin;
+    uint64_t end;
+    // added to the timestamps
+    int64_t shift;
+};
+
+// the last frame of a track, to place the next input after it
+struct TrackEnd {
+    bool    started   = false;
+    int64_t timestamp = 0;
+    int64_t duration  = 0;
+
+    void add( int64_t frameTimestamp ) {
+        if ( started && frameTimestamp > timestamp ) duration = frameTimestamp - timestamp;
+        if ( !started || frameTimestamp > timestamp ) timestamp = frameTimestamp;
+        started = true;
+    }
+};
+
+} // namespace
+
+static bool is_frame( const FlvTagInfo &tag ) {
+    return ( tag.type == 8 && tag.packetType != 0 ) || ( tag.type == 9 && tag.packetType == 1 );
+}
+
+/**
+ * @brief the smallest timestamp of the first audio frame and the first video frame, 0 if there is no frame.
+ */
+static uint32_t first_timestamp( int fd, uint64_t fileSize ) {
+    FlvFileReader reader( fd, FlvFileHeaderSize, fileSize, 4096 );
+    FlvTagInfo    tag;
+    bool          audio = false;
+    bool          video = false;
+    uint32_t      first = UINT32_MAX;
+    for ( int count = 0; count < 256 && !( audio && video ) && reader.next( tag, nullptr ) > 0; count++ ) {
+        if ( !is_frame( tag ) ) continue;
+        bool &seen = tag.type == 8 ? audio : video;
+        if ( seen ) continue;
+        seen = true;
+        if ( tag.timestamp < first ) first = tag.timestamp;
+    }
+    return first == UINT32_MAX ? 0 : first;
+}
+
+int flv_concat_files( const char *const *inputs, size_t count, const char *output, const FlvConcatOptions &options, FlvConcatReport *report ) {
+    FlvConcatReport      result;
+    std::vector<int>     fds;
+    std::vector<Segment> segments;
+    FlvMetaDataCollector collector( options.keyframeIndex );
+    std::vector<uint8_t> avcConfig;
+    std::vector<uint8_t> aacConfig;
+    std::vector<uint8_t> body;
+    bool                 hasAudio      = false;
+    bool                 hasVideo      = false;
+    uint64_t             tagsSize      = 0;
+    int64_t              nextTimestamp = 0;
+    int                  ret           = 0;
+
+    // walk the tag headers of each input, decide what is copied and where the timestamps go
+    for ( size_t i = 0; i < count && ret == 0; i++ ) {
+        int fd = open( inputs[i], O_RDONLY );
+        if ( fd < 0 ) {
+            ret = -1;
+            break;
+        }
+        fds.push_back( fd );
+        struct stat st;
+        uint8_t     header[FlvFileHeaderSize];
+        bool        audio = false;
+        bool        video = false;
+        if ( fstat( fd, &st ) < 0 || flv_pread_all( fd, header, FlvFileHeaderSize, 0 ) < 0 || flv_parse_header( header, FlvFileHeaderSize, &audio, &video ) < 0 ) {
+            ret = -1;
+            break;
+        }
+        hasAudio |= audio;
+        hasVideo |= video;
+
+        int64_t        shift = nextTimestamp - first_timestamp( fd, st.st_size );
+        TrackEnd       audioEnd;
+        TrackEnd       videoEnd;
+        Segment        segment  = { i, 0, 0, shift };
+        bool           copying  = false;
+        FlvFileReader  reader( fd, FlvFileHeaderSize, st.st_size, 4096 );
+        FlvTagInfo     tag;
+        const uint8_t *data = nullptr;
+        // the first sequence header of each track must match the config the previous input ended on
+        bool audioHeaderSeen = false;
+        bool videoHeaderSeen = false;
+        while ( reader.next( tag, &data ) > 0 ) {
+            bool keep = true;
+            if ( tag.type == 18 ) {
+                // onMetaData is recomputed
+                keep = false;
+            }
+            else if ( tag.type == 9 && tag.packetType == 2 ) {
+                // end of sequence, only at the end
+                keep = i + 1 == count;
+            }
+            else if ( tag.packetType == 0 ) {
+                if ( !data ) {
+                    body.resize( tag.dataSize );
+                    if ( reader.read_at( tag.offset + FlvTagHeaderSize, &body[0], tag.dataSize ) < 0 ) {
+                        ret = -1;
+                        break;
+                    }
+                    data = &body[0];
+                }
+                std::vector<uint8_t> &config       = tag.type == 9 ? avcConfig : aacConfig;
+                bool                 &headerSeen   = tag.type == 9 ? videoHeaderSeen : audioHeaderSeen;
+                bool                  firstOfInput = !headerSeen;
+                headerSeen                         = true;
+                if ( config.size() == tag.dataSize && std::equal( config.begin(), config.end(), data ) ) {
+                    keep = false;
+                    result.droppedSequenceHeaders += 1;
+                }
+                else if ( config.empty() || !firstOfInput || options.allowConfigChange ) {
+                    // a change inside an input is always kept
+                    if ( !config.empty() ) result.changedSequenceHeaders += 1;
+                    config.assign( data, data + tag.dataSize );
+                }
+                else {
+                    result.mismatchedInput = (int)i;
+                    ret                    = -2;
+                    break;
+                }
+            }
+            if ( !keep ) {
+                if ( copying ) segments.push_back( segment );
+                copying = false;
+                continue;
+            }
+            if ( !copying ) {
+                segment.begin = tag.offset;
+                copying       = true;
+            }
+            segment.end = tag.offset + tag.size();
+
+            // metadata of the output, the offsets are relative to the first tag of the output
+            FlvTagInfo outputTag = tag;
+            int64_t    timestamp = tag.timestamp + shift;
+            outputTag.offset     = tagsSize;
+            outputTag.timestamp  = timestamp > 0 ? (uint32_t)timestamp : 0;
+            collector.add_tag( outputTag, data );
+            tagsSize += tag.size();
+            if ( is_frame( tag ) ) ( tag.type == 8 ? audioEnd : videoEnd ).add( outputTag.timestamp );
+        }
+        if ( copying ) segments.push_back( segment );
+
+        // the next input starts one frame after the end of the longest track
+        for ( const TrackEnd *end : { &audioEnd, &videoEnd } ) {
+            if ( !end->started ) continue;
+            int64_t next = end->timestamp + ( end->duration ? end->duration : 1 );
+            if ( next > nextTimestamp ) nextTimestamp = next;
+        }
+    }
+
+    int out = -1;
+    if ( ret == 0 ) {
+        // header, onMetaData, then the tags of the inputs
+        FlvMetaData metaData;
+        metaData.hasAudio = hasAudio;
+        metaData.hasVideo = hasVideo;
+        collector.fill( metaData, 0 );
+        uint64_t tagsStart = FlvFileHeaderSize + metadata_to_buf( metaData ).size();
+        collector.fill( metaData, (int64_t)tagsStart );
+        metaData.filesize = (double)( tagsStart + tagsSize );
+
+        std::vector<uint8_t> prefix( FlvFileHeaderSize, 0 );
+        flv_header( hasAudio, hasVideo ).to_buf( &prefix[0] );
+        auto metadata = metadata_to_buf( metaData );
+        prefix.insert( prefix.end(), metadata.begin(), metadata.end() );
+
+        out = open( output, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+        ret = out >= 0 && flv_write_all( out, &prefix[0], prefix.size() ) == 0 ? 0 : -1;
+        // the tag headers are rewritten on the way, the payloads are copied in the kernel
+        for ( size_t i = 0; i < segments.size() && ret == 0; i++ ) {
+            const Segment &segment = segments[i];
+            ret                    = flv_copy_tags( fds[segment.input], segment.begin, segment.end - segment.begin, out, segment.shift );
+        }
+        result.audioTags = collector.audioTags;
+        result.videoTags = collector.videoTags;
+        result.duration  = collector.duration();
+        result.bytes     = tagsStart + tagsSize;
+    }
+    if ( out >= 0 ) close( out );
+    for ( int fd : fds ) {
+        close( fd );
+    }
+    if ( report ) *report = result;
+    return ret;
+}
+
+}; // namespace nx
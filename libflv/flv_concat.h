@@ -0,0 +1,48 @@
+#ifndef __FLV_CONCAT_H__
+#define __FLV_CONCAT_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nx {
+
+struct FlvConcatOptions {
+    // the first sequence header of an input which differs from the config the previous input ended on is kept,
+    // otherwise the concatenation fails. A config change inside an input is always kept
+    bool allowConfigChange = false;
+    // write a keyframes index to onMetaData
+    bool keyframeIndex = false;
+};
+
+struct FlvConcatReport {
+    uint64_t audioTags = 0;
+    uint64_t videoTags = 0;
+    // seconds
+    double   duration = 0;
+    uint64_t bytes    = 0;
+    // sequence headers equal to the current one, left out
+    uint64_t droppedSequenceHeaders = 0;
+    // sequence headers which changed the config, kept
+    uint64_t changedSequenceHeaders = 0;
+    // index of the input whose sequence header differs, when the concatenation failed for it
+    int mismatchedInput = -1;
+};
+
+/**
+ * @brief concatenate flv files, e.g. the segments of a recording.
+ * The timestamps of each input are moved to start one frame after the end of the previous input,
+ * sequence headers equal to the current ones are left out, onMetaData is recomputed,
+ * and the tags are moved with copy_file_range, only the tag headers are rewritten, see flv_copy_tags for the cost.
+ * onMetaData of the inputs and the end of sequence tags but the last one are left out.
+ *
+ * @param inputs  flv file paths
+ * @param output  path of the concatenation, created or truncated
+ * @param report  can be null, filled on failure too
+ * @return 0: success, -1: io error or not a flv file, -2: the first sequence headers of an input differ from the config
+ *         of the previous input and allowConfigChange is not set.
+ */
+int flv_concat_files( const char *const *inputs, size_t count, const char *output, const FlvConcatOptions &options, FlvConcatReport *report );
+
+};     // namespace nx
+
+#endif // __FLV_CONCAT_H__
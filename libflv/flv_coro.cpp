@@ -0,0 +1,44 @@
+#include "flv_coro.h"
+
+#if FLV_ENABLE_COROUTINES
+
+namespace nx {
+
+FlvAsyncSendBuffer::FlvAsyncSendBuffer( size_t highWatermark, size_t lowWatermark ) {
+    this->highWatermark = highWatermark;
+    this->lowWatermark  = lowWatermark < highWatermark ? lowWatermark : highWatermark;
+}
+
+void FlvAsyncSendBuffer::append( const uint8_t *data, size_t bytes ) {
+    // reclaim the sent bytes once they are the larger part of the buffer
+    if ( head && head >= buffer.size() - head ) {
+        buffer.erase( buffer.begin(), buffer.begin() + head );
+        head = 0;
+    }
+    buffer.insert( buffer.end(), data, data + bytes );
+}
+
+void FlvAsyncSendBuffer::consume( size_t bytes ) {
+    head += bytes < size() ? bytes : size();
+    if ( head == buffer.size() ) {
+        buffer.clear();
+        head = 0;
+    }
+    if ( size() > lowWatermark || waiters.empty() ) return;
+    // a resumed muxer may queue again and wait, on a fresh list
+    std::vector<std::coroutine_handle<>> ready;
+    ready.swap( waiters );
+    for ( size_t i = 0; i < ready.size(); i++ ) {
+        ready[i].resume();
+    }
+}
+
+bool FlvAsyncSendBuffer::await_drained( std::coroutine_handle<> waiter ) {
+    if ( !full() ) return false;
+    waiters.push_back( waiter );
+    return true;
+}
+
+}; // namespace nx
+
+#endif // FLV_ENABLE_COROUTINES
@@ -0,0 +1,221 @@
+#ifndef __FLV_CORO_H__
+#define __FLV_CORO_H__
+
+/*
+ Opt-in C++20 coroutine front end of the muxer, for coroutine based network stacks.
+ Build with FLV_ENABLE_COROUTINES=1 (cmake -DLIBFLV_ENABLE_COROUTINES=ON) and C++20, this header is empty otherwise.
+
+ An async sink is a sink of BasicFlvMuxer which queues the tags without blocking, reports its fill level with
+ onBackpressure, and resumes a coroutine once it has drained:
+
+    bool await_drained( std::coroutine_handle<> waiter );
+
+ returns false when the sink has room again, the waiter is not kept, or true when it keeps the waiter
+ and resumes it later, from the writer that drains the sink, e.g. a socket or an io_uring completion.
+ FlvAsyncMuxer awaits the sink before each frame instead of dropping video, so one thread can drive
+ thousands of streams, each suspended only while its own connection is slow.
+*/
+#ifndef FLV_ENABLE_COROUTINES
+#define FLV_ENABLE_COROUTINES 0
+#endif
+
+#if FLV_ENABLE_COROUTINES
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "flvmuxer.h"
+
+namespace nx {
+
+template <typename S>
+concept FlvAsyncSink = std::copy_constructible<S> && requires( S sink, const uint8_t *data, size_t bytes, const FlvBatchTag *tags, std::coroutine_handle<> waiter ) {
+    sink.onMuxedFlvHeader( data, bytes );
+    sink.onMuxedData( 0, data, bytes, 0u );
+    sink.onMuxedBatch( data, bytes, tags, bytes );
+    sink.onUpdateMuxedData( bytes, data, bytes );
+    sink.onEndMuxing();
+    { sink.onBackpressure() } -> std::convertible_to<int>;
+    { sink.await_drained( waiter ) } -> std::same_as<bool>;
+};
+
+/**
+ * @brief FlvMuxer with awaitable mux calls, which suspend while the sink reports backpressure.
+ * Any async sink plugs in through a FlvMuxerDataHandler adapter, so the muxer of the library is used as built.
+ * The sink is copied, the copies share the output of the caller, see flv_sink.h.
+ * A muxer is used by one coroutine at a time.
+ */
+template <FlvAsyncSink Sink>
+class FlvAsyncMuxer {
+public:
+    FlvAsyncMuxer( bool hasAudio, bool hasVideo, Sink sink, FlvMemoryResource *resource = flv_default_resource() )
+        : handler( std::make_shared<Handler>( sink ) ), muxer( hasAudio, hasVideo, handler, resource ) {}
+
+    /**
+     * @brief awaitable of a mux call, ready when the sink has room, otherwise resumed by the sink when it drains.
+     * The frame is muxed on resumption, the buffers of the frame must stay valid until then.
+     * A frame which has waited is muxed even if the waiters resumed before it filled the sink again,
+     * so the sink may go over its high watermark by the frames of the waiters, but no video is dropped.
+     */
+    class Awaiter {
+    public:
+        Awaiter( FlvAsyncMuxer *owner, const FlvFrame &frame ) : owner( owner ), frame( frame ) {}
+
+        bool await_ready() {
+            return owner->handler->sink.onBackpressure() == FlvBackpressureNone;
+        }
+        bool await_suspend( std::coroutine_handle<> waiter ) {
+            owner->waits += 1;
+            return owner->handler->sink.await_drained( waiter );
+        }
+        void await_resume() {
+            // the frame has its turn, the backpressure of the sink is not applied again by the muxer
+            owner->handler->awaited = true;
+            if ( frame.type == 8 ) {
+                owner->muxer.mux_aac( frame.data, frame.length, frame.pts );
+            }
+            else {
+                owner->muxer.mux_avc( frame.data, frame.length, frame.pts, frame.dts, frame.isKeyFrame );
+            }
+            owner->handler->awaited = false;
+        }
+
+    private:
+        FlvAsyncMuxer *owner;
+        FlvFrame       frame;
+    };
+
+    /**
+     * @brief co_await mux_aac( ... ), see FlvMuxer::mux_aac.
+     */
+    Awaiter mux_aac( uint8_t *adts, size_t length, uint32_t timestamp ) {
+        return Awaiter( this, FlvFrame { 8, adts, length, timestamp, timestamp, false } );
+    }
+    /**
+     * @brief co_await mux_avc( ... ), see FlvMuxer::mux_avc.
+     */
+    Awaiter mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame ) {
+        return Awaiter( this, FlvFrame { 9, buf, length, pts, dts, isKeyFrame } );
+    }
+    /**
+     * @brief the muxer, for the calls which do not wait, e.g. get_stats or set_nalu_filter.
+     */
+    FlvMuxer &sync() {
+        return muxer;
+    }
+    // times a mux call suspended
+    uint64_t suspensions() const {
+        return waits;
+    }
+
+private:
+    struct Handler : FlvMuxerDataHandler {
+        Sink sink;
+        // muxing the frame of an awaiter
+        bool awaited = false;
+
+        explicit Handler( const Sink &sink ) : sink( sink ) {}
+
+        void onMuxedFlvHeader( void *context, uint8_t *data, size_t bytes ) override {
+            sink.onMuxedFlvHeader( data, bytes );
+        }
+        void onMuxedData( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) override {
+            sink.onMuxedData( type, data, bytes, timestamp );
+        }
+        void onMuxedBatch( void *context, const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) override {
+            sink.onMuxedBatch( data, bytes, tags, count );
+        }
+        void onUpdateMuxedData( void *context, size_t offsetFromStart, const uint8_t *data, size_t bytes ) override {
+            sink.onUpdateMuxedData( offsetFromStart, data, bytes );
+        }
+        void onEndMuxing() override {
+            sink.onEndMuxing();
+        }
+        int onBackpressure( void *context ) override {
+            return awaited ? FlvBackpressureNone : sink.onBackpressure();
+        }
+    };
+
+    std::shared_ptr<Handler> handler;
+    FlvMuxer                 muxer;
+    uint64_t                 waits = 0;
+};
+
+/**
+ * @brief send queue of a live connection, filled by FlvAsyncSendSink and drained by the network writer.
+ * Above highWatermark bytes the sink reports backpressure, and waiting muxers are resumed
+ * when consume brings it to lowWatermark. Single threaded, the muxers and the writer run on the same event loop.
+ */
+class FlvAsyncSendBuffer {
+public:
+    FlvAsyncSendBuffer( size_t highWatermark, size_t lowWatermark );
+
+    // queued bytes, data() is valid until the next append or consume
+    const uint8_t *data() const {
+        return buffer.data() + head;
+    }
+    size_t size() const {
+        return buffer.size() - head;
+    }
+    /**
+     * @brief remove bytes sent by the writer, and resume the waiting muxers at the low watermark.
+     */
+    void consume( size_t bytes );
+
+    void append( const uint8_t *data, size_t bytes );
+    bool full() const {
+        return size() > highWatermark;
+    }
+    // keep the waiter until the low watermark, false if there is room already
+    bool await_drained( std::coroutine_handle<> waiter );
+    // the stream ended, a writer flushes the rest and closes
+    bool ended = false;
+
+private:
+    std::vector<uint8_t>                 buffer;
+    size_t                               head = 0;
+    size_t                               highWatermark;
+    size_t                               lowWatermark;
+    std::vector<std::coroutine_handle<>> waiters;
+};
+
+/**
+ * @brief async sink of a FlvAsyncSendBuffer of the caller.
+ * Sent bytes cannot be patched, onUpdateMuxedData is ignored, as for a live stream.
+ */
+struct FlvAsyncSendSink {
+    FlvAsyncSendBuffer *output;
+
+    explicit FlvAsyncSendSink( FlvAsyncSendBuffer &output ) : output( &output ) {}
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes ) {
+        output->append( data, bytes );
+    }
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        output->append( data, bytes );
+    }
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+        output->append( data, bytes );
+    }
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {}
+    void onEndMuxing() {
+        output->ended = true;
+    }
+    // a muxer used without co_await drops disposable frames instead of waiting
+    int onBackpressure() {
+        return output->full() ? FlvBackpressureDropDisposable : FlvBackpressureNone;
+    }
+    bool await_drained( std::coroutine_handle<> waiter ) {
+        return output->await_drained( waiter );
+    }
+};
+
+};     // namespace nx
+
+#endif // FLV_ENABLE_COROUTINES
+
+#endif // __FLV_CORO_H__
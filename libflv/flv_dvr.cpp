@@ -0,0 +1,242 @@
+#include "flv_dvr.h"
+#include "flv_metadata.h"
+#include "flv_reader.h"
+
+namespace nx {
+
+FlvDvrBuffer::FlvDvrBuffer( size_t slabSize, size_t slabCount, size_t maxGops, FlvMemoryResource *resource ) {
+    this->resource = resource;
+    this->slabSize = slabSize;
+    slabs.resize( slabCount < 2 ? 2 : slabCount );
+    gops.resize( maxGops ? maxGops : 1 );
+}
+
+FlvDvrBuffer::~FlvDvrBuffer() {
+    for ( size_t i = 0; i < slabs.size(); i++ ) {
+        resource->deallocate( slabs[i].data, slabSize );
+    }
+}
+
+void FlvDvrBuffer::start( const uint8_t *header, size_t bytes ) {
+    memset( this->header, 0, sizeof( this->header ) );
+    memcpy( this->header, header, bytes < sizeof( this->header ) ? bytes : sizeof( this->header ) );
+    flv_parse_header( this->header, sizeof( this->header ), &hasAudio, &hasVideo );
+    // the slabs are kept for the new stream
+    for ( size_t i = 0; i < slabs.size(); i++ ) {
+        slabs[i].sequence = i;
+        slabs[i].used     = 0;
+    }
+    writeSlab       = 0;
+    gopHead         = 0;
+    gopCount        = 0;
+    recording       = false;
+    newestTimestamp = 0;
+    avcHeaders.clear();
+    aacHeaders.clear();
+    avcVersion = 0;
+    aacVersion = 0;
+}
+
+void FlvDvrBuffer::evict_oldest_gop() {
+    gopHead = ( gopHead + 1 ) % gops.size();
+    gopCount -= 1;
+    evictedGops += 1;
+}
+
+bool FlvDvrBuffer::reserve( size_t bytes ) {
+    if ( bytes > slabSize ) return false;
+    Slab *slab = &slab_of( writeSlab );
+    if ( slab->data && slab->sequence == writeSlab && slab->used + bytes <= slabSize ) return true;
+    if ( slab->data && slab->used ) {
+        // the slot of the next slab holds the oldest one, its gops go first
+        writeSlab += 1;
+        slab = &slab_of( writeSlab );
+        if ( writeSlab >= slabs.size() ) {
+            uint64_t reused = writeSlab - slabs.size();
+            while ( gopCount && gop_at( 0 ).slab <= reused ) {
+                evict_oldest_gop();
+            }
+        }
+    }
+    if ( !slab->data ) {
+        slab->data = (uint8_t *)resource->allocate( slabSize );
+        if ( !slab->data ) return false;
+    }
+    slab->sequence = writeSlab;
+    slab->used     = 0;
+    // the gop being written started in the reused slab, it is lost until the next key frame
+    if ( !gopCount ) recording = false;
+    return true;
+}
+
+void FlvDvrBuffer::remember_sequence_header( std::vector<SequenceHeader> &headers, uint64_t version, const uint8_t *data, size_t bytes ) {
+    if ( headers.size() == MaxHeaderVersions ) headers.erase( headers.begin() );
+    headers.push_back( SequenceHeader() );
+    headers.back().version = version;
+    headers.back().tag.assign( data, data + bytes );
+    evict_unreferenced_gops();
+}
+
+const FlvDvrBuffer::SequenceHeader *FlvDvrBuffer::find_sequence_header( const std::vector<SequenceHeader> &headers, uint64_t version ) const {
+    for ( size_t i = 0; i < headers.size(); i++ ) {
+        if ( headers[i].version == version ) return &headers[i];
+    }
+    return nullptr;
+}
+
+void FlvDvrBuffer::evict_unreferenced_gops() {
+    // versions only grow, the gops of forgotten headers are the oldest ones
+    while ( gopCount ) {
+        const Gop &gop = gop_at( 0 );
+        bool       avc = !gop.avcVersion || find_sequence_header( avcHeaders, gop.avcVersion );
+        bool       aac = !gop.aacVersion || find_sequence_header( aacHeaders, gop.aacVersion );
+        if ( avc && aac ) break;
+        evict_oldest_gop();
+    }
+    if ( !gopCount ) recording = false;
+}
+
+void FlvDvrBuffer::add_tag( const uint8_t *data, size_t bytes ) {
+    FlvTagInfo tag;
+    if ( flv_parse_tag_header( data, bytes, tag ) < 0 || tag.size() != bytes || tag.type == 18 ) return;
+
+    bool sequenceHeader = tag.packetType == 0;
+    if ( sequenceHeader && tag.type == 9 ) {
+        avcVersion += 1;
+        remember_sequence_header( avcHeaders, avcVersion, data, bytes );
+    }
+    else if ( sequenceHeader && tag.type == 8 ) {
+        aacVersion += 1;
+        remember_sequence_header( aacHeaders, aacVersion, data, bytes );
+    }
+
+    // a gop starts at a key frame, audio only streams are cut in segments
+    bool gopStart = false;
+    if ( !sequenceHeader ) {
+        if ( hasVideo ) {
+            gopStart = tag.type == 9 && tag.isKeyFrame && tag.packetType == 1;
+        }
+        else {
+            gopStart = tag.type == 8 && ( !gopCount || !recording || tag.timestamp >= gops[( gopHead + gopCount - 1 ) % gops.size()].timestamp + SegmentMs );
+        }
+    }
+    if ( !gopStart && !recording ) {
+        // sequence headers are kept aside
+        if ( !sequenceHeader ) droppedTags += 1;
+        return;
+    }
+    if ( !reserve( bytes ) || ( !gopStart && !recording ) ) {
+        recording = false;
+        droppedTags += 1;
+        return;
+    }
+    Slab &slab = slab_of( writeSlab );
+    if ( gopStart ) {
+        if ( gopCount == gops.size() ) evict_oldest_gop();
+        Gop &gop       = gops[( gopHead + gopCount ) % gops.size()];
+        gop.timestamp  = tag.timestamp;
+        gop.slab       = writeSlab;
+        gop.offset     = slab.used;
+        gop.avcVersion = avcVersion;
+        gop.aacVersion = aacVersion;
+        gopCount += 1;
+        recording = true;
+    }
+    memcpy( slab.data + slab.used, data, bytes );
+    slab.used += bytes;
+    newestTimestamp = tag.timestamp;
+}
+
+int FlvDvrBuffer::prepare_dump( uint32_t fromTs, uint32_t toTs ) {
+    if ( !gopCount || fromTs > toTs ) return -1;
+    // the last gop starting at or before fromTs, or the oldest one
+    size_t first = 0;
+    for ( size_t i = 1; i < gopCount && gop_at( i ).timestamp <= fromTs; i++ ) {
+        first = i;
+    }
+    const Gop &gop = gop_at( first );
+    if ( gop.timestamp > toTs ) return -1;
+
+    const SequenceHeader *avcHeader = find_sequence_header( avcHeaders, gop.avcVersion );
+    const SequenceHeader *aacHeader = find_sequence_header( aacHeaders, gop.aacVersion );
+    FlvMetaDataCollector  collector;
+    FlvTagInfo            tag;
+    for ( const SequenceHeader *sequenceHeader : { avcHeader, aacHeader } ) {
+        if ( !sequenceHeader ) continue;
+        flv_parse_tag_header( &sequenceHeader->tag[0], sequenceHeader->tag.size(), tag );
+        collector.add_tag( tag, &sequenceHeader->tag[FlvTagHeaderSize] );
+    }
+
+    // the tags of the range, slab by slab
+    dumpTags.clear();
+    dumpRuns.clear();
+    uint64_t tagBytes = 0;
+    bool     done     = false;
+    for ( uint64_t sequence = gop.slab; sequence <= writeSlab && !done; sequence++ ) {
+        const Slab &slab  = slab_of( sequence );
+        size_t      begin = sequence == gop.slab ? gop.offset : 0;
+        size_t      end   = begin;
+        Run         run   = { slab.data + begin, 0, dumpTags.size(), 0 };
+        while ( end < slab.used ) {
+            flv_parse_tag_header( slab.data + end, slab.used - end, tag );
+            if ( tag.timestamp > toTs ) {
+                done = true;
+                break;
+            }
+            collector.add_tag( tag, slab.data + end + FlvTagHeaderSize );
+            dumpTags.push_back( { tag.type, end - begin, (size_t)tag.size(), tag.timestamp } );
+            end += tag.size();
+        }
+        run.bytes    = end - begin;
+        run.tagCount = dumpTags.size() - run.firstTag;
+        if ( run.tagCount ) dumpRuns.push_back( run );
+        tagBytes += run.bytes;
+    }
+
+    // header, onMetaData and the sequence headers at the time of the key frame
+    FlvMetaData metaData;
+    metaData.hasAudio = hasAudio;
+    metaData.hasVideo = hasVideo;
+    collector.fill( metaData, 0 );
+    size_t prefixBytes = FlvFileHeaderSize + metadata_to_buf( metaData ).size();
+    for ( const SequenceHeader *sequenceHeader : { avcHeader, aacHeader } ) {
+        if ( sequenceHeader ) prefixBytes += sequenceHeader->tag.size();
+    }
+    metaData.filesize = (double)( prefixBytes + tagBytes );
+
+    auto metadata = metadata_to_buf( metaData );
+    dumpPrefix.assign( header, header + FlvFileHeaderSize );
+    dumpHeaderBytes = FlvFileHeaderSize;
+    dumpPrefixTags.clear();
+    dumpPrefixTags.push_back( { 18, 0, metadata.size(), 0 } );
+    dumpPrefix.insert( dumpPrefix.end(), metadata.begin(), metadata.end() );
+    for ( const SequenceHeader *sequenceHeader : { avcHeader, aacHeader } ) {
+        if ( !sequenceHeader ) continue;
+        size_t offset = dumpPrefix.size();
+        dumpPrefix.insert( dumpPrefix.end(), sequenceHeader->tag.begin(), sequenceHeader->tag.end() );
+        flv_set_tag_timestamp( &dumpPrefix[offset], gop.timestamp );
+        dumpPrefixTags.push_back( { sequenceHeader->tag[0] & 0x1F, 0, sequenceHeader->tag.size(), gop.timestamp } );
+    }
+    dumpBytes = (int64_t)( dumpPrefix.size() + tagBytes );
+    return 0;
+}
+
+void FlvDvrBuffer::get_stats( FlvDvrStats &stats ) const {
+    stats = FlvDvrStats();
+    for ( size_t i = 0; i < slabs.size(); i++ ) {
+        if ( slabs[i].data ) stats.memoryBytes += slabSize;
+    }
+    stats.gops            = gopCount;
+    stats.newestTimestamp = newestTimestamp;
+    stats.evictedGops     = evictedGops;
+    stats.droppedTags     = droppedTags;
+    if ( !gopCount ) return;
+    const Gop &gop        = gop_at( 0 );
+    stats.oldestTimestamp = gop.timestamp;
+    for ( uint64_t sequence = gop.slab; sequence <= writeSlab; sequence++ ) {
+        const Slab &slab = slabs[sequence % slabs.size()];
+        stats.bytes += slab.used - ( sequence == gop.slab ? gop.offset : 0 );
+    }
+}
+
+}; // namespace nx
@@ -0,0 +1,203 @@
+#ifndef __FLV_DVR_H__
+#define __FLV_DVR_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "flv_memory.h"
+#include "flv_sink.h"
+
+namespace nx {
+
+struct FlvDvrStats {
+    // bytes of the retained tags, and the memory of the slabs
+    uint64_t bytes       = 0;
+    uint64_t memoryBytes = 0;
+    // retained gops, and the timestamps of the oldest gop and of the newest tag
+    size_t   gops            = 0;
+    uint32_t oldestTimestamp = 0;
+    uint32_t newestTimestamp = 0;
+    // gops evicted to make room for new tags
+    uint64_t evictedGops = 0;
+    // tags not retained, before the first key frame, larger than a slab, or while a gop larger than the ring is written
+    uint64_t droppedTags = 0;
+};
+
+/**
+ * @brief in memory dvr of a live stream, "save the last 10 minutes" without recording everything to disk.
+ * Serialized tags are kept in a fixed ring of large slabs, a tag never spans two slabs.
+ * A fixed size index maps the timestamp of every gop to its slab and offset,
+ * and the oldest gops are evicted as a whole when a slab or an index entry is reused, so a dump always starts at a key frame.
+ * Audio only streams are cut in segments of SegmentMs instead of gops.
+ *
+ * The memory is strictly bounded: slabCount * slabSize for the tags, maxGops entries for the index,
+ * and the last MaxHeaderVersions sequence headers of each track. Slabs are allocated on first use.
+ * Fed by FlvDvrSink, not thread safe, dump from the muxing thread.
+ */
+class FlvDvrBuffer {
+public:
+    static const size_t   DefaultSlabSize   = 4 << 20;
+    static const uint32_t SegmentMs         = 1000;
+    static const size_t   MaxHeaderVersions = 4;
+
+    /**
+     * @param slabSize  bytes of a slab, the largest tag retained
+     * @param slabCount  slabs of the ring, at least 2
+     * @param maxGops  entries of the gop index
+     * @param resource  memory of the slabs, not owned, must outlive the buffer
+     */
+    FlvDvrBuffer( size_t slabSize, size_t slabCount, size_t maxGops = 4096, FlvMemoryResource *resource = flv_default_resource() );
+    ~FlvDvrBuffer();
+    FlvDvrBuffer( const FlvDvrBuffer & )            = delete;
+    FlvDvrBuffer &operator=( const FlvDvrBuffer & ) = delete;
+
+    /**
+     * @brief start a new stream from the flv header, the retained tags are dropped.
+     */
+    void start( const uint8_t *header, size_t bytes );
+    /**
+     * @brief retain a serialized tag, with its tag size. Script data tags are not retained, onMetaData is regenerated by dump.
+     */
+    void add_tag( const uint8_t *data, size_t bytes );
+
+    /**
+     * @brief write the retained tags from the last gop starting at or before fromTs, up to the last tag at or before toTs,
+     * as a complete flv: a header, onMetaData recomputed for the range, and the sequence headers in effect at its first key frame,
+     * all with the timestamp of the first key frame, then the tags in place, one onMuxedBatch per slab, and onEndMuxing.
+     * The timestamps are those of the stream.
+     *
+     * @param sink  FlvMemorySink, FlvFileSink, VirtualHandlerSink or any sink of BasicFlvMuxer
+     * @return bytes written, <0: no gop in the range
+     */
+    template <typename Sink>
+    int64_t dump( uint32_t fromTs, uint32_t toTs, Sink &sink ) {
+        if ( prepare_dump( fromTs, toTs ) < 0 ) return -1;
+        sink.onMuxedFlvHeader( &dumpPrefix[0], dumpHeaderBytes );
+        size_t offset = dumpHeaderBytes;
+        for ( size_t i = 0; i < dumpPrefixTags.size(); i++ ) {
+            const FlvBatchTag &tag = dumpPrefixTags[i];
+            sink.onMuxedData( tag.type, &dumpPrefix[offset], tag.bytes, tag.timestamp );
+            offset += tag.bytes;
+        }
+        for ( size_t i = 0; i < dumpRuns.size(); i++ ) {
+            const Run &run = dumpRuns[i];
+            sink.onMuxedBatch( run.data, run.bytes, &dumpTags[run.firstTag], run.tagCount );
+        }
+        sink.onEndMuxing();
+        return dumpBytes;
+    }
+    void get_stats( FlvDvrStats &stats ) const;
+
+private:
+    struct Slab {
+        uint8_t *data = nullptr;
+        // logical sequence of the slab in the ring, slot = sequence % slabCount
+        uint64_t sequence = 0;
+        size_t   used     = 0;
+    };
+    struct Gop {
+        uint32_t timestamp;
+        uint64_t slab;
+        size_t   offset;
+        // versions of the sequence headers in effect at the key frame
+        uint64_t avcVersion;
+        uint64_t aacVersion;
+    };
+    struct SequenceHeader {
+        uint64_t             version;
+        std::vector<uint8_t> tag;
+    };
+    struct Run {
+        const uint8_t *data;
+        size_t         bytes;
+        size_t         firstTag;
+        size_t         tagCount;
+    };
+
+    Slab &slab_of( uint64_t sequence ) {
+        return slabs[sequence % slabs.size()];
+    }
+    const Gop &gop_at( size_t index ) const {
+        return gops[( gopHead + index ) % gops.size()];
+    }
+    void evict_oldest_gop();
+    // make room for bytes in the current slab, moving to the next one
+    bool reserve( size_t bytes );
+    void remember_sequence_header( std::vector<SequenceHeader> &headers, uint64_t version, const uint8_t *data, size_t bytes );
+    const SequenceHeader *find_sequence_header( const std::vector<SequenceHeader> &headers, uint64_t version ) const;
+    // evict the gops whose sequence headers are no longer kept
+    void evict_unreferenced_gops();
+    // plan the dump in dumpPrefix, dumpTags and dumpRuns
+    int prepare_dump( uint32_t fromTs, uint32_t toTs );
+
+    FlvMemoryResource *resource;
+    size_t             slabSize;
+    std::vector<Slab>  slabs;
+    // slab being written
+    uint64_t writeSlab = 0;
+
+    // ring of the gop index, gopCount entries from gopHead
+    std::vector<Gop> gops;
+    size_t           gopHead  = 0;
+    size_t           gopCount = 0;
+
+    bool     hasAudio        = false;
+    bool     hasVideo        = false;
+    uint8_t  header[13]      = { 0 };
+    bool     recording       = false;
+    uint32_t newestTimestamp = 0;
+
+    // sequence headers, the newest last
+    std::vector<SequenceHeader> avcHeaders;
+    std::vector<SequenceHeader> aacHeaders;
+    uint64_t                    avcVersion = 0;
+    uint64_t                    aacVersion = 0;
+
+    uint64_t evictedGops = 0;
+    uint64_t droppedTags = 0;
+
+    // scratch space of dump
+    std::vector<uint8_t>     dumpPrefix;
+    size_t                   dumpHeaderBytes = 0;
+    std::vector<FlvBatchTag> dumpPrefixTags;
+    std::vector<FlvBatchTag> dumpTags;
+    std::vector<Run>         dumpRuns;
+    int64_t                  dumpBytes = 0;
+};
+
+/**
+ * @brief retain the flv in a FlvDvrBuffer of the caller, for BasicFlvMuxer<FlvDvrSink>.
+ */
+struct FlvDvrSink {
+    FlvDvrBuffer *dvr;
+
+    explicit FlvDvrSink( FlvDvrBuffer &dvr ) : dvr( &dvr ) {}
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes ) {
+        dvr->start( data, bytes );
+    }
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        dvr->add_tag( data, bytes );
+    }
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+        for ( size_t i = 0; i < count; i++ ) {
+            dvr->add_tag( data + tags[i].offset, tags[i].bytes );
+        }
+    }
+    // the metadata is regenerated by dump
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {}
+    void onEndMuxing() {}
+    int  onBackpressure() {
+        return 0;
+    }
+    // whole tags only, they are parsed
+    int onStreamingSupport() {
+        return FlvSinkStreamingNone;
+    }
+    void onMuxedDataPart( int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) {}
+};
+
+};     // namespace nx
+
+#endif // __FLV_DVR_H__
@@ -0,0 +1,683 @@
+#include "flv_fmp4.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "aac.h"
+#include "avc.h"
+#include "flv_reader.h"
+
+namespace nx {
+
+using MP4_BUFFER = std::vector<uint8_t>;
+
+static void mp4_put_u8( uint8_t value, MP4_BUFFER &buf ) {
+    buf.push_back( value );
+}
+
+static void mp4_put_u16( uint16_t value, MP4_BUFFER &buf ) {
+    buf.push_back( value >> 8 & 0xFF );
+    buf.push_back( value & 0xFF );
+}
+
+static void mp4_put_u24( uint32_t value, MP4_BUFFER &buf ) {
+    buf.push_back( value >> 16 & 0xFF );
+    buf.push_back( value >> 8 & 0xFF );
+    buf.push_back( value & 0xFF );
+}
+
+static void mp4_put_u32( uint32_t value, MP4_BUFFER &buf ) {
+    mp4_put_u16( value >> 16, buf );
+    mp4_put_u16( value & 0xFFFF, buf );
+}
+
+static void mp4_put_u64( uint64_t value, MP4_BUFFER &buf ) {
+    mp4_put_u32( value >> 32, buf );
+    mp4_put_u32( value & 0xFFFFFFFF, buf );
+}
+
+static void mp4_put_zeros( size_t count, MP4_BUFFER &buf ) {
+    buf.insert( buf.end(), count, 0 );
+}
+
+static void mp4_put_bytes( const void *data, size_t size, MP4_BUFFER &buf ) {
+    const uint8_t *p = (const uint8_t *)data;
+    buf.insert( buf.end(), p, p + size );
+}
+
+static void mp4_set_u32( size_t offset, uint32_t value, MP4_BUFFER &buf ) {
+    buf[offset]     = value >> 24 & 0xFF;
+    buf[offset + 1] = value >> 16 & 0xFF;
+    buf[offset + 2] = value >> 8 & 0xFF;
+    buf[offset + 3] = value & 0xFF;
+}
+
+/**
+ * @brief start a box, the size is written by mp4_end_box.
+ *
+ * @return offset of the box in buf
+ */
+static size_t mp4_begin_box( const char *type, MP4_BUFFER &buf ) {
+    size_t offset = buf.size();
+    mp4_put_u32( 0, buf );
+    mp4_put_bytes( type, 4, buf );
+    return offset;
+}
+
+static size_t mp4_begin_full_box( const char *type, uint8_t version, uint32_t flags, MP4_BUFFER &buf ) {
+    size_t offset = mp4_begin_box( type, buf );
+    mp4_put_u8( version, buf );
+    mp4_put_u24( flags, buf );
+    return offset;
+}
+
+static void mp4_end_box( size_t offset, MP4_BUFFER &buf ) {
+    mp4_set_u32( offset, (uint32_t)( buf.size() - offset ), buf );
+}
+
+// unity matrix
+static void mp4_put_matrix( MP4_BUFFER &buf ) {
+    const uint32_t matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for ( uint32_t value : matrix ) {
+        mp4_put_u32( value, buf );
+    }
+}
+
+namespace {
+
+struct Sample {
+    const uint8_t *data;
+    uint32_t       size;
+    uint32_t       timestamp; // dts, milliseconds
+    int32_t        compositionTime;
+    bool           isKeyFrame;
+};
+
+// a sample entry of stsd
+struct SampleDescription {
+    // avcC or AudioSpecificConfig, in the mapped input
+    const uint8_t *config;
+    uint32_t       configSize;
+    uint32_t       width;
+    uint32_t       height;
+    uint32_t       sampleRate;
+    uint32_t       channels;
+    uint32_t       frameLength;
+};
+
+struct Track {
+    uint32_t id = 0;
+    // video: milliseconds, audio: sample rate of the first description
+    uint32_t timescale = 0;
+    // one per distinct sequence header
+    std::vector<SampleDescription> descriptions;
+    // index of the description of the pending samples
+    uint32_t description = 0;
+
+    // tfdt of the next fragment
+    bool     started    = false;
+    uint64_t decodeTime = 0;
+    // audio decode time without rounding, the frame duration is not an integer after a sample rate change
+    double exactDecodeTime = 0;
+    // duration of the last video sample, used for the last sample of the stream
+    uint32_t lastDuration = 0;
+
+    std::vector<Sample> samples;
+
+    bool enabled() const {
+        return !descriptions.empty();
+    }
+    /**
+     * @brief find or add the description of a sequence header.
+     *
+     * @return index of the description, added is set if it is new.
+     */
+    uint32_t find_description( const SampleDescription &description, bool &added ) {
+        added = false;
+        for ( size_t i = 0; i < descriptions.size(); i++ ) {
+            if ( descriptions[i].configSize == description.configSize && memcmp( descriptions[i].config, description.config, description.configSize ) == 0 ) {
+                return (uint32_t)i;
+            }
+        }
+        added = true;
+        descriptions.push_back( description );
+        return (uint32_t)( descriptions.size() - 1 );
+    }
+};
+
+/**
+ * @brief gathers iovecs of a fragment, the payloads point to the mapped input.
+ */
+class VectorWriter {
+public:
+    explicit VectorWriter( int fd ) : fd( fd ) {}
+
+    int add( const void *data, size_t size ) {
+        if ( !size ) return 0;
+        iov.push_back( { (void *)data, size } );
+        if ( iov.size() >= IOV_MAX ) return flush();
+        return 0;
+    }
+    int flush() {
+        size_t first = 0;
+        while ( first < iov.size() ) {
+            int     count = (int)( iov.size() - first );
+            ssize_t n     = writev( fd, &iov[first], count );
+            if ( n < 0 ) {
+                if ( errno == EINTR ) continue;
+                return -1;
+            }
+            bytes += n;
+            // skip what was written, the last iovec may be partially written
+            while ( first < iov.size() && (size_t)n >= iov[first].iov_len ) {
+                n -= iov[first].iov_len;
+                first++;
+            }
+            if ( first < iov.size() ) {
+                iov[first].iov_base = (uint8_t *)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+        iov.clear();
+        return 0;
+    }
+
+    uint64_t bytes = 0;
+
+private:
+    int                fd;
+    std::vector<iovec> iov;
+};
+
+} // namespace
+
+/**
+ * @brief next tag of the mapped file.
+ *
+ * @return 1: got a tag, 0: end of file, <0: invalid or torn tag.
+ */
+static int next_tag( const uint8_t *file, uint64_t fileSize, uint64_t &offset, FlvTagInfo &tag ) {
+    if ( offset >= fileSize ) return 0;
+    if ( offset + FlvTagHeaderSize + 4 > fileSize ) return -1;
+    size_t available = (size_t)( fileSize - offset < FlvTagHeaderSize + 2 ? fileSize - offset : FlvTagHeaderSize + 2 );
+    if ( flv_parse_tag_header( file + offset, available, tag ) < 0 ) return -1;
+    if ( offset + tag.size() > fileSize ) return -1;
+    const uint8_t *p        = file + offset + tag.size() - 4;
+    uint32_t       previous = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    if ( previous != FlvTagHeaderSize + tag.dataSize ) return -1;
+    tag.offset = offset;
+    offset += tag.size();
+    return 1;
+}
+
+static void put_ftyp( MP4_BUFFER &buf ) {
+    size_t box = mp4_begin_box( "ftyp", buf );
+    mp4_put_bytes( "iso6", 4, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_bytes( "iso6", 4, buf );
+    mp4_put_bytes( "isom", 4, buf );
+    mp4_put_bytes( "avc1", 4, buf );
+    mp4_put_bytes( "mp41", 4, buf );
+    mp4_end_box( box, buf );
+}
+
+static void put_avc1( const SampleDescription &description, MP4_BUFFER &buf ) {
+    size_t box = mp4_begin_box( "avc1", buf );
+    mp4_put_zeros( 6, buf );
+    mp4_put_u16( 1, buf ); // data_reference_index
+    mp4_put_zeros( 16, buf );
+    mp4_put_u16( description.width, buf );
+    mp4_put_u16( description.height, buf );
+    mp4_put_u32( 0x00480000, buf ); // 72 dpi
+    mp4_put_u32( 0x00480000, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u16( 1, buf );    // frame_count
+    mp4_put_zeros( 32, buf ); // compressorname
+    mp4_put_u16( 0x0018, buf );
+    mp4_put_u16( 0xFFFF, buf );
+    size_t avcC = mp4_begin_box( "avcC", buf );
+    mp4_put_bytes( description.config, description.configSize, buf );
+    mp4_end_box( avcC, buf );
+    mp4_end_box( box, buf );
+}
+
+static void put_mp4a( const SampleDescription &description, uint32_t esId, MP4_BUFFER &buf ) {
+    size_t box = mp4_begin_box( "mp4a", buf );
+    mp4_put_zeros( 6, buf );
+    mp4_put_u16( 1, buf ); // data_reference_index
+    mp4_put_zeros( 8, buf );
+    mp4_put_u16( description.channels, buf );
+    mp4_put_u16( 16, buf ); // samplesize
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( description.sampleRate << 16, buf );
+
+    // ISO/IEC 14496-1 ES_Descriptor, the config is short enough for 1 byte sizes
+    size_t esds = mp4_begin_full_box( "esds", 0, 0, buf );
+    mp4_put_u8( 0x03, buf ); // ES_DescrTag
+    mp4_put_u8( 3 + 2 + 13 + 2 + description.configSize + 3, buf );
+    mp4_put_u16( esId, buf );
+    mp4_put_u8( 0, buf );
+    mp4_put_u8( 0x04, buf ); // DecoderConfigDescrTag
+    mp4_put_u8( 13 + 2 + description.configSize, buf );
+    mp4_put_u8( 0x40, buf ); // Audio ISO/IEC 14496-3
+    mp4_put_u8( 0x15, buf ); // AudioStream, upStream 0, reserved 1
+    mp4_put_u24( 0, buf );   // bufferSizeDB
+    mp4_put_u32( 0, buf );   // maxBitrate
+    mp4_put_u32( 0, buf );   // avgBitrate
+    mp4_put_u8( 0x05, buf ); // DecSpecificInfoTag
+    mp4_put_u8( description.configSize, buf );
+    mp4_put_bytes( description.config, description.configSize, buf );
+    mp4_put_u8( 0x06, buf ); // SLConfigDescrTag
+    mp4_put_u8( 1, buf );
+    mp4_put_u8( 2, buf ); // predefined, reserved for use in mp4 files
+    mp4_end_box( esds, buf );
+    mp4_end_box( box, buf );
+}
+
+static void put_trak( const Track &track, bool video, MP4_BUFFER &buf ) {
+    size_t trak = mp4_begin_box( "trak", buf );
+
+    size_t tkhd = mp4_begin_full_box( "tkhd", 0, 3, buf ); // enabled, in movie
+    mp4_put_u32( 0, buf );                                 // creation_time
+    mp4_put_u32( 0, buf );                                 // modification_time
+    mp4_put_u32( track.id, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 0, buf ); // duration, in the fragments
+    mp4_put_zeros( 8, buf );
+    mp4_put_u16( 0, buf ); // layer
+    mp4_put_u16( 0, buf ); // alternate_group
+    mp4_put_u16( video ? 0 : 0x0100, buf );
+    mp4_put_u16( 0, buf );
+    mp4_put_matrix( buf );
+    mp4_put_u32( track.descriptions[0].width << 16, buf );
+    mp4_put_u32( track.descriptions[0].height << 16, buf );
+    mp4_end_box( tkhd, buf );
+
+    size_t mdia = mp4_begin_box( "mdia", buf );
+    size_t mdhd = mp4_begin_full_box( "mdhd", 0, 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( track.timescale, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u16( 0x55C4, buf ); // und
+    mp4_put_u16( 0, buf );
+    mp4_end_box( mdhd, buf );
+
+    size_t hdlr = mp4_begin_full_box( "hdlr", 0, 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_bytes( video ? "vide" : "soun", 4, buf );
+    mp4_put_zeros( 12, buf );
+    const char *name = video ? "VideoHandler" : "SoundHandler";
+    mp4_put_bytes( name, strlen( name ) + 1, buf );
+    mp4_end_box( hdlr, buf );
+
+    size_t minf = mp4_begin_box( "minf", buf );
+    if ( video ) {
+        size_t vmhd = mp4_begin_full_box( "vmhd", 0, 1, buf );
+        mp4_put_zeros( 8, buf );
+        mp4_end_box( vmhd, buf );
+    }
+    else {
+        size_t smhd = mp4_begin_full_box( "smhd", 0, 0, buf );
+        mp4_put_zeros( 4, buf );
+        mp4_end_box( smhd, buf );
+    }
+    size_t dinf = mp4_begin_box( "dinf", buf );
+    size_t dref = mp4_begin_full_box( "dref", 0, 0, buf );
+    mp4_put_u32( 1, buf );
+    size_t url = mp4_begin_full_box( "url ", 0, 1, buf ); // media in the same file
+    mp4_end_box( url, buf );
+    mp4_end_box( dref, buf );
+    mp4_end_box( dinf, buf );
+
+    // samples are in the fragments, the sample tables are empty
+    size_t stbl = mp4_begin_box( "stbl", buf );
+    size_t stsd = mp4_begin_full_box( "stsd", 0, 0, buf );
+    mp4_put_u32( (uint32_t)track.descriptions.size(), buf );
+    for ( const SampleDescription &description : track.descriptions ) {
+        if ( video ) {
+            put_avc1( description, buf );
+        }
+        else {
+            put_mp4a( description, track.id, buf );
+        }
+    }
+    mp4_end_box( stsd, buf );
+    const char *emptyTables[] = { "stts", "stsc", "stco" };
+    for ( const char *type : emptyTables ) {
+        size_t table = mp4_begin_full_box( type, 0, 0, buf );
+        mp4_put_u32( 0, buf );
+        mp4_end_box( table, buf );
+    }
+    size_t stsz = mp4_begin_full_box( "stsz", 0, 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_end_box( stsz, buf );
+    mp4_end_box( stbl, buf );
+
+    mp4_end_box( minf, buf );
+    mp4_end_box( mdia, buf );
+    mp4_end_box( trak, buf );
+}
+
+static void put_moov( const Track &video, const Track &audio, MP4_BUFFER &buf ) {
+    size_t moov = mp4_begin_box( "moov", buf );
+    size_t mvhd = mp4_begin_full_box( "mvhd", 0, 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 1000, buf );
+    mp4_put_u32( 0, buf );
+    mp4_put_u32( 0x00010000, buf ); // rate 1.0
+    mp4_put_u16( 0x0100, buf );     // volume 1.0
+    mp4_put_zeros( 10, buf );
+    mp4_put_matrix( buf );
+    mp4_put_zeros( 24, buf );
+    mp4_put_u32( 3, buf ); // next_track_ID
+    mp4_end_box( mvhd, buf );
+
+    if ( video.enabled() ) put_trak( video, true, buf );
+    if ( audio.enabled() ) put_trak( audio, false, buf );
+
+    size_t mvex = mp4_begin_box( "mvex", buf );
+    for ( const Track *track : { &video, &audio } ) {
+        if ( !track->enabled() ) continue;
+        size_t trex = mp4_begin_full_box( "trex", 0, 0, buf );
+        mp4_put_u32( track->id, buf );
+        mp4_put_u32( 1, buf ); // default_sample_description_index
+        mp4_put_u32( 0, buf );
+        mp4_put_u32( 0, buf );
+        mp4_put_u32( 0, buf );
+        mp4_end_box( trex, buf );
+    }
+    mp4_end_box( mvex, buf );
+    mp4_end_box( moov, buf );
+}
+
+static void put_tfhd( const Track &track, MP4_BUFFER &buf ) {
+    size_t tfhd = mp4_begin_full_box( "tfhd", 0, 0x020002, buf ); // sample-description-index, default-base-is-moof
+    mp4_put_u32( track.id, buf );
+    mp4_put_u32( track.description + 1, buf );
+    mp4_end_box( tfhd, buf );
+}
+
+/**
+ * @brief video traf, durations from the dts deltas.
+ *
+ * @param nextTimestamp  dts of the first sample of the next fragment, the last sample lasts until it
+ * @param dataOffset  set to the offset of trun data_offset in buf
+ */
+static void put_video_traf( Track &track, bool hasNext, uint32_t nextTimestamp, MP4_BUFFER &buf, size_t &dataOffset ) {
+    size_t traf = mp4_begin_box( "traf", buf );
+    put_tfhd( track, buf );
+    size_t tfdt = mp4_begin_full_box( "tfdt", 1, 0, buf );
+    mp4_put_u64( track.samples[0].timestamp, buf );
+    mp4_end_box( tfdt, buf );
+
+    // data-offset, sample-duration, sample-size, sample-flags, sample-composition-time-offsets
+    size_t trun = mp4_begin_full_box( "trun", 1, 0x000F01, buf );
+    mp4_put_u32( (uint32_t)track.samples.size(), buf );
+    dataOffset = buf.size();
+    mp4_put_u32( 0, buf );
+    for ( size_t i = 0; i < track.samples.size(); i++ ) {
+        const Sample &sample = track.samples[i];
+        if ( i + 1 < track.samples.size() ) {
+            track.lastDuration = track.samples[i + 1].timestamp - sample.timestamp;
+        }
+        else if ( hasNext ) {
+            track.lastDuration = nextTimestamp - sample.timestamp;
+        }
+        mp4_put_u32( track.lastDuration, buf );
+        mp4_put_u32( sample.size, buf );
+        // sample_depends_on 2 for key frames, else sample_depends_on 1 and sample_is_non_sync_sample
+        mp4_put_u32( sample.isKeyFrame ? 0x02000000 : 0x01010000, buf );
+        mp4_put_u32( (uint32_t)sample.compositionTime, buf );
+    }
+    mp4_end_box( trun, buf );
+    mp4_end_box( traf, buf );
+}
+
+/**
+ * @brief audio traf, every aac frame lasts frameLength samples at the sample rate of its description.
+ */
+static void put_audio_traf( Track &track, MP4_BUFFER &buf, size_t &dataOffset ) {
+    if ( !track.started ) {
+        track.started         = true;
+        track.decodeTime      = (uint64_t)track.samples[0].timestamp * track.timescale / 1000;
+        track.exactDecodeTime = (double)track.decodeTime;
+    }
+    const SampleDescription &description = track.descriptions[track.description];
+    double                   duration    = (double)description.frameLength * track.timescale / description.sampleRate;
+
+    size_t traf = mp4_begin_box( "traf", buf );
+    put_tfhd( track, buf );
+    size_t tfdt = mp4_begin_full_box( "tfdt", 1, 0, buf );
+    mp4_put_u64( track.decodeTime, buf );
+    mp4_end_box( tfdt, buf );
+
+    // data-offset, sample-duration, sample-size
+    size_t trun = mp4_begin_full_box( "trun", 0, 0x000301, buf );
+    mp4_put_u32( (uint32_t)track.samples.size(), buf );
+    dataOffset = buf.size();
+    mp4_put_u32( 0, buf );
+    for ( const Sample &sample : track.samples ) {
+        track.exactDecodeTime += duration;
+        uint64_t next = (uint64_t)( track.exactDecodeTime + 0.5 );
+        mp4_put_u32( (uint32_t)( next - track.decodeTime ), buf );
+        mp4_put_u32( sample.size, buf );
+        track.decodeTime = next;
+    }
+    mp4_end_box( trun, buf );
+    mp4_end_box( traf, buf );
+}
+
+static uint64_t payload_size( const Track &track ) {
+    uint64_t size = 0;
+    for ( const Sample &sample : track.samples ) {
+        size += sample.size;
+    }
+    return size;
+}
+
+/**
+ * @brief write moof and mdat of the pending samples, the payloads are referenced from the input.
+ *
+ * @param video  null to keep the pending video samples for the next fragment
+ * @param audio  null to keep the pending audio samples for the next fragment
+ * @param hasNext  nextTimestamp is the dts of the next video sample
+ */
+static int write_fragment( VectorWriter &writer, uint32_t sequence, Track *video, Track *audio, bool hasNext, uint32_t nextTimestamp, MP4_BUFFER &buf ) {
+    if ( video && video->samples.empty() ) video = nullptr;
+    if ( audio && audio->samples.empty() ) audio = nullptr;
+    if ( !video && !audio ) return 0;
+    buf.clear();
+    size_t videoOffset = 0;
+    size_t audioOffset = 0;
+    size_t moof        = mp4_begin_box( "moof", buf );
+    size_t mfhd        = mp4_begin_full_box( "mfhd", 0, 0, buf );
+    mp4_put_u32( sequence, buf );
+    mp4_end_box( mfhd, buf );
+    if ( video ) put_video_traf( *video, hasNext, nextTimestamp, buf, videoOffset );
+    if ( audio ) put_audio_traf( *audio, buf, audioOffset );
+    mp4_end_box( moof, buf );
+
+    // the data offsets are relative to the start of moof, mdat header is 8 bytes
+    uint64_t videoBytes = video ? payload_size( *video ) : 0;
+    uint64_t audioBytes = audio ? payload_size( *audio ) : 0;
+    uint32_t moofSize   = (uint32_t)buf.size();
+    if ( videoOffset ) mp4_set_u32( videoOffset, moofSize + 8, buf );
+    if ( audioOffset ) mp4_set_u32( audioOffset, (uint32_t)( moofSize + 8 + videoBytes ), buf );
+    uint64_t mdatSize = 8 + videoBytes + audioBytes;
+    if ( mdatSize > UINT32_MAX ) return -1;
+    mp4_put_u32( (uint32_t)mdatSize, buf );
+    mp4_put_bytes( "mdat", 4, buf );
+
+    if ( writer.add( &buf[0], buf.size() ) < 0 ) return -1;
+    for ( Track *track : { video, audio } ) {
+        if ( !track ) continue;
+        for ( const Sample &sample : track->samples ) {
+            if ( writer.add( sample.data, sample.size ) < 0 ) return -1;
+        }
+    }
+    // buf and the samples must stay valid until the iovecs are written
+    if ( writer.flush() < 0 ) return -1;
+    if ( video ) video->samples.clear();
+    if ( audio ) audio->samples.clear();
+    return 0;
+}
+
+static bool video_description( const uint8_t *data, uint32_t dataSize, SampleDescription &description ) {
+    H264SPS sps;
+    if ( dataSize <= 5 || avc_decode_avcc_sps( &sps, data + 5, dataSize - 5 ) < 0 ) return false;
+    description = { data + 5, dataSize - 5, 0, 0, 0, 0, 0 };
+    sps.get_resolution( description.width, description.height );
+    return true;
+}
+
+static bool audio_description( const uint8_t *data, uint32_t dataSize, SampleDescription &description ) {
+    AudioSpecificConfig config;
+    if ( dataSize <= 2 || config.parse( data + 2, dataSize - 2 ) < 0 ) return false;
+    description = { data + 2, dataSize - 2, 0, 0, config.sampleRate(), config.channelConfiguration, config.frameLengthFlag ? 960u : 1024u };
+    if ( !description.channels ) description.channels = 2;
+    return true;
+}
+
+/**
+ * @brief ftyp, moov and a free box, the free box leaves room for sample entries of later sequence headers.
+ *
+ * @return 0: success, <0: the moov does not fit in reserved bytes.
+ */
+static int build_header( const Track &video, const Track &audio, size_t reserved, MP4_BUFFER &buf ) {
+    buf.clear();
+    put_ftyp( buf );
+    put_moov( video, audio, buf );
+    if ( reserved ) {
+        if ( buf.size() + 8 > reserved ) return -1;
+        size_t free = mp4_begin_box( "free", buf );
+        mp4_put_zeros( reserved - buf.size(), buf );
+        mp4_end_box( free, buf );
+    }
+    return 0;
+}
+
+int flv_remux_fmp4( const char *input, const char *output, const FlvFmp4Options &options, FlvFmp4Report *report ) {
+    int fd = open( input, O_RDONLY );
+    if ( fd < 0 ) return -1;
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || st.st_size < FlvFileHeaderSize ) {
+        close( fd );
+        return -1;
+    }
+    uint64_t fileSize = st.st_size;
+    void    *mapped   = mmap( nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( mapped == MAP_FAILED ) return -1;
+    madvise( mapped, fileSize, MADV_SEQUENTIAL );
+    const uint8_t *file = (const uint8_t *)mapped;
+
+    int           ret = -1;
+    int           out = -1;
+    FlvFmp4Report result;
+    Track         video;
+    Track         audio;
+    FlvTagInfo    tag;
+    uint64_t      offset   = FlvFileHeaderSize;
+    bool          hasAudio = false;
+    bool          hasVideo = false;
+    do {
+        if ( flv_parse_header( file, FlvFileHeaderSize, &hasAudio, &hasVideo ) < 0 ) break;
+
+        // the sequence headers come before the first frames
+        video.id        = 1;
+        video.timescale = 1000;
+        audio.id        = 2;
+        for ( int count = 0; count < 1024 && ( ( hasVideo && !video.enabled() ) || ( hasAudio && !audio.enabled() ) ); count++ ) {
+            if ( next_tag( file, fileSize, offset, tag ) <= 0 ) break;
+            if ( tag.packetType != 0 ) continue;
+            const uint8_t    *data = file + tag.offset + FlvTagHeaderSize;
+            SampleDescription description;
+            bool              added = false;
+            if ( tag.type == 9 && tag.codec == 7 && !video.enabled() && video_description( data, tag.dataSize, description ) ) {
+                video.find_description( description, added );
+            }
+            else if ( tag.type == 8 && tag.codec == 10 && !audio.enabled() && audio_description( data, tag.dataSize, description ) ) {
+                audio.find_description( description, added );
+                audio.timescale = description.sampleRate;
+            }
+        }
+        if ( !video.enabled() && !audio.enabled() ) break;
+
+        out = open( output, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if ( out < 0 ) break;
+        VectorWriter writer( out );
+        MP4_BUFFER   buf;
+        if ( build_header( video, audio, 0, buf ) < 0 ) break;
+        size_t reserved = buf.size() + options.moovPadding;
+        if ( build_header( video, audio, reserved, buf ) < 0 ) break;
+        if ( writer.add( &buf[0], buf.size() ) < 0 || writer.flush() < 0 ) break;
+
+        offset        = FlvFileHeaderSize;
+        int tagResult = 0;
+        while ( ( tagResult = next_tag( file, fileSize, offset, tag ) ) > 0 ) {
+            const uint8_t *data  = file + tag.offset + FlvTagHeaderSize;
+            Track         *track = nullptr;
+            if ( tag.type == 9 && tag.codec == 7 && video.enabled() && tag.dataSize >= 5 ) track = &video;
+            if ( tag.type == 8 && tag.codec == 10 && audio.enabled() && tag.dataSize >= 2 ) track = &audio;
+            if ( !track ) continue;
+
+            if ( tag.packetType == 0 ) {
+                SampleDescription description;
+                bool              valid = track == &video ? video_description( data, tag.dataSize, description ) : audio_description( data, tag.dataSize, description );
+                if ( !valid ) continue;
+                bool     added = false;
+                uint32_t index = track->find_description( description, added );
+                if ( added ) {
+                    // a new sample entry, rewrite moov in place
+                    if ( build_header( video, audio, reserved, buf ) < 0 || pwrite( out, &buf[0], buf.size(), 0 ) != (ssize_t)buf.size() ) break;
+                }
+                if ( index != track->description ) {
+                    // a traf has one sample description, write the pending samples of this track
+                    if ( !track->samples.empty() && write_fragment( writer, (uint32_t)++result.fragments, track == &video ? &video : nullptr, track == &audio ? &audio : nullptr, true, tag.timestamp, buf ) < 0 ) break;
+                    track->description = index;
+                }
+                continue;
+            }
+            if ( track == &video ) {
+                if ( tag.packetType != 1 ) continue;
+                if ( tag.isKeyFrame && !video.samples.empty() ) {
+                    if ( write_fragment( writer, (uint32_t)++result.fragments, &video, &audio, true, tag.timestamp, buf ) < 0 ) break;
+                }
+                // signed 24 bits composition time
+                int32_t compositionTime = (int32_t)( (uint32_t)data[2] << 24 | (uint32_t)data[3] << 16 | (uint32_t)data[4] << 8 ) >> 8;
+                video.samples.push_back( { data + 5, tag.dataSize - 5, tag.timestamp, compositionTime, tag.isKeyFrame } );
+                result.videoSamples += 1;
+            }
+            else {
+                // video streams are cut at key frames
+                if ( !video.enabled() && !audio.samples.empty() && tag.timestamp - audio.samples[0].timestamp >= options.audioFragmentMs ) {
+                    if ( write_fragment( writer, (uint32_t)++result.fragments, &video, &audio, true, tag.timestamp, buf ) < 0 ) break;
+                }
+                audio.samples.push_back( { data + 2, tag.dataSize - 2, tag.timestamp, 0, true } );
+                result.audioSamples += 1;
+            }
+        }
+        if ( tagResult > 0 ) break; // moov padding exhausted or write error
+        if ( !video.samples.empty() || !audio.samples.empty() ) {
+            if ( write_fragment( writer, (uint32_t)++result.fragments, &video, &audio, false, 0, buf ) < 0 ) break;
+        }
+        result.bytes = writer.bytes;
+        ret          = 0;
+    } while ( 0 );
+
+    if ( out >= 0 ) close( out );
+    munmap( mapped, fileSize );
+    if ( ret == 0 && report ) *report = result;
+    return ret;
+}
+
+}; // namespace nx
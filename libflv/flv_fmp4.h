@@ -0,0 +1,42 @@
+#ifndef __FLV_FMP4_H__
+#define __FLV_FMP4_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nx {
+
+struct FlvFmp4Options {
+    // audio only streams are cut in fragments of this duration, video streams are cut at every key frame
+    uint32_t audioFragmentMs = 2000;
+    // free bytes after moov, sample entries of sequence headers which change in the middle of the stream are added there
+    size_t moovPadding = 4096;
+};
+
+struct FlvFmp4Report {
+    uint64_t fragments    = 0;
+    uint64_t videoSamples = 0;
+    uint64_t audioSamples = 0;
+    // output size
+    uint64_t bytes = 0;
+};
+
+/**
+ * @brief remux a flv file with avc and/or aac to fragmented mp4, ftyp and moov followed by one moof and mdat per gop.
+ * The avcC and the AudioSpecificConfig are taken from the sequence headers as they are,
+ * and the samples are written from the memory mapped input with writev, the payloads are not copied.
+ * A sequence header which changes in the middle of the stream adds a sample entry to stsd,
+ * moov is rewritten in place in the padding reserved after it.
+ * The tags after a torn or invalid tag are ignored.
+ *
+ * @param input  flv file path
+ * @param output  mp4 file path, created or truncated
+ * @param report  can be null
+ * @return 0: success, <0: io error, not a flv file, no avc/aac sequence header,
+ * or the sample entries do not fit in FlvFmp4Options::moovPadding.
+ */
+int flv_remux_fmp4( const char *input, const char *output, const FlvFmp4Options &options, FlvFmp4Report *report );
+
+};     // namespace nx
+
+#endif // __FLV_FMP4_H__
@@ -0,0 +1,156 @@
+#include "flv_ingest.h"
+#include <chrono>
+#include <cstring>
+#include <new>
+
+namespace nx {
+
+FlvIngestQueue::FlvIngestQueue( FlvMemoryResource *resource, size_t maxBatchFrames )
+    : head( &stub ), queued( 0 ), peakQueued( 0 ), pushedCount( 0 ), muxedCount( 0 ), rejectedCount( 0 ), waiting( false ) {
+    this->resource       = resource;
+    this->maxBatchFrames = maxBatchFrames ? maxBatchFrames : 1;
+    this->tail           = &stub;
+    stub.next.store( nullptr, std::memory_order_relaxed );
+    batchFrames.resize( this->maxBatchFrames );
+    batchNodes.resize( this->maxBatchFrames );
+}
+
+FlvIngestQueue::~FlvIngestQueue() {
+    // the producers are gone, a pending link cannot be left behind
+    while ( Node *node = dequeue() ) {
+        if ( node->release ) node->release( node->opaque, node->frame );
+        free_node( node );
+    }
+}
+
+void FlvIngestQueue::enqueue( Node *node ) {
+    node->next.store( nullptr, std::memory_order_relaxed );
+    Node *previous = head.exchange( node, std::memory_order_acq_rel );
+    previous->next.store( node, std::memory_order_release );
+}
+
+FlvIngestQueue::Node *FlvIngestQueue::dequeue() {
+    Node *first = tail;
+    Node *next  = first->next.load( std::memory_order_acquire );
+    // skip the stub
+    if ( first == &stub ) {
+        if ( !next ) return nullptr;
+        tail  = next;
+        first = next;
+        next  = next->next.load( std::memory_order_acquire );
+    }
+    if ( next ) {
+        tail = next;
+        return first;
+    }
+    // first is the last linked node, a producer may be linking a new one
+    if ( first != head.load( std::memory_order_acquire ) ) return nullptr;
+    // put the stub back behind first, so first can be taken
+    enqueue( &stub );
+    next = first->next.load( std::memory_order_acquire );
+    if ( next ) {
+        tail = next;
+        return first;
+    }
+    return nullptr;
+}
+
+FlvIngestQueue::Node *FlvIngestQueue::allocate_node( const FlvFrame &frame, size_t dataBytes ) {
+    size_t bytes = sizeof( Node ) + dataBytes;
+    Node  *node  = (Node *)resource->allocate( bytes );
+    if ( !node ) {
+        rejectedCount.fetch_add( 1, std::memory_order_relaxed );
+        return nullptr;
+    }
+    new ( node ) Node();
+    node->frame   = frame;
+    node->release = nullptr;
+    node->opaque  = nullptr;
+    node->bytes   = bytes;
+    return node;
+}
+
+void FlvIngestQueue::publish( Node *node ) {
+    size_t depth = queued.fetch_add( 1, std::memory_order_seq_cst ) + 1;
+    size_t peak  = peakQueued.load( std::memory_order_relaxed );
+    while ( depth > peak && !peakQueued.compare_exchange_weak( peak, depth, std::memory_order_relaxed ) ) {
+    }
+    pushedCount.fetch_add( 1, std::memory_order_relaxed );
+    enqueue( node );
+    // wake the consumer, only when it waits
+    if ( waiting.load( std::memory_order_seq_cst ) ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        cond.notify_one();
+    }
+}
+
+int FlvIngestQueue::push( const FlvFrame &frame, FlvFrameRelease release, void *opaque ) {
+    Node *node = allocate_node( frame, 0 );
+    if ( !node ) return -1;
+    node->release = release;
+    node->opaque  = opaque;
+    publish( node );
+    return 0;
+}
+
+int FlvIngestQueue::push_copy( const FlvFrame &frame ) {
+    // one allocation, the data follows the node
+    Node *node = allocate_node( frame, frame.length );
+    if ( !node ) return -1;
+    node->frame.data = (uint8_t *)( node + 1 );
+    memcpy( node->frame.data, frame.data, frame.length );
+    publish( node );
+    return 0;
+}
+
+size_t FlvIngestQueue::pop_batch( size_t maxFrames ) {
+    size_t count = 0;
+    while ( count < maxBatchFrames && count < maxFrames ) {
+        Node *node = dequeue();
+        if ( !node ) break;
+        batchNodes[count]  = node;
+        batchFrames[count] = node->frame;
+        count += 1;
+    }
+    batchCount = count;
+    return count;
+}
+
+void FlvIngestQueue::release_batch() {
+    for ( size_t i = 0; i < batchCount; i++ ) {
+        Node *node = batchNodes[i];
+        if ( node->release ) node->release( node->opaque, node->frame );
+        free_node( node );
+    }
+    queued.fetch_sub( batchCount, std::memory_order_relaxed );
+    muxedCount.fetch_add( batchCount, std::memory_order_relaxed );
+    batchCount = 0;
+}
+
+void FlvIngestQueue::free_node( Node *node ) {
+    size_t bytes = node->bytes;
+    node->~Node();
+    resource->deallocate( node, bytes );
+}
+
+bool FlvIngestQueue::wait( uint32_t timeoutMs ) {
+    if ( queued.load( std::memory_order_seq_cst ) ) return true;
+    std::unique_lock<std::mutex> lock( mutex );
+    // a producer either sees waiting, or its frame is counted before the check below
+    waiting.store( true, std::memory_order_seq_cst );
+    cond.wait_for( lock, std::chrono::milliseconds( timeoutMs ), [this]() {
+        return queued.load( std::memory_order_seq_cst ) != 0;
+    } );
+    waiting.store( false, std::memory_order_relaxed );
+    return queued.load( std::memory_order_relaxed ) != 0;
+}
+
+void FlvIngestQueue::get_stats( FlvIngestStats &stats ) const {
+    stats.pushed    = pushedCount.load( std::memory_order_relaxed );
+    stats.muxed     = muxedCount.load( std::memory_order_relaxed );
+    stats.rejected  = rejectedCount.load( std::memory_order_relaxed );
+    stats.depth     = queued.load( std::memory_order_relaxed );
+    stats.peakDepth = peakQueued.load( std::memory_order_relaxed );
+}
+
+}; // namespace nx
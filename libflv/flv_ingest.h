@@ -0,0 +1,164 @@
+#ifndef __FLV_INGEST_H__
+#define __FLV_INGEST_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "flv_memory.h"
+#include "flvmuxer.h"
+
+namespace nx {
+
+/**
+ * @brief called by the consumer once a queued frame is muxed or discarded,
+ * to free a transferred buffer or to signal the producer that a borrowed one can be reused.
+ */
+typedef void ( *FlvFrameRelease )( void *opaque, const FlvFrame &frame );
+
+struct FlvIngestStats {
+    // frames pushed by the producers
+    uint64_t pushed = 0;
+    // frames given to the muxer
+    uint64_t muxed = 0;
+    // frames rejected because the memory resource failed
+    uint64_t rejected = 0;
+    // frames pushed and not yet muxed
+    size_t depth = 0;
+    // largest depth so far
+    size_t peakDepth = 0;
+};
+
+/**
+ * @brief thread safe front end of a muxer, for audio and video encoders running on their own threads.
+ * Producers push frame descriptors to a lock-free multi-producer single-consumer queue (Vyukov's intrusive queue),
+ * a push is one allocation and one atomic exchange, producers never wait for each other or for the muxer.
+ * A single consumer thread drains the queue into the muxer with mux_batch, in push order,
+ * enable set_interleaving of the muxer when the encoders have different delays.
+ *
+ * Frame buffers are either borrowed, with an optional FlvFrameRelease called when the frame is done,
+ * or copied into the queue by push_copy.
+ */
+class FlvIngestQueue {
+public:
+    /**
+     * @param resource  memory of the queue nodes, used from every producer thread, it must be thread safe
+     * @param maxBatchFrames  frames per mux_batch call of drain
+     */
+    explicit FlvIngestQueue( FlvMemoryResource *resource = flv_default_resource(), size_t maxBatchFrames = 64 );
+    /**
+     * @brief queued frames are released without being muxed.
+     */
+    ~FlvIngestQueue();
+    FlvIngestQueue( const FlvIngestQueue & )            = delete;
+    FlvIngestQueue &operator=( const FlvIngestQueue & ) = delete;
+
+    /**
+     * @brief queue a frame with a borrowed buffer, any producer thread.
+     *
+     * @param frame  the frame, data must stay valid until release is called, or until drained when release is null
+     * @param release  called by the consumer when the frame is muxed or discarded, may be null
+     * @param opaque  passed to release
+     * @return 0: success, <0: no memory, release is not called
+     */
+    int push( const FlvFrame &frame, FlvFrameRelease release = nullptr, void *opaque = nullptr );
+    /**
+     * @brief queue a copy of the frame, the buffer can be reused on return, any producer thread.
+     *
+     * @return 0: success, <0: no memory
+     */
+    int push_copy( const FlvFrame &frame );
+
+    /**
+     * @brief mux the queued frames, consumer thread only.
+     * Frames pushed concurrently may be left for the next call.
+     *
+     * @param muxer  BasicFlvMuxer of any sink
+     * @param maxFrames  stop after this many frames
+     * @return frames muxed
+     */
+    template <typename Muxer>
+    size_t drain( Muxer &muxer, size_t maxFrames = SIZE_MAX ) {
+        size_t total = 0;
+        while ( total < maxFrames ) {
+            size_t count = pop_batch( maxFrames - total );
+            if ( !count ) break;
+            muxer.mux_batch( &batchFrames[0], count );
+            release_batch();
+            total += count;
+        }
+        return total;
+    }
+    /**
+     * @brief wait until a frame is queued, consumer thread only.
+     * Producers take a lock to wake the consumer only while it waits here.
+     *
+     * @param timeoutMs  longest wait in milliseconds
+     * @return true if frames are queued
+     */
+    bool wait( uint32_t timeoutMs );
+    /**
+     * @brief frames pushed and not yet muxed, any thread.
+     */
+    size_t depth() const {
+        return queued.load( std::memory_order_relaxed );
+    }
+    /**
+     * @brief counters and depth, any thread.
+     */
+    void get_stats( FlvIngestStats &stats ) const;
+
+private:
+    struct Node {
+        std::atomic<Node *> next;
+        FlvFrame            frame;
+        FlvFrameRelease     release;
+        void               *opaque;
+        // bytes of the allocation, the node is followed by the frame data for push_copy
+        size_t bytes;
+    };
+
+    // a node with room for dataBytes after it, null when the resource fails
+    Node *allocate_node( const FlvFrame &frame, size_t dataBytes );
+    // count the node and link it, then wake the consumer if it waits
+    void publish( Node *node );
+    void enqueue( Node *node );
+    // the oldest node, null when empty or when a producer is between its exchange and its link
+    Node *dequeue();
+    // pop up to maxFrames nodes into batchFrames and batchNodes
+    size_t pop_batch( size_t maxFrames );
+    // release and free the nodes of the last pop_batch
+    void release_batch();
+    void free_node( Node *node );
+
+    FlvMemoryResource *resource;
+    size_t             maxBatchFrames;
+
+    // producers exchange head, the consumer owns tail
+    std::atomic<Node *> head;
+    Node               *tail;
+    Node                stub;
+
+    std::atomic<size_t>   queued;
+    std::atomic<size_t>   peakQueued;
+    std::atomic<uint64_t> pushedCount;
+    std::atomic<uint64_t> muxedCount;
+    std::atomic<uint64_t> rejectedCount;
+
+    // wake up of the consumer, only used while it waits
+    std::atomic<bool>       waiting;
+    std::mutex              mutex;
+    std::condition_variable cond;
+
+    // consumer scratch space
+    std::vector<FlvFrame> batchFrames;
+    std::vector<Node *>   batchNodes;
+    size_t                batchCount = 0;
+};
+
+};     // namespace nx
+
+#endif // __FLV_INGEST_H__
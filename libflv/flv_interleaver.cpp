@@ -0,0 +1,106 @@
+#include "flv_interleaver.h"
+#include <algorithm>
+
+namespace nx {
+
+// std heap is a max-heap, order by the greater timestamp to get a min-heap
+static bool later( const FlvInterleaver::Tag &a, const FlvInterleaver::Tag &b ) {
+    if ( a.timestamp != b.timestamp ) return a.timestamp > b.timestamp;
+    return a.sequence > b.sequence;
+}
+
+FlvInterleaver::FlvInterleaver( bool hasAudio, bool hasVideo, uint32_t maxLatencyMs, size_t maxQueuedTags, FlvMemoryResource *resource ) {
+    this->hasAudio      = hasAudio;
+    this->hasVideo      = hasVideo;
+    this->maxLatencyMs  = maxLatencyMs;
+    this->maxQueuedTags = maxQueuedTags ? maxQueuedTags : 1;
+    this->resource      = resource;
+    this->heap          = std::vector<Tag, FlvAllocator<Tag>>( FlvAllocator<Tag>( resource ) );
+}
+
+void FlvInterleaver::push( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+    // copied first, the state is unchanged when the allocation fails
+    Tag tag;
+    tag.data = std::vector<uint8_t, FlvAllocator<uint8_t>>( data, data + bytes, FlvAllocator<uint8_t>( resource ) );
+    if ( heap.size() == heap.capacity() ) heap.reserve( heap.size() * 2 + 16 );
+
+    if ( type == 8 ) {
+        audioStarted   = true;
+        audioWatermark = std::max( audioWatermark, timestamp );
+    }
+    else if ( type == 9 ) {
+        videoStarted   = true;
+        videoWatermark = std::max( videoWatermark, timestamp );
+    }
+    newestTimestamp = std::max( newestTimestamp, timestamp );
+
+    tag.type      = type;
+    tag.timestamp = timestamp;
+    tag.sequence  = nextSequence++;
+    heap.push_back( std::move( tag ) );
+    std::push_heap( heap.begin(), heap.end(), later );
+}
+
+bool FlvInterleaver::pop( Tag &tag, bool flush ) {
+    if ( heap.empty() ) return false;
+    const Tag &top = heap.front();
+
+    bool release = flush;
+    if ( !release ) {
+        // released when every expected track has reached the timestamp
+        bool audioReady = !hasAudio || ( audioStarted && audioWatermark >= top.timestamp );
+        bool videoReady = !hasVideo || ( videoStarted && videoWatermark >= top.timestamp );
+        release         = audioReady && videoReady;
+    }
+    if ( !release && ( newestTimestamp - top.timestamp > maxLatencyMs || heap.size() > maxQueuedTags ) ) {
+        release = true;
+        stats.forcedReleases += 1;
+    }
+    if ( !release ) return false;
+
+    std::pop_heap( heap.begin(), heap.end(), later );
+    tag = std::move( heap.back() );
+    heap.pop_back();
+
+    uint32_t hold = newestTimestamp - tag.timestamp;
+    if ( hold > stats.maxHoldMs ) stats.maxHoldMs = hold;
+    if ( released && tag.sequence < maxReleasedSequence ) stats.reorders += 1;
+    if ( !released || tag.sequence > maxReleasedSequence ) maxReleasedSequence = tag.sequence;
+
+    if ( released && tag.timestamp < lastReleaseTimestamp ) {
+        // late tag, raise the timestamp in the tag header, low 24 bits big endian and the extended byte
+        stats.lateTags += 1;
+        uint32_t raise = lastReleaseTimestamp - tag.timestamp;
+        tag.timestamp  = lastReleaseTimestamp;
+        if ( tag.data.size() >= 8 ) {
+            tag.data[4] = tag.timestamp >> 16 & 0xFF;
+            tag.data[5] = tag.timestamp >> 8 & 0xFF;
+            tag.data[6] = tag.timestamp & 0xFF;
+            tag.data[7] = tag.timestamp >> 24 & 0xFF;
+        }
+        // avc nalu, lower the composition time so that pts = dts + cts stays, down to 0
+        if ( tag.type == 9 && tag.data.size() >= 16 && ( tag.data[11] & 0x0F ) == 7 && tag.data[12] == 1 ) {
+            int32_t cts = (int32_t)( (uint32_t)tag.data[13] << 24 | (uint32_t)tag.data[14] << 16 | (uint32_t)tag.data[15] << 8 ) >> 8;
+            if ( cts < 0 || (uint32_t)cts < raise ) {
+                stats.ptsShifts += 1;
+                cts = 0;
+            }
+            else {
+                cts -= (int32_t)raise;
+            }
+            tag.data[13] = cts >> 16 & 0xFF;
+            tag.data[14] = cts >> 8 & 0xFF;
+            tag.data[15] = cts & 0xFF;
+        }
+    }
+    released             = true;
+    lastReleaseTimestamp = tag.timestamp;
+    return true;
+}
+
+void FlvInterleaver::get_stats( FlvInterleaverStats &stats ) const {
+    stats        = this->stats;
+    stats.queued = heap.size();
+}
+
+}; // namespace nx
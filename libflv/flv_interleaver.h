@@ -0,0 +1,99 @@
+#ifndef __FLV_INTERLEAVER_H__
+#define __FLV_INTERLEAVER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "flv_memory.h"
+
+namespace nx {
+
+struct FlvInterleaverStats {
+    // tags released after a tag which was received later
+    uint64_t reorders = 0;
+    // tags released because the latency budget or the queue limit was exceeded
+    uint64_t forcedReleases = 0;
+    // tags older than the last released tag, their timestamp is raised to keep the output monotonic
+    uint64_t lateTags = 0;
+    // late avc frames whose pts moved, the composition time was smaller than the raise of the timestamp
+    uint64_t ptsShifts = 0;
+    // largest time a tag was held, in stream time milliseconds
+    uint32_t maxHoldMs = 0;
+    // tags currently held
+    size_t queued = 0;
+};
+
+/**
+ * @brief hold audio and video tags in a min-heap keyed by timestamp,
+ * and release them in timestamp order once the other track has caught up,
+ * or when the latency budget expires.
+ */
+class FlvInterleaver {
+public:
+    struct Tag {
+        int                                         type;
+        uint32_t                                    timestamp;
+        uint64_t                                    sequence; // arrival order, keeps tags of the same timestamp in order
+        std::vector<uint8_t, FlvAllocator<uint8_t>> data;     // the whole tag, with tag header and tag size
+    };
+
+    /**
+     * @param hasAudio  whether audio tags are expected
+     * @param hasVideo  whether video tags are expected
+     * @param maxLatencyMs  a tag is released at the latest when a tag maxLatencyMs newer has been pushed
+     * @param maxQueuedTags  hard limit of held tags
+     * @param resource  memory of the held tags
+     */
+    FlvInterleaver( bool hasAudio, bool hasVideo, uint32_t maxLatencyMs, size_t maxQueuedTags = 1024, FlvMemoryResource *resource = flv_default_resource() );
+
+    /**
+     * @brief push a tag, the data is copied.
+     * Throws std::bad_alloc when the memory resource fails.
+     *
+     * @param type  8 - audio, 9 - video, 18 - script data
+     * @param data  the whole tag, with tag header and tag size
+     * @param bytes  tag bytes
+     * @param timestamp  tag timestamp
+     */
+    void push( int type, const uint8_t *data, size_t bytes, uint32_t timestamp );
+    /**
+     * @brief pop the next tag which can be released.
+     *
+     * @param tag  filled with the released tag
+     * @param flush  release every held tag regardless of the other track
+     * @return true if a tag was released
+     */
+    bool pop( Tag &tag, bool flush = false );
+
+    void get_stats( FlvInterleaverStats &stats ) const;
+
+private:
+    bool     hasAudio;
+    bool     hasVideo;
+    uint32_t maxLatencyMs;
+    size_t   maxQueuedTags;
+
+    FlvMemoryResource *resource;
+
+    std::vector<Tag, FlvAllocator<Tag>> heap;
+    uint64_t                            nextSequence = 0;
+
+    // newest pushed timestamp of each track
+    bool     audioStarted    = false;
+    bool     videoStarted    = false;
+    uint32_t audioWatermark  = 0;
+    uint32_t videoWatermark  = 0;
+    uint32_t newestTimestamp = 0;
+
+    // last released tag
+    bool     released             = false;
+    uint32_t lastReleaseTimestamp = 0;
+    uint64_t maxReleasedSequence  = 0;
+
+    FlvInterleaverStats stats;
+};
+
+};     // namespace nx
+
+#endif // __FLV_INTERLEAVER_H__
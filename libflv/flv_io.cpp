@@ -0,0 +1,73 @@
+#include "flv_io.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <vector>
+
+namespace nx {
+
+int flv_write_all( int fd, const uint8_t *data, size_t size ) {
+    while ( size > 0 ) {
+        ssize_t n = write( fd, data, size );
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int flv_pread_all( int fd, uint8_t *dst, size_t size, uint64_t offset ) {
+    size_t done = 0;
+    while ( done < size ) {
+        ssize_t n = pread( fd, dst + done, size - done, offset + done );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// errors which mean the kernel can not do this copy, not an io error
+static bool copy_not_supported( int error ) {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+
+int flv_copy_file_range( int in, uint64_t offset, int out, uint64_t size ) {
+    // 1 GiB per call, copy_file_range and sendfile copy at most 2 GiB
+    const size_t MaxChunk = 1 << 30;
+#if defined( __GLIBC__ ) && ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 27 ) )
+    while ( size > 0 ) {
+        loff_t  inOffset = offset;
+        ssize_t n        = copy_file_range( in, &inOffset, out, nullptr, size < MaxChunk ? (size_t)size : MaxChunk, 0 );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n < 0 && copy_not_supported( errno ) ) break;
+        if ( n <= 0 ) return -1;
+        offset += n;
+        size -= n;
+    }
+#endif
+    while ( size > 0 ) {
+        off_t   inOffset = offset;
+        ssize_t n        = sendfile( out, in, &inOffset, size < MaxChunk ? (size_t)size : MaxChunk );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n < 0 && copy_not_supported( errno ) ) break;
+        if ( n <= 0 ) return -1;
+        offset += n;
+        size -= n;
+    }
+    // read and write the rest
+    std::vector<uint8_t> buf( size ? 1 << 20 : 0 );
+    while ( size > 0 ) {
+        size_t want = size < buf.size() ? (size_t)size : buf.size();
+        if ( flv_pread_all( in, &buf[0], want, offset ) < 0 || flv_write_all( out, &buf[0], want ) < 0 ) return -1;
+        offset += want;
+        size -= want;
+    }
+    return 0;
+}
+
+}; // namespace nx
@@ -0,0 +1,34 @@
+#ifndef __FLV_IO_H__
+#define __FLV_IO_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nx {
+
+/**
+ * @brief write all bytes at the current position of fd.
+ *
+ * @return 0: success, <0: io error, errno is set.
+ */
+int flv_write_all( int fd, const uint8_t *data, size_t size );
+
+/**
+ * @brief read size bytes at offset.
+ *
+ * @return 0: success, <0: io error or end of file.
+ */
+int flv_pread_all( int fd, uint8_t *dst, size_t size, uint64_t offset );
+
+/**
+ * @brief copy [offset, offset + size) of in to the current position of out, without a copy in user space when possible.
+ * copy_file_range is tried first, it shares the extents on filesystems with reflinks, e.g. btrfs and xfs,
+ * then sendfile, then read and write.
+ *
+ * @return 0: success, <0: io error or end of file.
+ */
+int flv_copy_file_range( int in, uint64_t offset, int out, uint64_t size );
+
+};     // namespace nx
+
+#endif // __FLV_IO_H__
@@ -0,0 +1,162 @@
+#include "flv_memory.h"
+#include <cstdlib>
+
+namespace nx {
+
+static size_t align_up( size_t value, size_t alignment ) {
+    return ( value + alignment - 1 ) & ~( alignment - 1 );
+}
+
+namespace {
+
+class HeapResource : public FlvMemoryResource {
+protected:
+    void *do_allocate( size_t bytes, size_t alignment ) override {
+        if ( alignment <= DefaultAlignment ) return malloc( bytes ? bytes : 1 );
+        void *p = nullptr;
+        if ( posix_memalign( &p, alignment, bytes ? bytes : 1 ) != 0 ) return nullptr;
+        return p;
+    }
+    void do_deallocate( void *p, size_t bytes, size_t alignment ) override {
+        free( p );
+    }
+    bool do_is_equal( const FlvMemoryResource &other ) const override {
+        return dynamic_cast<const HeapResource *>( &other ) != nullptr;
+    }
+};
+
+} // namespace
+
+FlvMemoryResource *flv_default_resource() {
+    static HeapResource resource;
+    return &resource;
+}
+
+FlvMonotonicResource::FlvMonotonicResource( size_t initialSize, FlvMemoryResource *upstream ) {
+    this->upstream  = upstream;
+    this->firstSize = initialSize > sizeof( Chunk ) ? initialSize : 4096;
+    this->nextSize  = firstSize;
+}
+
+FlvMonotonicResource::~FlvMonotonicResource() {
+    release();
+    if ( chunks ) upstream->deallocate( chunks, chunks->size );
+}
+
+void FlvMonotonicResource::release() {
+    // keep the oldest chunk, the next batch usually fits in it
+    while ( chunks && chunks->previous ) {
+        Chunk *previous = chunks->previous;
+        upstream->deallocate( chunks, chunks->size );
+        chunks = previous;
+    }
+    nextSize = firstSize;
+    current  = chunks ? (uint8_t *)chunks + sizeof( Chunk ) : nullptr;
+    end      = chunks ? (uint8_t *)chunks + chunks->size : nullptr;
+}
+
+void *FlvMonotonicResource::do_allocate( size_t bytes, size_t alignment ) {
+    if ( current ) {
+        uint8_t *p = (uint8_t *)align_up( (uintptr_t)current, alignment );
+        if ( p <= end && (size_t)( end - p ) >= bytes ) {
+            current = p + bytes;
+            return p;
+        }
+    }
+    // a new chunk, large enough for the allocation
+    size_t size = nextSize;
+    size_t need = sizeof( Chunk ) + alignment + bytes;
+    while ( size < need ) size *= 2;
+    Chunk *chunk = (Chunk *)upstream->allocate( size );
+    if ( !chunk ) return nullptr;
+    chunk->previous = chunks;
+    chunk->size     = size;
+    chunks          = chunk;
+    nextSize        = size * 2;
+
+    uint8_t *p = (uint8_t *)align_up( (uintptr_t)chunk + sizeof( Chunk ), alignment );
+    current    = p + bytes;
+    end        = (uint8_t *)chunk + size;
+    return p;
+}
+
+FlvPoolResource::FlvPoolResource( size_t maxBlockSize, FlvMemoryResource *upstream ) {
+    this->upstream     = upstream;
+    this->maxBlockSize = maxBlockSize;
+}
+
+FlvPoolResource::~FlvPoolResource() {
+    release();
+}
+
+void FlvPoolResource::release() {
+    for ( int i = 0; i < MaxClasses; i++ ) {
+        while ( freeLists[i] ) {
+            FreeBlock *block = freeLists[i];
+            freeLists[i]     = block->next;
+            upstream->deallocate( block, MinBlockSize << i );
+        }
+    }
+    cachedBytes = 0;
+}
+
+int FlvPoolResource::size_class( size_t bytes, size_t alignment ) const {
+    if ( bytes > maxBlockSize || alignment > DefaultAlignment ) return -1;
+    int    index = 0;
+    size_t size  = MinBlockSize;
+    while ( size < bytes ) {
+        size <<= 1;
+        index += 1;
+    }
+    return index < MaxClasses ? index : -1;
+}
+
+void *FlvPoolResource::do_allocate( size_t bytes, size_t alignment ) {
+    int index = size_class( bytes, alignment );
+    if ( index < 0 ) return upstream->allocate( bytes, alignment );
+    if ( FreeBlock *block = freeLists[index] ) {
+        freeLists[index] = block->next;
+        cachedBytes -= MinBlockSize << index;
+        return block;
+    }
+    return upstream->allocate( MinBlockSize << index );
+}
+
+void FlvPoolResource::do_deallocate( void *p, size_t bytes, size_t alignment ) {
+    int index = size_class( bytes, alignment );
+    if ( index < 0 ) {
+        upstream->deallocate( p, bytes, alignment );
+        return;
+    }
+    FreeBlock *block = (FreeBlock *)p;
+    block->next      = freeLists[index];
+    freeLists[index] = block;
+    cachedBytes += MinBlockSize << index;
+}
+
+FlvBudgetResource::FlvBudgetResource( size_t limit, FlvMemoryResource *upstream )
+    : usedBytes( 0 ), peakBytes( 0 ), rejectedCount( 0 ) {
+    this->upstream    = upstream;
+    this->budgetLimit = limit;
+}
+
+void *FlvBudgetResource::do_allocate( size_t bytes, size_t alignment ) {
+    size_t used = usedBytes.fetch_add( bytes, std::memory_order_relaxed ) + bytes;
+    void  *p    = used <= budgetLimit ? upstream->allocate( bytes, alignment ) : nullptr;
+    if ( !p ) {
+        usedBytes.fetch_sub( bytes, std::memory_order_relaxed );
+        rejectedCount.fetch_add( 1, std::memory_order_relaxed );
+        return nullptr;
+    }
+    size_t peak = peakBytes.load( std::memory_order_relaxed );
+    while ( used > peak && !peakBytes.compare_exchange_weak( peak, used, std::memory_order_relaxed ) ) {
+    }
+    return p;
+}
+
+void FlvBudgetResource::do_deallocate( void *p, size_t bytes, size_t alignment ) {
+    upstream->deallocate( p, bytes, alignment );
+    usedBytes.fetch_sub( bytes, std::memory_order_relaxed );
+}
+
+}; // namespace nx
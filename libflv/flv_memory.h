@@ -0,0 +1,257 @@
+#ifndef __FLV_MEMORY_H__
+#define __FLV_MEMORY_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ Memory resources of the muxer, modeled on std::pmr::memory_resource which needs C++17.
+ A resource returns null when it cannot allocate, FlvAllocator turns it into std::bad_alloc for std containers.
+ Resources are not owned by their users, they must outlive the muxers and the buffers which use them.
+*/
+
+namespace nx {
+
+class FlvMemoryResource {
+public:
+    static const size_t DefaultAlignment = alignof( std::max_align_t );
+
+    virtual ~FlvMemoryResource() {}
+
+    /**
+     * @return the allocated memory, null on failure
+     */
+    void *allocate( size_t bytes, size_t alignment = DefaultAlignment ) {
+        return do_allocate( bytes, alignment );
+    }
+    /**
+     * @brief release memory of allocate, with the same bytes and alignment.
+     */
+    void deallocate( void *p, size_t bytes, size_t alignment = DefaultAlignment ) {
+        if ( p ) do_deallocate( p, bytes, alignment );
+    }
+    /**
+     * @brief whether memory allocated by one can be released by the other.
+     */
+    bool is_equal( const FlvMemoryResource &other ) const {
+        return this == &other || do_is_equal( other );
+    }
+
+protected:
+    virtual void *do_allocate( size_t bytes, size_t alignment )             = 0;
+    virtual void  do_deallocate( void *p, size_t bytes, size_t alignment ) = 0;
+    virtual bool  do_is_equal( const FlvMemoryResource &other ) const {
+        return false;
+    }
+};
+
+/**
+ * @brief the global heap, malloc and free, the resource used when none is given.
+ */
+FlvMemoryResource *flv_default_resource();
+
+/**
+ * @brief bump allocator over chunks of the upstream resource, deallocate does nothing,
+ * the memory is released at once by release() or the destructor.
+ * For short lived batches, e.g. the buffers of one frame. Not thread safe.
+ */
+class FlvMonotonicResource : public FlvMemoryResource {
+public:
+    /**
+     * @param initialSize  size of the first chunk, the next chunks double in size
+     */
+    explicit FlvMonotonicResource( size_t initialSize = 64 << 10, FlvMemoryResource *upstream = flv_default_resource() );
+    ~FlvMonotonicResource();
+    FlvMonotonicResource( const FlvMonotonicResource & )            = delete;
+    FlvMonotonicResource &operator=( const FlvMonotonicResource & ) = delete;
+
+    /**
+     * @brief release every chunk but the first one and rewind, the allocations are invalidated.
+     */
+    void release();
+
+protected:
+    void *do_allocate( size_t bytes, size_t alignment ) override;
+    void  do_deallocate( void *p, size_t bytes, size_t alignment ) override {}
+
+private:
+    struct Chunk {
+        Chunk *previous;
+        size_t size; // with this header
+    };
+    FlvMemoryResource *upstream;
+    Chunk             *chunks    = nullptr; // newest first
+    uint8_t           *current   = nullptr;
+    uint8_t           *end       = nullptr;
+    size_t             nextSize  = 0;
+    size_t             firstSize = 0;
+};
+
+/**
+ * @brief free lists of power of 2 size classes, allocations larger than maxBlockSize go to the upstream resource.
+ * Released blocks are kept for the next allocations of the class, and given back by release() or the destructor.
+ * Muxing reuses tag and nalu buffers of similar sizes frame after frame, so the upstream is rarely called in steady state.
+ * Not thread safe, use one per muxer.
+ */
+class FlvPoolResource : public FlvMemoryResource {
+public:
+    static const size_t MinBlockSize = 64;
+
+    explicit FlvPoolResource( size_t maxBlockSize = 1 << 20, FlvMemoryResource *upstream = flv_default_resource() );
+    ~FlvPoolResource();
+    FlvPoolResource( const FlvPoolResource & )            = delete;
+    FlvPoolResource &operator=( const FlvPoolResource & ) = delete;
+
+    /**
+     * @brief give the cached blocks back to the upstream resource.
+     */
+    void release();
+    /**
+     * @brief bytes of the released blocks kept in the free lists.
+     */
+    size_t cached_bytes() const {
+        return cachedBytes;
+    }
+
+protected:
+    void *do_allocate( size_t bytes, size_t alignment ) override;
+    void  do_deallocate( void *p, size_t bytes, size_t alignment ) override;
+
+private:
+    static const int MaxClasses = 48;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    // size class of bytes, -1 if it is not pooled
+    int size_class( size_t bytes, size_t alignment ) const;
+
+    FlvMemoryResource *upstream;
+    size_t             maxBlockSize;
+    FreeBlock         *freeLists[MaxClasses] = { nullptr };
+    size_t             cachedBytes           = 0;
+};
+
+/**
+ * @brief account the memory of a stream or a tenant and reject allocations beyond a limit,
+ * so a runaway stream fails its own allocations instead of exhausting the process.
+ * The counters are atomic, a budget can be shared by muxers on different threads
+ * when its upstream is thread safe too.
+ */
+class FlvBudgetResource : public FlvMemoryResource {
+public:
+    /**
+     * @param limit  maximum bytes in use at any time
+     */
+    explicit FlvBudgetResource( size_t limit, FlvMemoryResource *upstream = flv_default_resource() );
+
+    size_t limit() const {
+        return budgetLimit;
+    }
+    // bytes in use
+    size_t used() const {
+        return usedBytes.load( std::memory_order_relaxed );
+    }
+    // largest bytes in use so far
+    size_t peak() const {
+        return peakBytes.load( std::memory_order_relaxed );
+    }
+    // allocations rejected because of the limit or the upstream
+    uint64_t rejected() const {
+        return rejectedCount.load( std::memory_order_relaxed );
+    }
+
+protected:
+    void *do_allocate( size_t bytes, size_t alignment ) override;
+    void  do_deallocate( void *p, size_t bytes, size_t alignment ) override;
+
+private:
+    FlvMemoryResource    *upstream;
+    size_t                budgetLimit;
+    std::atomic<size_t>   usedBytes;
+    std::atomic<size_t>   peakBytes;
+    std::atomic<uint64_t> rejectedCount;
+};
+
+/**
+ * @brief std allocator over a FlvMemoryResource, throws std::bad_alloc when the resource fails.
+ * The resource follows the container on copy, move and swap.
+ */
+template <typename T>
+struct FlvAllocator {
+    using value_type                             = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    FlvMemoryResource *resource;
+
+    FlvAllocator( FlvMemoryResource *resource = flv_default_resource() ) : resource( resource ) {}
+    template <typename U>
+    FlvAllocator( const FlvAllocator<U> &other ) : resource( other.resource ) {}
+
+    T *allocate( size_t n ) {
+        void *p = resource->allocate( n * sizeof( T ), alignof( T ) );
+        if ( !p ) throw std::bad_alloc();
+        return (T *)p;
+    }
+    void deallocate( T *p, size_t n ) {
+        resource->deallocate( p, n * sizeof( T ), alignof( T ) );
+    }
+};
+
+template <typename T, typename U>
+bool operator==( const FlvAllocator<T> &a, const FlvAllocator<U> &b ) {
+    return a.resource->is_equal( *b.resource );
+}
+
+template <typename T, typename U>
+bool operator!=( const FlvAllocator<T> &a, const FlvAllocator<U> &b ) {
+    return !( a == b );
+}
+
+/**
+ * @brief construct an object in memory of the resource, released with flv_delete.
+ *
+ * @return the object, null when the resource fails
+ */
+template <typename T, typename... Args>
+T *flv_new( FlvMemoryResource *resource, Args &&...args ) {
+    void *p = resource->allocate( sizeof( T ), alignof( T ) );
+    if ( !p ) return nullptr;
+    try {
+        return new ( p ) T( std::forward<Args>( args )... );
+    }
+    catch ( ... ) {
+        resource->deallocate( p, sizeof( T ), alignof( T ) );
+        throw;
+    }
+}
+
+template <typename T>
+void flv_delete( FlvMemoryResource *resource, T *p ) {
+    if ( !p ) return;
+    p->~T();
+    resource->deallocate( p, sizeof( T ), alignof( T ) );
+}
+
+/**
+ * @brief deleter of a std::unique_ptr of flv_new.
+ */
+template <typename T>
+struct FlvDeleter {
+    FlvMemoryResource *resource;
+
+    FlvDeleter( FlvMemoryResource *resource = flv_default_resource() ) : resource( resource ) {}
+    void operator()( T *p ) const {
+        flv_delete( resource, p );
+    }
+};
+
+};     // namespace nx
+
+#endif // __FLV_MEMORY_H__
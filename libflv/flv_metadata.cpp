@@ -0,0 +1,90 @@
+#include "flv_metadata.h"
+
+#include "aac.h"
+#include "avc.h"
+
+namespace nx {
+
+void FlvMetaDataCollector::Track::add( const FlvTagInfo &tag ) {
+    if ( !tags || tag.timestamp < firstTimestamp ) firstTimestamp = tag.timestamp;
+    if ( !tags || tag.timestamp > lastTimestamp ) lastTimestamp = tag.timestamp;
+    bytes += tag.size();
+    tags += 1;
+}
+
+uint32_t FlvMetaDataCollector::Track::duration() const {
+    return lastTimestamp - firstTimestamp;
+}
+
+FlvMetaDataCollector::FlvMetaDataCollector( bool keyframeIndex, uint32_t timestampBase ) {
+    this->keyframeIndex = keyframeIndex;
+    this->timestampBase = timestampBase;
+}
+
+void FlvMetaDataCollector::add_tag( const FlvTagInfo &tag, const uint8_t *data ) {
+    if ( tag.type == 8 ) {
+        if ( tag.packetType == 0 ) {
+            AudioSpecificConfig config;
+            if ( data && tag.dataSize > 2 && config.parse( data + 2, tag.dataSize - 2 ) == 0 ) {
+                sampleRate = config.sampleRate();
+                stereo     = config.channelConfiguration == 2;
+            }
+            return;
+        }
+        audio.add( tag );
+        audioTags += 1;
+    }
+    else if ( tag.type == 9 ) {
+        if ( tag.packetType == 0 ) {
+            H264SPS sps;
+            if ( data && tag.dataSize > 5 && avc_decode_avcc_sps( &sps, data + 5, tag.dataSize - 5 ) == 0 ) {
+                sps.get_resolution( width, height );
+            }
+            return;
+        }
+        if ( tag.packetType == 2 ) return; // end of sequence
+        video.add( tag );
+        videoTags += 1;
+        if ( tag.isKeyFrame ) {
+            keyFrames += 1;
+            if ( keyframeIndex ) {
+                uint32_t timestamp = tag.timestamp > timestampBase ? tag.timestamp - timestampBase : 0;
+                keyframeTimes.push_back( timestamp / 1000.0 );
+                keyframePositions.push_back( tag.offset );
+            }
+        }
+    }
+}
+
+double FlvMetaDataCollector::duration() const {
+    if ( !audio.tags && !video.tags ) return 0;
+    uint32_t first = audio.tags ? audio.firstTimestamp : video.firstTimestamp;
+    uint32_t last  = audio.tags ? audio.lastTimestamp : video.lastTimestamp;
+    if ( video.tags && video.firstTimestamp < first ) first = video.firstTimestamp;
+    if ( video.tags && video.lastTimestamp > last ) last = video.lastTimestamp;
+    return ( last - first ) / 1000.0;
+}
+
+void FlvMetaDataCollector::fill( FlvMetaData &metaData, int64_t positionDelta ) const {
+    metaData.duration        = duration();
+    metaData.width           = width;
+    metaData.height          = height;
+    metaData.audiosamplerate = sampleRate;
+    metaData.stereo          = stereo;
+    metaData.audiodatarate   = 0;
+    metaData.videodatarate   = 0;
+    metaData.framerate       = 0;
+    // bits per millisecond, kilobits per second
+    if ( audio.duration() ) metaData.audiodatarate = audio.bytes * 8.0 / audio.duration();
+    if ( video.duration() ) {
+        metaData.videodatarate = video.bytes * 8.0 / video.duration();
+        metaData.framerate     = ( video.tags - 1 ) * 1000.0 / video.duration();
+    }
+    metaData.keyframeTimes = keyframeTimes;
+    metaData.keyframeFilePositions.clear();
+    for ( uint64_t position : keyframePositions ) {
+        metaData.keyframeFilePositions.push_back( (double)( (int64_t)position + positionDelta ) );
+    }
+}
+
+}; // namespace nx
@@ -0,0 +1,68 @@
+#ifndef __FLV_METADATA_H__
+#define __FLV_METADATA_H__
+
+#include "flv_reader.h"
+#include "flvmuxer.h"
+
+namespace nx {
+
+/**
+ * @brief recompute onMetaData from the tags of a file, for the tools which rewrite flv files.
+ * Duration, data rates and frame rate are computed like FlvMuxer::endMuxing,
+ * width and height, sample rate and channels come from the last sequence headers.
+ */
+class FlvMetaDataCollector {
+public:
+    /**
+     * @param keyframeIndex  collect key frames for the keyframes object
+     * @param timestampBase  subtracted from the key frame times, for files whose timestamps are rebased
+     */
+    explicit FlvMetaDataCollector( bool keyframeIndex = false, uint32_t timestampBase = 0 );
+
+    /**
+     * @brief add a tag in file order.
+     *
+     * @param data  tag data, only needed for sequence headers, can be null for the other tags
+     */
+    void add_tag( const FlvTagInfo &tag, const uint8_t *data );
+    /**
+     * @brief fill the recomputed fields, hasAudio, hasVideo and filesize are not changed.
+     *
+     * @param positionDelta  added to the key frame file positions, when the tags move in the new file
+     */
+    void fill( FlvMetaData &metaData, int64_t positionDelta ) const;
+    /**
+     * @brief seconds between the first and the last audio or video frame.
+     */
+    double duration() const;
+
+    uint64_t audioTags = 0;
+    uint64_t videoTags = 0;
+    uint64_t keyFrames = 0;
+    uint32_t width     = 0;
+    uint32_t height    = 0;
+
+private:
+    struct Track {
+        uint64_t tags           = 0;
+        uint64_t bytes          = 0;
+        uint32_t firstTimestamp = 0;
+        uint32_t lastTimestamp  = 0;
+
+        void     add( const FlvTagInfo &tag );
+        uint32_t duration() const;
+    };
+
+    bool                  keyframeIndex;
+    uint32_t              timestampBase;
+    Track                 audio;
+    Track                 video;
+    uint32_t              sampleRate = 0;
+    bool                  stereo     = false;
+    std::vector<double>   keyframeTimes;
+    std::vector<uint64_t> keyframePositions;
+};
+
+};     // namespace nx
+
+#endif // __FLV_METADATA_H__
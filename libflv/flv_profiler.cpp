@@ -0,0 +1,140 @@
+#include "flv_profiler.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+namespace nx {
+
+static const char *stage_name( int stage ) {
+    switch ( stage ) {
+    case FlvProfileStage::SplitNalus:
+        return "split_nalus";
+    case FlvProfileStage::ParseSps:
+        return "parse_sps";
+    case FlvProfileStage::AssembleTag:
+        return "assemble_tag";
+    case FlvProfileStage::Handler:
+        return "handler";
+    case FlvProfileStage::EndToEnd:
+        return "end_to_end";
+    default:
+        return "unknown";
+    }
+}
+
+void FlvHistogram::record( uint64_t value ) {
+    int bucket = 0;
+    if ( value < SubBuckets ) {
+        bucket = (int)value;
+    }
+    else {
+        int exponent = 63 - __builtin_clzll( value );
+        bucket       = ( exponent - SubBucketBits + 1 ) * SubBuckets + (int)( ( value >> ( exponent - SubBucketBits ) ) & ( SubBuckets - 1 ) );
+    }
+    buckets[bucket]++;
+    count += 1;
+    sum += value;
+    if ( value < min ) min = value;
+    if ( value > max ) max = value;
+}
+
+uint64_t FlvHistogram::percentile( double percent ) const {
+    if ( !count ) return 0;
+    uint64_t target = (uint64_t)( count * percent / 100.0 + 0.5 );
+    if ( target < 1 ) target = 1;
+    uint64_t seen = 0;
+    for ( int i = 0; i < BucketCount; i++ ) {
+        seen += buckets[i];
+        if ( seen < target ) continue;
+        if ( i < SubBuckets ) return i;
+        // upper bound of the bucket
+        int      exponent = i / SubBuckets + SubBucketBits - 1;
+        int      shift    = exponent - SubBucketBits;
+        uint64_t lower    = (uint64_t)( SubBuckets + i % SubBuckets ) << shift;
+        uint64_t upper    = lower + ( ( (uint64_t)1 << shift ) - 1 );
+        return upper < max ? upper : max;
+    }
+    return max;
+}
+
+FlvProfiler::FlvProfiler() {
+    origin = now();
+    // allocated once, the ring does not allocate on the instrumented path
+    trace.reserve( TraceCapacity );
+}
+
+uint64_t FlvProfiler::now() {
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>( time ).count();
+}
+
+void FlvProfiler::record( FlvProfileStage stage, uint64_t begin, uint64_t end ) {
+    uint64_t duration = end > begin ? end - begin : 0;
+    stages[stage].record( duration );
+    // trace ring
+    {
+        TraceEvent event = { (uint8_t)stage, begin - origin, duration };
+        if ( trace.size() < TraceCapacity ) {
+            trace.push_back( event );
+        }
+        else {
+            trace[traceNext] = event;
+        }
+        traceNext = ( traceNext + 1 ) % TraceCapacity;
+    }
+    if ( stage == FlvProfileStage::EndToEnd ) {
+        // close the frame
+        frameAllocs.record( currentAllocs );
+        frameCopiedBytes.record( currentCopied );
+        currentAllocs = 0;
+        currentCopied = 0;
+    }
+}
+
+void FlvProfiler::count_alloc( size_t bytes ) {
+    currentAllocs += 1;
+    totalAllocs += 1;
+    totalAllocBytes += bytes;
+}
+
+void FlvProfiler::count_copy( size_t bytes ) {
+    currentCopied += bytes;
+    totalCopiedBytes += bytes;
+}
+
+void FlvProfiler::dump_text( std::string &out ) const {
+    char line[256];
+    snprintf( line, sizeof( line ), "%-14s %10s %10s %10s %10s %10s %10s\n", "stage(ns)", "count", "mean", "p50", "p99", "p99.9", "max" );
+    out += line;
+    for ( int i = 0; i < StageCount; i++ ) {
+        const FlvHistogram &h = stages[i];
+        if ( !h.count ) continue;
+        snprintf( line, sizeof( line ), "%-14s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+                  stage_name( i ), h.count, h.sum / h.count, h.percentile( 50 ), h.percentile( 99 ), h.percentile( 99.9 ), h.max );
+        out += line;
+    }
+    snprintf( line, sizeof( line ), "frames %" PRIu64 ", allocations %" PRIu64 " (%" PRIu64 " bytes), copied %" PRIu64 " bytes\n",
+              frameAllocs.count, totalAllocs, totalAllocBytes, totalCopiedBytes );
+    out += line;
+    if ( frameAllocs.count ) {
+        snprintf( line, sizeof( line ), "per frame: allocations p50 %" PRIu64 " max %" PRIu64 ", copied bytes p50 %" PRIu64 " max %" PRIu64 "\n",
+                  frameAllocs.percentile( 50 ), frameAllocs.max, frameCopiedBytes.percentile( 50 ), frameCopiedBytes.max );
+        out += line;
+    }
+}
+
+void FlvProfiler::dump_chrome_trace( std::string &out ) const {
+    char event[160];
+    out += "{\"traceEvents\":[";
+    // oldest event first
+    size_t start = trace.size() < TraceCapacity ? 0 : traceNext;
+    for ( size_t i = 0; i < trace.size(); i++ ) {
+        const TraceEvent &e = trace[( start + i ) % trace.size()];
+        snprintf( event, sizeof( event ), "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                  i ? "," : "", stage_name( e.stage ), e.begin / 1000.0, e.duration / 1000.0 );
+        out += event;
+    }
+    out += "],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+}; // namespace nx
@@ -0,0 +1,128 @@
+#ifndef __FLV_PROFILER_H__
+#define __FLV_PROFILER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ Opt-in instrumentation of the muxing hot path.
+ Build with FLV_ENABLE_PROFILING=1 to enable it, the macros expand to nothing otherwise.
+ The flag changes the layout of FlvMuxer, so the library and its users must be built with the same value.
+*/
+#ifndef FLV_ENABLE_PROFILING
+#define FLV_ENABLE_PROFILING 0
+#endif
+
+namespace nx {
+
+enum FlvProfileStage {
+    SplitNalus = 0, // split annex-b frame to nalus
+    ParseSps,       // decode sps and build AVCDecoderConfigurationRecord
+    AssembleTag,    // build flv tag buffer
+    Handler,        // data handler callback
+    EndToEnd,       // from mux_* call to the completion of the last handler callback
+    StageCount
+};
+
+/**
+ * @brief HDR style histogram, log-linear buckets with 16 sub buckets for each power of 2,
+ * so a recorded value is kept with 6.25% precision over the whole uint64_t range.
+ */
+class FlvHistogram {
+public:
+    void     record( uint64_t value );
+    uint64_t percentile( double percent ) const;
+
+    uint64_t count = 0;
+    uint64_t sum   = 0;
+    uint64_t min   = UINT64_MAX;
+    uint64_t max   = 0;
+
+private:
+    static const int SubBucketBits = 4;
+    static const int SubBuckets    = 1 << SubBucketBits;
+    static const int BucketCount   = ( 64 - SubBucketBits + 1 ) * SubBuckets;
+    uint64_t         buckets[BucketCount] = { 0 };
+};
+
+class FlvProfiler {
+public:
+    // number of trace events kept for the chrome trace, the oldest are overwritten, reserved at construction
+    static const size_t TraceCapacity = 1 << 16;
+
+    FlvProfiler();
+    /**
+     * @brief monotonic clock in nanoseconds
+     */
+    static uint64_t now();
+
+    /**
+     * @brief record the duration of a stage, recording EndToEnd closes the counters of the current frame.
+     */
+    void record( FlvProfileStage stage, uint64_t begin, uint64_t end );
+    void count_alloc( size_t bytes );
+    void count_copy( size_t bytes );
+    /**
+     * @brief human readable summary, one line per stage, with percentiles in nanoseconds.
+     */
+    void dump_text( std::string &out ) const;
+    /**
+     * @brief Chrome trace event format, can be loaded in chrome://tracing or Perfetto.
+     */
+    void dump_chrome_trace( std::string &out ) const;
+
+private:
+    struct TraceEvent {
+        uint8_t  stage;
+        uint64_t begin; // ns
+        uint64_t duration;
+    };
+    FlvHistogram stages[StageCount];
+    FlvHistogram frameAllocs;
+    FlvHistogram frameCopiedBytes;
+
+    uint64_t totalAllocs      = 0;
+    uint64_t totalAllocBytes  = 0;
+    uint64_t totalCopiedBytes = 0;
+    uint64_t currentAllocs    = 0;
+    uint64_t currentCopied    = 0;
+
+    std::vector<TraceEvent> trace;
+    size_t                  traceNext = 0;
+    uint64_t                origin    = 0;
+};
+
+/**
+ * @brief record the duration of the enclosing scope.
+ */
+class FlvProfileScope {
+public:
+    FlvProfileScope( FlvProfiler &profiler, FlvProfileStage stage )
+        : profiler( profiler ), stage( stage ), begin( FlvProfiler::now() ) {}
+    ~FlvProfileScope() {
+        profiler.record( stage, begin, FlvProfiler::now() );
+    }
+
+private:
+    FlvProfiler    &profiler;
+    FlvProfileStage stage;
+    uint64_t        begin;
+};
+
+}; // namespace nx
+
+#if FLV_ENABLE_PROFILING
+#define FLV_PROFILE_CONCAT_( a, b )          a##b
+#define FLV_PROFILE_CONCAT( a, b )           FLV_PROFILE_CONCAT_( a, b )
+#define FLV_PROFILE_SCOPE( profiler, stage ) nx::FlvProfileScope FLV_PROFILE_CONCAT( flvProfileScope, __LINE__ )( profiler, nx::FlvProfileStage::stage )
+#define FLV_PROFILE_ALLOC( profiler, bytes ) ( profiler ).count_alloc( bytes )
+#define FLV_PROFILE_COPY( profiler, bytes )  ( profiler ).count_copy( bytes )
+#else
+#define FLV_PROFILE_SCOPE( profiler, stage )
+#define FLV_PROFILE_ALLOC( profiler, bytes )
+#define FLV_PROFILE_COPY( profiler, bytes )
+#endif
+
+#endif // __FLV_PROFILER_H__
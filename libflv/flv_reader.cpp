@@ -0,0 +1,173 @@
+#include "flv_reader.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "flv_io.h"
+
+namespace nx {
+
+static uint32_t read_u24( const uint8_t *p ) {
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static uint32_t read_u32( const uint8_t *p ) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+int flv_parse_header( const uint8_t *buf, size_t size, bool *hasAudio, bool *hasVideo ) {
+    if ( size < 9 ) return -1;
+    if ( buf[0] != 'F' || buf[1] != 'L' || buf[2] != 'V' ) return -1;
+    if ( read_u32( buf + 5 ) < 9 ) return -1;
+    if ( hasAudio ) *hasAudio = ( buf[4] >> 2 ) & 1;
+    if ( hasVideo ) *hasVideo = buf[4] & 1;
+    return 0;
+}
+
+int flv_parse_tag_header( const uint8_t *buf, size_t bufSize, FlvTagInfo &tag ) {
+    if ( bufSize < FlvTagHeaderSize ) return -1;
+    // reserved 2 bits and filter must be 0
+    if ( buf[0] & 0xE0 ) return -1;
+    uint8_t type = buf[0] & 0x1F;
+    if ( type != 8 && type != 9 && type != 18 ) return -1;
+    // stream id is always 0
+    if ( buf[8] || buf[9] || buf[10] ) return -1;
+
+    tag.type       = type;
+    tag.dataSize   = read_u24( buf + 1 );
+    tag.timestamp  = read_u24( buf + 4 ) | (uint32_t)buf[7] << 24;
+    tag.codec      = 0;
+    tag.packetType = 0xFF;
+    tag.isKeyFrame = false;
+    if ( type != 18 && tag.dataSize >= 1 && bufSize > FlvTagHeaderSize ) {
+        uint8_t flags = buf[FlvTagHeaderSize];
+        if ( type == 8 ) {
+            tag.codec = flags >> 4;
+        }
+        else {
+            tag.codec      = flags & 0x0F;
+            tag.isKeyFrame = ( flags >> 4 ) == 1;
+        }
+        if ( tag.dataSize >= 2 && bufSize > FlvTagHeaderSize + 1 ) {
+            tag.packetType = buf[FlvTagHeaderSize + 1];
+        }
+    }
+    return 0;
+}
+
+void flv_set_tag_timestamp( uint8_t *buf, uint32_t timestamp ) {
+    buf[4] = timestamp >> 16 & 0xFF;
+    buf[5] = timestamp >> 8 & 0xFF;
+    buf[6] = timestamp & 0xFF;
+    buf[7] = timestamp >> 24 & 0xFF;
+}
+
+int flv_copy_tags( int in, uint64_t offset, uint64_t size, int out, int64_t shift ) {
+    if ( !shift ) return flv_copy_file_range( in, offset, out, size );
+    // smaller tags are copied with the headers, a system call costs more than their copy
+    const size_t         SmallTagSize = 16 << 10;
+    const size_t         FlushSize    = 256 << 10;
+    FlvFileReader        reader( in, offset, offset + size, FlushSize );
+    FlvTagInfo           tag;
+    const uint8_t       *data = nullptr;
+    std::vector<uint8_t> pending;
+    int                  ret = 0;
+    while ( ( ret = reader.next( tag, &data ) ) > 0 ) {
+        size_t  at        = pending.size();
+        bool    small     = data && tag.size() <= SmallTagSize;
+        int64_t timestamp = (int64_t)tag.timestamp + shift;
+        pending.resize( at + ( small ? (size_t)tag.size() : FlvTagHeaderSize ) );
+        if ( small ) {
+            memcpy( &pending[at], data - FlvTagHeaderSize, (size_t)tag.size() );
+        }
+        else if ( reader.read_at( tag.offset, &pending[at], FlvTagHeaderSize ) < 0 ) {
+            return -1;
+        }
+        flv_set_tag_timestamp( &pending[at], timestamp > 0 ? (uint32_t)timestamp : 0 );
+        if ( small && pending.size() < FlushSize ) continue;
+        if ( flv_write_all( out, &pending[0], pending.size() ) < 0 ) return -1;
+        pending.clear();
+        // tag data and tag size
+        if ( !small && flv_copy_file_range( in, tag.offset + FlvTagHeaderSize, out, tag.size() - FlvTagHeaderSize ) < 0 ) return -1;
+    }
+    if ( ret < 0 ) return -1;
+    if ( !pending.empty() && flv_write_all( out, &pending[0], pending.size() ) < 0 ) return -1;
+    return 0;
+}
+
+FlvFileReader::FlvFileReader( int fd, uint64_t begin, uint64_t end, size_t bufferSize ) {
+    this->fd     = fd;
+    this->offset = begin;
+    this->end    = end;
+    // at least one tag header and tag size besides a large tag data
+    buffer.resize( bufferSize < 4096 ? 4096 : bufferSize );
+}
+
+int FlvFileReader::fill( uint64_t offset, size_t size ) {
+    if ( offset >= bufferOffset && offset + size <= bufferOffset + bufferSize ) return 0;
+    // read a whole buffer starting at offset
+    bufferOffset = offset;
+    bufferSize   = 0;
+    size_t want  = buffer.size();
+    if ( offset + want > end ) want = (size_t)( end - offset );
+    while ( bufferSize < want ) {
+        ssize_t n = pread( fd, &buffer[bufferSize], want - bufferSize, offset + bufferSize );
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            return -1;
+        }
+        if ( n == 0 ) break;
+        bufferSize += n;
+    }
+    return bufferSize >= size ? 0 : -1;
+}
+
+int FlvFileReader::read_at( uint64_t offset, uint8_t *dst, size_t size ) {
+    if ( offset + size > end ) return -1;
+    if ( size <= buffer.size() ) {
+        if ( fill( offset, size ) < 0 ) return -1;
+        memcpy( dst, &buffer[offset - bufferOffset], size );
+        return 0;
+    }
+    size_t done = 0;
+    while ( done < size ) {
+        ssize_t n = pread( fd, dst + done, size - done, offset + done );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n <= 0 ) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int FlvFileReader::next( FlvTagInfo &tag, const uint8_t **data ) {
+    if ( data ) *data = nullptr;
+    if ( offset >= end ) return 0;
+    // tag header and the first 2 bytes of tag data
+    const size_t headerBytes = FlvTagHeaderSize + 2;
+    if ( offset + FlvTagHeaderSize + 4 > end ) return -1; // torn tag header
+    size_t available = (size_t)( end - offset < headerBytes ? end - offset : headerBytes );
+    if ( fill( offset, available ) < 0 ) return -1;
+    if ( flv_parse_tag_header( &buffer[offset - bufferOffset], available, tag ) < 0 ) return -1;
+    tag.offset = offset;
+
+    uint64_t tagEnd = offset + tag.size();
+    if ( tagEnd > end ) return -1; // torn tag data
+    uint8_t  sizeBuf[4];
+    uint32_t previousTagSize = 0;
+    if ( tag.size() <= buffer.size() ) {
+        // whole tag in the buffer
+        if ( fill( offset, (size_t)tag.size() ) < 0 ) return -1;
+        const uint8_t *p = &buffer[offset - bufferOffset];
+        previousTagSize  = read_u32( p + tag.size() - 4 );
+        if ( data ) *data = p + FlvTagHeaderSize;
+    }
+    else {
+        if ( read_at( tagEnd - 4, sizeBuf, 4 ) < 0 ) return -1;
+        previousTagSize = read_u32( sizeBuf );
+    }
+    if ( previousTagSize != FlvTagHeaderSize + tag.dataSize ) return -1;
+    offset = tagEnd;
+    return 1;
+}
+
+}; // namespace nx
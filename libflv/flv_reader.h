@@ -0,0 +1,130 @@
+#ifndef __FLV_READER_H__
+#define __FLV_READER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nx {
+
+// 9 bytes flv header + 4 bytes PreviousTagSize0
+static const int FlvFileHeaderSize = 13;
+static const int FlvTagHeaderSize  = 11;
+
+/**
+ * @brief a tag found in a flv file, parsed from the tag header and the first bytes of the tag data.
+ */
+struct FlvTagInfo {
+    uint64_t offset    = 0; // offset of the tag header in the file
+    uint8_t  type      = 0; // 8 - audio, 9 - video, 18 - script data
+    uint32_t dataSize  = 0; // tag data size, without tag header and tag size
+    uint32_t timestamp = 0; // timestamp with the extended byte
+    /*
+    audio: SoundFormat, video: CodecID
+    */
+    uint8_t codec = 0;
+    /*
+    audio: AACPacketType, video: AVCPacketType, 0xFF if not present
+    */
+    uint8_t packetType = 0xFF;
+    // video FrameType is key frame
+    bool isKeyFrame = false;
+
+    // the whole tag, header + data + tag size
+    uint64_t size() const {
+        return FlvTagHeaderSize + (uint64_t)dataSize + 4;
+    }
+};
+
+/**
+ * @brief parse the 9 bytes flv header.
+ *
+ * @return 0: success, <0: not a flv header.
+ */
+int flv_parse_header( const uint8_t *buf, size_t size, bool *hasAudio, bool *hasVideo );
+
+/**
+ * @brief parse and sanity check a tag header, reserved bits, tag type and stream id.
+ *
+ * @param buf  11 bytes tag header, followed by up to 2 bytes of tag data in bufSize
+ * @param bufSize  bytes available at buf, at least 11
+ * @param tag  filled with the parsed fields, offset is not touched
+ * @return 0: success, <0: not a valid tag header.
+ */
+int flv_parse_tag_header( const uint8_t *buf, size_t bufSize, FlvTagInfo &tag );
+
+/**
+ * @brief write a new timestamp in a tag header.
+ */
+void flv_set_tag_timestamp( uint8_t *buf, uint32_t timestamp );
+
+/**
+ * @brief copy whole tags of a file to the current position of out, adding shift to their timestamps, clamped to 0.
+ * Without shift the range is one flv_copy_file_range. Otherwise the rebased tag headers are written from user space,
+ * small tags with them, and the rest of each large tag is copied with flv_copy_file_range, so the output is written once
+ * and its pages are never read back. It costs 2 system calls per large tag, and the copied ranges are not block aligned,
+ * so a filesystem with reflinks copies them instead of sharing the extents.
+ *
+ * @param in  file of the tags, opened for reading
+ * @param offset  offset of the first tag header in in
+ * @param size  bytes of whole, valid tags
+ * @return 0: success, <0: io error, or an invalid tag in the range.
+ */
+int flv_copy_tags( int in, uint64_t offset, uint64_t size, int out, int64_t shift );
+
+/**
+ * @brief sequential tag reader over a file descriptor, reads in large chunks with pread.
+ * Each tag is checked against its PreviousTagSize, the reader stops at the first invalid tag.
+ */
+class FlvFileReader {
+public:
+    static const size_t DefaultBufferSize = 8 << 20;
+
+    /**
+     * @param fd  file descriptor opened for reading
+     * @param begin  offset of the first tag header
+     * @param end  file size, or end of the range to read
+     */
+    FlvFileReader( int fd, uint64_t begin, uint64_t end, size_t bufferSize = DefaultBufferSize );
+
+    /**
+     * @brief read the next tag.
+     *
+     * @param tag  filled with the tag info
+     * @param data  points to the tag data when the whole tag is in the buffer, nullptr otherwise.
+     *              Valid until the next call.
+     * @return 1: got a tag, 0: end reached, <0: invalid or torn tag at position(), or read error.
+     */
+    int next( FlvTagInfo &tag, const uint8_t **data );
+    /**
+     * @brief offset of the next tag, or of the invalid tag after next returned <0.
+     */
+    uint64_t position() const {
+        return offset;
+    }
+    /**
+     * @brief continue reading at offset, e.g. after resynchronizing on a tag boundary.
+     */
+    void seek( uint64_t offset ) {
+        this->offset = offset;
+    }
+    /**
+     * @brief read size bytes at offset, through the buffer when possible.
+     */
+    int read_at( uint64_t offset, uint8_t *dst, size_t size );
+
+private:
+    // make [offset, offset + size) available in the buffer, size <= capacity
+    int fill( uint64_t offset, size_t size );
+
+    int                  fd;
+    uint64_t             offset;
+    uint64_t             end;
+    std::vector<uint8_t> buffer;
+    uint64_t             bufferOffset = 0; // file offset of buffer[0]
+    size_t               bufferSize   = 0; // valid bytes in buffer
+};
+
+};     // namespace nx
+
+#endif // __FLV_READER_H__
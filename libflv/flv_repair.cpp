@@ -0,0 +1,115 @@
+#include "flv_repair.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flv_io.h"
+#include "flv_metadata.h"
+
+namespace nx {
+
+int flv_repair_file( const char *path, const FlvRepairOptions &options, FlvRepairReport *report ) {
+    FlvRepairReport result;
+    int             fd = open( path, options.dryRun ? O_RDONLY : O_RDWR );
+    if ( fd < 0 ) return -1;
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+    result.originalSize = st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    FlvMetaData   metaData;
+    FlvFileReader reader( fd, FlvFileHeaderSize, st.st_size, options.bufferSize );
+    uint8_t       header[FlvFileHeaderSize];
+    if ( reader.read_at( 0, header, FlvFileHeaderSize ) < 0 || flv_parse_header( header, FlvFileHeaderSize, &metaData.hasAudio, &metaData.hasVideo ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+
+    // scan tags
+    uint64_t             oldMetadataSize = 0;
+    FlvMetaDataCollector collector( options.keyframeIndex );
+    FlvTagInfo           tag;
+    const uint8_t       *data = nullptr;
+    int                  ret  = 0;
+    while ( ( ret = reader.next( tag, &data ) ) > 0 ) {
+        if ( tag.type == 18 ) {
+            if ( tag.offset == FlvFileHeaderSize ) oldMetadataSize = tag.size();
+            continue;
+        }
+        // sequence headers are small, read them when they are not in the buffer
+        std::vector<uint8_t> body;
+        if ( tag.packetType == 0 && !data ) {
+            body.resize( tag.dataSize );
+            if ( reader.read_at( tag.offset + FlvTagHeaderSize, &body[0], tag.dataSize ) < 0 ) break;
+            data = &body[0];
+        }
+        collector.add_tag( tag, data );
+    }
+    uint64_t validEnd = reader.position();
+    result.truncated  = validEnd < (uint64_t)st.st_size;
+    if ( ret < 0 && !result.truncated ) {
+        // read error, not a torn tail
+        close( fd );
+        return -1;
+    }
+
+    // recompute metadata, the size of onMetaData does not depend on the values, build it once to know how much the tags move
+    collector.fill( metaData, 0 );
+    int64_t delta = (int64_t)metadata_to_buf( metaData ).size() - (int64_t)oldMetadataSize;
+    collector.fill( metaData, delta );
+    result.audioTags = collector.audioTags;
+    result.videoTags = collector.videoTags;
+    result.keyFrames = collector.keyFrames;
+    result.duration  = collector.duration();
+    result.width     = collector.width;
+    result.height    = collector.height;
+
+    metaData.filesize   = (double)( validEnd + delta );
+    result.repairedSize = validEnd + delta;
+    auto metadata       = metadata_to_buf( metaData );
+
+    if ( options.dryRun ) {
+        close( fd );
+        if ( report ) *report = result;
+        return 0;
+    }
+
+    if ( delta == 0 ) {
+        // in place
+        if ( pwrite( fd, &metadata[0], metadata.size(), FlvFileHeaderSize ) != (ssize_t)metadata.size() || ( result.truncated && ftruncate( fd, validEnd ) < 0 ) || fdatasync( fd ) < 0 ) {
+            close( fd );
+            return -1;
+        }
+        result.metadataInPlace = true;
+    }
+    else {
+        // rewrite to a temporary file next to the original, then replace it
+        std::string tmpPath = std::string( path ) + ".repair";
+        int         out     = open( tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777 );
+        if ( out < 0 ) {
+            close( fd );
+            return -1;
+        }
+        uint64_t tagsBegin = FlvFileHeaderSize + oldMetadataSize;
+        if ( flv_write_all( out, header, FlvFileHeaderSize ) < 0 || flv_write_all( out, &metadata[0], metadata.size() ) < 0 || flv_copy_file_range( fd, tagsBegin, out, validEnd - tagsBegin ) < 0 || fdatasync( out ) < 0 || rename( tmpPath.c_str(), path ) < 0 ) {
+            close( out );
+            unlink( tmpPath.c_str() );
+            close( fd );
+            return -1;
+        }
+        close( out );
+        result.fileRewritten = true;
+    }
+    close( fd );
+    if ( report ) *report = result;
+    return 0;
+}
+
+}; // namespace nx
@@ -0,0 +1,50 @@
+#ifndef __FLV_REPAIR_H__
+#define __FLV_REPAIR_H__
+
+#include "flv_reader.h"
+
+namespace nx {
+
+struct FlvRepairOptions {
+    // write a keyframes index in onMetaData, the file is rewritten if the new onMetaData does not fit
+    bool keyframeIndex = false;
+    // only scan and report, the file is not modified
+    bool dryRun = false;
+    // read size of the scan
+    size_t bufferSize = FlvFileReader::DefaultBufferSize;
+};
+
+struct FlvRepairReport {
+    uint64_t originalSize = 0;
+    uint64_t repairedSize = 0;
+    uint64_t audioTags    = 0;
+    uint64_t videoTags    = 0;
+    uint64_t keyFrames    = 0;
+    // seconds
+    double   duration = 0;
+    uint32_t width    = 0;
+    uint32_t height   = 0;
+    // a torn or invalid tail was cut at the last valid tag
+    bool truncated = false;
+    // onMetaData was rewritten in place
+    bool metadataInPlace = false;
+    // the file was rewritten, the new onMetaData did not fit in the old one
+    bool fileRewritten = false;
+};
+
+/**
+ * @brief repair a flv file left by a recorder which did not finish, e.g. FlvMuxer::endMuxing never ran.
+ * The file is truncated after the last tag whose PreviousTagSize matches, and onMetaData is recomputed,
+ * duration, filesize, data rates, width and height from the last avc sequence header,
+ * sample rate and channels from the last aac sequence header, and optionally a keyframes index.
+ *
+ * @param path  flv file path
+ * @param options  repair options
+ * @param report  filled with what was found and done, can be null
+ * @return 0: success, <0: not a flv file or io error.
+ */
+int flv_repair_file( const char *path, const FlvRepairOptions &options, FlvRepairReport *report );
+
+};     // namespace nx
+
+#endif // __FLV_REPAIR_H__
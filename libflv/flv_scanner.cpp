@@ -0,0 +1,270 @@
+#include "flv_scanner.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "flv_io.h"
+
+namespace nx {
+
+namespace {
+
+// a byte range of the file scanned by one worker
+struct RangeScan {
+    uint64_t begin = 0;
+    uint64_t end   = 0;
+    // first tag of the range
+    uint64_t start = 0;
+    // first tag after the range, or end when the range ends in corrupted data
+    uint64_t stop      = 0;
+    bool     stopAtTag = false;
+    int      error     = 0;
+
+    FlvScanResult result;
+};
+
+} // namespace
+
+static uint32_t read_u32( const uint8_t *p ) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * @brief read a tag header at offset and check the PreviousTagSize after it.
+ */
+static bool check_tag( int fd, uint64_t offset, uint64_t fileSize, FlvTagInfo &tag ) {
+    uint8_t header[FlvTagHeaderSize];
+    uint8_t sizeBuf[4];
+    if ( offset + FlvTagHeaderSize + 4 > fileSize ) return false;
+    if ( flv_pread_all( fd, header, FlvTagHeaderSize, offset ) < 0 || flv_parse_tag_header( header, FlvTagHeaderSize, tag ) < 0 ) return false;
+    if ( offset + tag.size() > fileSize || flv_pread_all( fd, sizeBuf, 4, offset + tag.size() - 4 ) < 0 ) return false;
+    return read_u32( sizeBuf ) == FlvTagHeaderSize + tag.dataSize;
+}
+
+/**
+ * @brief a tag starts at offset if its header is valid, its PreviousTagSize matches,
+ * and either the PreviousTagSize before it points to a valid tag, or it is followed by a valid tag or the end of file.
+ * The check in both directions finds the first tag after corrupted data as well as the last tag before a torn tail.
+ */
+static bool is_tag_start( int fd, uint64_t offset, uint64_t fileSize ) {
+    FlvTagInfo tag;
+    if ( !check_tag( fd, offset, fileSize, tag ) ) return false;
+    // following tag
+    uint64_t   next = offset + tag.size();
+    FlvTagInfo nextTag;
+    if ( next == fileSize || check_tag( fd, next, fileSize, nextTag ) ) return true;
+    // previous tag
+    uint8_t sizeBuf[4];
+    if ( flv_pread_all( fd, sizeBuf, 4, offset - 4 ) < 0 ) return false;
+    uint32_t previous = read_u32( sizeBuf );
+    if ( offset == FlvFileHeaderSize ) return previous == 0;
+    if ( previous < FlvTagHeaderSize || offset < (uint64_t)FlvFileHeaderSize + 4 + previous ) return false;
+    FlvTagInfo previousTag;
+    return check_tag( fd, offset - 4 - previous, fileSize, previousTag );
+}
+
+/**
+ * @brief find the first tag starting in [from, limit).
+ *
+ * @return offset of the tag, or limit if there is none.
+ */
+static uint64_t find_tag_start( int fd, uint64_t from, uint64_t limit, uint64_t fileSize, std::vector<uint8_t> &buf ) {
+    if ( from < FlvFileHeaderSize ) from = FlvFileHeaderSize;
+    const size_t step = buf.size() - FlvTagHeaderSize;
+    for ( uint64_t chunk = from; chunk < limit; chunk += step ) {
+        size_t want = buf.size();
+        if ( chunk + want > fileSize ) want = (size_t)( fileSize - chunk );
+        if ( want < FlvTagHeaderSize || flv_pread_all( fd, &buf[0], want, chunk ) < 0 ) break;
+        for ( size_t i = 0; i + FlvTagHeaderSize <= want && i < step && chunk + i < limit; i++ ) {
+            // cheap filter first, tag type with reserved bits and filter 0, stream id 0
+            const uint8_t *p = &buf[i];
+            if ( ( p[0] != 8 && p[0] != 9 && p[0] != 18 ) || p[8] || p[9] || p[10] ) continue;
+            if ( is_tag_start( fd, chunk + i, fileSize ) ) return chunk + i;
+        }
+    }
+    return limit;
+}
+
+static void add_track_tag( FlvScanTrack &track, const FlvTagInfo &tag ) {
+    if ( !track.tags ) {
+        track.firstTimestamp = tag.timestamp;
+    }
+    else if ( tag.timestamp < track.lastTimestamp ) {
+        track.backwardTimestamps += 1;
+    }
+    track.lastTimestamp = tag.timestamp;
+    track.tags += 1;
+    track.bytes += tag.size();
+}
+
+static int add_tag( FlvFileReader &reader, const FlvTagInfo &tag, const uint8_t *data, FlvScanResult &result ) {
+    if ( tag.type == 18 ) {
+        result.scriptTags += 1;
+        return 0;
+    }
+    if ( tag.packetType == 0 ) {
+        // sequence header
+        FlvScanCodecHeader header = { tag.offset, tag.type, tag.timestamp, std::vector<uint8_t>( tag.dataSize ) };
+        if ( data ) {
+            header.data.assign( data, data + tag.dataSize );
+        }
+        else if ( reader.read_at( tag.offset + FlvTagHeaderSize, &header.data[0], tag.dataSize ) < 0 ) {
+            return -1;
+        }
+        result.codecHeaders.push_back( std::move( header ) );
+        return 0;
+    }
+    if ( tag.type == 8 ) {
+        add_track_tag( result.audio, tag );
+        return 0;
+    }
+    if ( tag.packetType == 2 ) return 0; // end of sequence
+    add_track_tag( result.video, tag );
+    if ( tag.isKeyFrame ) {
+        result.keyframes.push_back( { tag.offset, tag.timestamp } );
+    }
+    return 0;
+}
+
+/**
+ * @brief scan the tags starting in [range.begin, range.end), the last tag may end after range.end.
+ *
+ * @param resyncStart  range.begin may not be a tag boundary, look for the first tag
+ */
+static void scan_range( int fd, uint64_t fileSize, size_t bufferSize, RangeScan &range, bool resyncStart ) {
+    std::vector<uint8_t> resyncBuffer( 1 << 20 );
+    range.start     = resyncStart ? find_tag_start( fd, range.begin, range.end, fileSize, resyncBuffer ) : range.begin;
+    range.stop      = range.end;
+    range.stopAtTag = false;
+    if ( range.start >= range.end ) return;
+
+    FlvScanResult &result = range.result;
+    FlvFileReader  reader( fd, range.start, fileSize, bufferSize );
+    FlvTagInfo     tag;
+    const uint8_t *data = nullptr;
+    while ( reader.position() < range.end ) {
+        int ret = reader.next( tag, &data );
+        if ( ret == 0 ) break;
+        if ( ret > 0 ) {
+            if ( add_tag( reader, tag, data, result ) < 0 ) {
+                range.error = -1;
+                return;
+            }
+            result.validEnd = reader.position();
+            continue;
+        }
+        // corrupted or torn tag, continue at the next tag boundary
+        uint64_t corrupted = reader.position();
+        uint64_t resync    = find_tag_start( fd, corrupted + 1, range.end, fileSize, resyncBuffer );
+        result.corruptions.push_back( { corrupted, resync } );
+        if ( resync >= range.end ) return;
+        reader.seek( resync );
+    }
+    range.stop      = reader.position();
+    range.stopAtTag = true;
+}
+
+static void merge_track( FlvScanTrack &to, const FlvScanTrack &from ) {
+    if ( !from.tags ) return;
+    if ( !to.tags ) {
+        to = from;
+        return;
+    }
+    if ( from.firstTimestamp < to.lastTimestamp ) to.backwardTimestamps += 1;
+    to.tags += from.tags;
+    to.bytes += from.bytes;
+    to.lastTimestamp = from.lastTimestamp;
+    to.backwardTimestamps += from.backwardTimestamps;
+}
+
+template <typename T>
+static void append( std::vector<T> &to, std::vector<T> &from ) {
+    for ( auto &item : from ) {
+        to.push_back( std::move( item ) );
+    }
+}
+
+static void merge_result( FlvScanResult &to, FlvScanResult &from ) {
+    to.scriptTags += from.scriptTags;
+    merge_track( to.audio, from.audio );
+    merge_track( to.video, from.video );
+    if ( from.validEnd ) to.validEnd = from.validEnd;
+    append( to.keyframes, from.keyframes );
+    append( to.codecHeaders, from.codecHeaders );
+    append( to.corruptions, from.corruptions );
+}
+
+int flv_scan_file( const char *path, const FlvScanOptions &options, FlvScanResult &result ) {
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 ) return -1;
+    struct stat st;
+    uint8_t     header[FlvFileHeaderSize];
+    if ( fstat( fd, &st ) < 0 || flv_pread_all( fd, header, FlvFileHeaderSize, 0 ) < 0 || flv_parse_header( header, FlvFileHeaderSize, &result.hasAudio, &result.hasVideo ) < 0 ) {
+        close( fd );
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+    uint64_t fileSize = st.st_size;
+    result.fileSize   = fileSize;
+    result.validEnd   = FlvFileHeaderSize;
+
+    // split in ranges
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if ( !threads ) threads = 1;
+    uint64_t dataSize  = fileSize - FlvFileHeaderSize;
+    uint64_t maxRanges = options.minRangeSize ? dataSize / options.minRangeSize : threads;
+    if ( maxRanges < 1 ) maxRanges = 1;
+    size_t                 rangeCount = (size_t)( threads < maxRanges ? threads : maxRanges );
+    std::vector<RangeScan> ranges( rangeCount );
+    for ( size_t i = 0; i < rangeCount; i++ ) {
+        ranges[i].begin = FlvFileHeaderSize + dataSize * i / rangeCount;
+        ranges[i].end   = FlvFileHeaderSize + dataSize * ( i + 1 ) / rangeCount;
+    }
+
+    // the first range starts at the first tag, the others resynchronize
+    std::vector<std::thread> workers;
+    for ( size_t i = 1; i < rangeCount; i++ ) {
+        workers.emplace_back( scan_range, fd, fileSize, options.bufferSize, std::ref( ranges[i] ), true );
+    }
+    scan_range( fd, fileSize, options.bufferSize, ranges[0], false );
+    for ( auto &worker : workers ) {
+        worker.join();
+    }
+
+    // merge in file order
+    int      ret       = 0;
+    uint64_t stop      = FlvFileHeaderSize;
+    bool     stopAtTag = true;
+    for ( auto &range : ranges ) {
+        if ( stopAtTag && stop >= range.end ) {
+            // covered by a tag of the previous range
+            continue;
+        }
+        if ( stopAtTag && range.start != stop ) {
+            // the resynchronization was wrong, or the previous range ended in corrupted data, scan again from the tag boundary
+            range.begin  = stop;
+            range.error  = 0;
+            range.result = FlvScanResult();
+            scan_range( fd, fileSize, options.bufferSize, range, false );
+        }
+        if ( range.error < 0 ) {
+            ret = -1;
+            break;
+        }
+        if ( !stopAtTag && !result.corruptions.empty() ) {
+            // the corrupted data of the previous ranges ends at the first tag of this range
+            result.corruptions.back().resyncOffset = range.start < range.end ? range.start : range.end;
+        }
+        merge_result( result, range.result );
+        stop      = range.stop;
+        stopAtTag = range.stopAtTag;
+    }
+    close( fd );
+    return ret;
+}
+
+}; // namespace nx
@@ -0,0 +1,89 @@
+#ifndef __FLV_SCANNER_H__
+#define __FLV_SCANNER_H__
+
+#include <string>
+#include <vector>
+
+#include "flv_reader.h"
+
+namespace nx {
+
+struct FlvScanOptions {
+    // number of worker threads, 0 - one per core
+    unsigned threads = 0;
+    // a file is split in ranges of at least this size, small files are scanned by one thread
+    uint64_t minRangeSize = 64 << 20;
+    // read size of each worker
+    size_t bufferSize = FlvFileReader::DefaultBufferSize;
+};
+
+struct FlvScanTrack {
+    // frame tags, sequence headers are counted in FlvScanResult::codecHeaders
+    uint64_t tags = 0;
+    // include tag header and tag size
+    uint64_t bytes = 0;
+    // timestamps of the first and the last tag in file order
+    uint32_t firstTimestamp = 0;
+    uint32_t lastTimestamp  = 0;
+    // number of tags with a timestamp smaller than the previous tag of the track
+    uint64_t backwardTimestamps = 0;
+};
+
+struct FlvScanKeyframe {
+    uint64_t offset;
+    uint32_t timestamp;
+};
+
+/**
+ * @brief an avc or aac sequence header, data is the tag data.
+ */
+struct FlvScanCodecHeader {
+    uint64_t             offset;
+    uint8_t              type;
+    uint32_t             timestamp;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * @brief bytes [offset, resyncOffset) are not valid tags,
+ * resyncOffset is the file size when no tag was found after offset.
+ */
+struct FlvScanCorruption {
+    uint64_t offset;
+    uint64_t resyncOffset;
+};
+
+struct FlvScanResult {
+    uint64_t     fileSize = 0;
+    bool         hasAudio = false;
+    bool         hasVideo = false;
+    uint64_t     scriptTags = 0;
+    FlvScanTrack audio;
+    FlvScanTrack video;
+    // end of the last valid tag
+    uint64_t validEnd = 0;
+    // all in file order
+    std::vector<FlvScanKeyframe>    keyframes;
+    std::vector<FlvScanCodecHeader> codecHeaders;
+    std::vector<FlvScanCorruption>  corruptions;
+
+    bool valid() const {
+        return corruptions.empty() && !audio.backwardTimestamps && !video.backwardTimestamps;
+    }
+};
+
+/**
+ * @brief validate and index a flv file with several threads.
+ * The file is split in byte ranges, each worker finds the first tag of its range
+ * by checking candidate tag headers against the PreviousTagSize before and after them,
+ * and scans its range independently. The results are merged in file order,
+ * a range whose first tag does not continue the previous range is scanned again from the right offset.
+ * After a corrupted tag the scan resynchronizes the same way.
+ *
+ * @return 0: success, the file may still be invalid, see FlvScanResult::valid. <0: not a flv file or io error.
+ */
+int flv_scan_file( const char *path, const FlvScanOptions &options, FlvScanResult &result );
+
+};     // namespace nx
+
+#endif // __FLV_SCANNER_H__
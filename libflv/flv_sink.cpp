@@ -0,0 +1,170 @@
+#include "flv_sink.h"
+#include "flvmuxer.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <unistd.h>
+
+namespace nx {
+
+FlvBufferedFile::FlvBufferedFile( size_t bufferSize ) {
+    size_t size = ( bufferSize + BufferAlignment - 1 ) / BufferAlignment * BufferAlignment;
+    if ( !size ) size = BufferAlignment;
+    void *memory = nullptr;
+    if ( posix_memalign( &memory, BufferAlignment, size ) ) throw std::bad_alloc();
+    buffer   = (uint8_t *)memory;
+    capacity = size;
+}
+
+FlvBufferedFile::~FlvBufferedFile() {
+    close();
+    free( buffer );
+}
+
+int FlvBufferedFile::open( const char *path ) {
+    close();
+    fd          = ::open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    lastError   = fd < 0 ? errno : 0;
+    bytes       = 0;
+    written     = 0;
+    used        = 0;
+    reservedEnd = 0;
+    syncedEnd   = 0;
+    rateStarted = false;
+    return fd < 0 ? -1 : 0;
+}
+
+int FlvBufferedFile::close() {
+    if ( fd < 0 ) return lastError ? -1 : 0;
+    flush();
+    trim();
+    ::close( fd );
+    fd = -1;
+    return lastError ? -1 : 0;
+}
+
+void FlvBufferedFile::set_preallocation( bool enable, uint32_t aheadMs, size_t minBytes, size_t maxBytes ) {
+    this->preallocate = enable;
+    this->aheadMs     = aheadMs;
+    this->minReserve  = minBytes;
+    this->maxReserve  = maxBytes > minBytes ? maxBytes : minBytes;
+}
+
+void FlvBufferedFile::set_writeback_pacing( size_t windowBytes ) {
+    this->syncWindow = windowBytes;
+    this->syncedEnd  = written;
+}
+
+void FlvBufferedFile::reserve( uint64_t end ) {
+#if defined( __linux__ )
+    if ( !preallocate || end <= reservedEnd ) return;
+    // bitrate of the stream so far, from the first second on
+    uint64_t step = minReserve;
+    if ( !rateStarted ) {
+        rateStarted    = true;
+        firstTimestamp = lastTimestamp;
+        firstBytes     = bytes;
+    }
+    else if ( lastTimestamp >= firstTimestamp + 1000 ) {
+        uint64_t rate = ( bytes - firstBytes ) * 1000 / ( lastTimestamp - firstTimestamp );
+        step          = rate * aheadMs / 1000;
+        if ( step < minReserve ) step = minReserve;
+        if ( step > maxReserve ) step = maxReserve;
+    }
+    uint64_t offset = reservedEnd > written ? reservedEnd : written;
+    if ( end > offset + step ) step = end - offset;
+    // the file size is kept, readers of a growing file only see the data
+    if ( fallocate( fd, FALLOC_FL_KEEP_SIZE, offset, step ) < 0 ) {
+        // not supported or no space, the writes report a real failure
+        preallocate = false;
+        return;
+    }
+    reservedEnd = offset + step;
+#endif
+}
+
+void FlvBufferedFile::trim() {
+    if ( reservedEnd <= written ) return;
+    // blocks past the end of the file are freed by a truncate to the same size
+    if ( ftruncate( fd, written ) < 0 && !lastError ) lastError = errno;
+    reservedEnd = 0;
+}
+
+void FlvBufferedFile::pace_writeback() {
+#if defined( __linux__ )
+    if ( !syncWindow ) return;
+    while ( written >= syncedEnd + syncWindow ) {
+        uint64_t start = syncedEnd;
+        syncedEnd += syncWindow;
+        // start the writeback of this window, without waiting
+        sync_file_range( fd, start, syncWindow, SYNC_FILE_RANGE_WRITE );
+        // wait for the previous window, which has had a window of writes to complete
+        if ( start >= syncWindow ) {
+            sync_file_range( fd, start - syncWindow, syncWindow, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+        }
+    }
+#endif
+}
+
+void FlvBufferedFile::write_all( const uint8_t *data, size_t size ) {
+    if ( lastError ) return;
+    reserve( written + size );
+    while ( size > 0 ) {
+        ssize_t n = ::write( fd, data, size );
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            lastError = errno;
+            return;
+        }
+        data += n;
+        size -= n;
+        written += n;
+    }
+    pace_writeback();
+}
+
+void FlvBufferedFile::flush() {
+    if ( fd < 0 || !used ) return;
+    write_all( buffer, used );
+    used = 0;
+}
+
+void FlvBufferedFile::append_slow( const uint8_t *data, size_t size ) {
+    if ( fd < 0 ) return;
+    bytes += size;
+    // fill the buffer, so it is written as a whole aligned block
+    size_t head = capacity - used;
+    memcpy( buffer + used, data, head );
+    write_all( buffer, capacity );
+    used = 0;
+    data += head;
+    size -= head;
+    // whole buffers are written directly, the rest is buffered
+    size_t direct = size / capacity * capacity;
+    if ( direct ) {
+        write_all( data, direct );
+        data += direct;
+        size -= direct;
+    }
+    memcpy( buffer, data, size );
+    used = size;
+}
+
+void FlvBufferedFile::write_at( size_t offset, const uint8_t *data, size_t size ) {
+    if ( fd < 0 || offset + size > bytes ) return;
+    // the part still in the buffer
+    if ( offset + size > written ) {
+        size_t head = offset < written ? (size_t)( written - offset ) : 0;
+        memcpy( buffer + ( offset + head - written ), data + head, size - head );
+        size = head;
+    }
+    if ( size && pwrite( fd, data, size, offset ) != (ssize_t)size && !lastError ) lastError = errno;
+}
+
+void FlvFileSink::onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+    file->append( data, bytes );
+    if ( count ) file->set_timestamp( tags[count - 1].timestamp );
+}
+
+}; // namespace nx
@@ -0,0 +1,250 @@
+#ifndef __FLV_SINK_H__
+#define __FLV_SINK_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ Output policies of BasicFlvMuxer, called directly by the muxer, so the tag path can be inlined.
+ A sink is a small copyable object referencing an output owned by the caller, it implements:
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes );
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp );
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count );
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes );
+    void onEndMuxing();
+    int  onBackpressure();
+    int  onStreamingSupport();
+    void onMuxedDataPart( int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last );
+
+ with the meaning of the FlvMuxerDataHandler callbacks, without the context.
+*/
+
+namespace nx {
+
+/**
+ * @brief a tag in the buffer of FlvMuxerDataHandler::onMuxedBatch.
+ */
+struct FlvBatchTag {
+    // 8 - audio, 9 - video
+    int type;
+    // offset in the batch buffer, the tag is followed by its tag size
+    size_t   offset;
+    size_t   bytes;
+    uint32_t timestamp;
+};
+
+/**
+ * @brief how a sink takes the video tags of BasicFlvMuxer::begin_video_frame, add_nalu and end_video_frame.
+ */
+enum FlvSinkStreaming {
+    FlvSinkStreamingNone = 0, // whole tags only, the frame is buffered and written with onMuxedData
+    FlvSinkStreamingAppend,   // tags in parts with onMuxedDataPart, written bytes are final, the frame size must be announced
+    FlvSinkStreamingSeekable, // tags in parts, and onUpdateMuxedData patches the DataSize of a tag when it is complete
+};
+
+/**
+ * @brief append the flv to a vector of the caller, the metadata is patched in place.
+ */
+struct FlvMemorySink {
+    std::vector<uint8_t> *output;
+    // size of output when the stream started, offsets are relative to it
+    size_t start;
+
+    explicit FlvMemorySink( std::vector<uint8_t> &output ) : output( &output ), start( output.size() ) {}
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes ) {
+        output->insert( output->end(), data, data + bytes );
+    }
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        output->insert( output->end(), data, data + bytes );
+    }
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+        output->insert( output->end(), data, data + bytes );
+    }
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {
+        if ( start + offsetFromStart + bytes > output->size() ) return;
+        memcpy( &( *output )[start + offsetFromStart], data, bytes );
+    }
+    void onEndMuxing() {}
+    int  onBackpressure() {
+        return 0;
+    }
+    int onStreamingSupport() {
+        return FlvSinkStreamingSeekable;
+    }
+    void onMuxedDataPart( int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) {
+        output->insert( output->end(), data, data + bytes );
+    }
+};
+
+/**
+ * @brief a file written with write(2) in large chunks through a page aligned user space buffer,
+ * and patched with pwrite(2). Not thread safe.
+ * Full buffers are written at offsets which are multiples of the buffer size, so the page cache
+ * and the file system only see whole aligned blocks.
+ *
+ * For long recordings, disk space can be reserved ahead of the data with fallocate(2) in steps sized
+ * from the observed bitrate, so the file is laid out in a few large extents instead of many small ones,
+ * and the writeback of dirty pages can be paced with sync_file_range(2). Both are Linux only, and ignored elsewhere.
+ */
+class FlvBufferedFile {
+public:
+    static const size_t DefaultBufferSize = 4 << 20;
+    static const size_t BufferAlignment   = 4096;
+
+    /**
+     * @param bufferSize  rounded up to a multiple of BufferAlignment
+     */
+    explicit FlvBufferedFile( size_t bufferSize = DefaultBufferSize );
+    ~FlvBufferedFile();
+    FlvBufferedFile( const FlvBufferedFile & )            = delete;
+    FlvBufferedFile &operator=( const FlvBufferedFile & ) = delete;
+
+    /**
+     * @brief create or truncate the file.
+     *
+     * @return 0: success, <0: failure, see error()
+     */
+    int open( const char *path );
+    /**
+     * @brief flush the buffer, release the reserved space past the data and close the file.
+     *
+     * @return 0: success, <0: a write failed, see error()
+     */
+    int close();
+    /**
+     * @brief append data, buffered.
+     */
+    void append( const uint8_t *data, size_t size ) {
+        if ( fd >= 0 && used + size <= capacity ) {
+            memcpy( buffer + used, data, size );
+            used += size;
+            bytes += size;
+            return;
+        }
+        append_slow( data, size );
+    }
+    /**
+     * @brief stream time of the appended data in milliseconds, for the bitrate of the preallocation.
+     * Older timestamps are ignored.
+     */
+    void set_timestamp( uint32_t timestamp ) {
+        if ( timestamp > lastTimestamp ) lastTimestamp = timestamp;
+    }
+    /**
+     * @brief overwrite data already appended, at offset from the start of the file.
+     * Buffered bytes are patched in memory, e.g. the size of a tag just written, the others with pwrite(2).
+     */
+    void write_at( size_t offset, const uint8_t *data, size_t size );
+    /**
+     * @brief write the buffered data to the file.
+     */
+    void flush();
+    /**
+     * @brief reserve disk space ahead of the data with fallocate, without changing the file size.
+     * A step reserves aheadMs of the bitrate observed through set_timestamp, bounded by minBytes and maxBytes,
+     * minBytes until a bitrate is known. Preallocation stops silently when the file system does not support it.
+     *
+     * @param enable  enable or disable preallocation, disabled by default
+     */
+    void set_preallocation( bool enable, uint32_t aheadMs = 60000, size_t minBytes = 16 << 20, size_t maxBytes = 1 << 30 );
+    /**
+     * @brief start the writeback of every windowBytes written with sync_file_range, and wait for the window before it,
+     * so dirty pages are flushed steadily instead of in bursts which stall the writing thread.
+     *
+     * @param windowBytes  bytes per window, 0 disables pacing, the default
+     */
+    void set_writeback_pacing( size_t windowBytes );
+
+    bool is_open() const {
+        return fd >= 0;
+    }
+    // errno of the first failure, 0 if none
+    int error() const {
+        return lastError;
+    }
+    // bytes appended
+    uint64_t size() const {
+        return bytes;
+    }
+    // end of the space reserved by preallocation, 0 if none
+    uint64_t reserved() const {
+        return reservedEnd;
+    }
+
+private:
+    void append_slow( const uint8_t *data, size_t size );
+    // write at the end of the file, reserving space and pacing writeback first
+    void write_all( const uint8_t *data, size_t size );
+    // make sure the space up to end is reserved
+    void reserve( uint64_t end );
+    // release the reserved space past the data
+    void trim();
+    // write back the windows completed by the last write
+    void pace_writeback();
+
+    int      fd        = -1;
+    int      lastError = 0;
+    uint64_t bytes     = 0;
+    // bytes written to the file, the buffered ones excluded
+    uint64_t written  = 0;
+    uint8_t *buffer   = nullptr;
+    size_t   capacity = 0;
+    size_t   used     = 0;
+
+    // preallocation
+    bool     preallocate    = false;
+    uint32_t aheadMs        = 0;
+    size_t   minReserve     = 0;
+    size_t   maxReserve     = 0;
+    uint64_t reservedEnd    = 0;
+    uint32_t lastTimestamp  = 0;
+    bool     rateStarted    = false;
+    uint32_t firstTimestamp = 0;
+    uint64_t firstBytes     = 0;
+
+    // writeback pacing, [syncedEnd - window, syncedEnd) is being written back
+    size_t   syncWindow = 0;
+    uint64_t syncedEnd  = 0;
+};
+
+/**
+ * @brief write the flv to a FlvBufferedFile of the caller, which is closed at the end of muxing.
+ */
+struct FlvFileSink {
+    FlvBufferedFile *file;
+
+    explicit FlvFileSink( FlvBufferedFile &file ) : file( &file ) {}
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes ) {
+        file->append( data, bytes );
+    }
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        file->append( data, bytes );
+        file->set_timestamp( timestamp );
+    }
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count );
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {
+        file->write_at( offsetFromStart, data, bytes );
+    }
+    void onEndMuxing() {
+        file->close();
+    }
+    int onBackpressure() {
+        return 0;
+    }
+    int onStreamingSupport() {
+        return FlvSinkStreamingSeekable;
+    }
+    void onMuxedDataPart( int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) {
+        file->append( data, bytes );
+        if ( last ) file->set_timestamp( timestamp );
+    }
+};
+
+};     // namespace nx
+
+#endif // __FLV_SINK_H__
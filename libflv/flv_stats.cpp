@@ -0,0 +1,213 @@
+#include "flv_stats.h"
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+namespace nx {
+
+static int size_to_bucket( uint32_t size ) {
+    if ( size < 16 ) return size;
+    int exponent = 31 - __builtin_clz( size );
+    return ( exponent - 2 ) * 8 + ( ( size >> ( exponent - 3 ) ) & 7 );
+}
+
+// the largest size that falls in the bucket
+static uint32_t bucket_to_size( int bucket ) {
+    if ( bucket < 16 ) return bucket;
+    int      exponent = bucket / 8 + 2;
+    uint64_t lower    = (uint64_t)( 8 + bucket % 8 ) << ( exponent - 3 );
+    uint64_t upper    = lower + ( (uint64_t)1 << ( exponent - 3 ) ) - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+bool FlvStatsCollector::TrackCounter::add( uint32_t timestamp, size_t bytes ) {
+    bool     opened = false;
+    uint32_t bucket = timestamp / BucketMs;
+    if ( !started ) {
+        started        = true;
+        firstTimestamp = timestamp;
+        currentBucket  = bucket;
+    }
+    else {
+        if ( timestamp > lastTimestamp ) {
+            uint32_t gap = timestamp - lastTimestamp;
+            if ( gap > maxTimestampGap ) maxTimestampGap = gap;
+            if ( gap > GapThresholdMs ) timestampGaps++;
+        }
+        if ( bucket > currentBucket ) {
+            // evict the buckets which fall out of the window, at most BucketCount
+            uint32_t advance = bucket - currentBucket;
+            uint32_t evict   = advance < BucketCount ? advance : BucketCount;
+            for ( uint32_t i = 1; i <= evict; i++ ) {
+                uint32_t index = ( currentBucket + i ) % BucketCount;
+                windowBytes -= bucketBytes[index];
+                windowTags -= bucketTags[index];
+                bucketBytes[index] = 0;
+                bucketTags[index]  = 0;
+            }
+            completedBuckets += advance;
+            if ( completedBuckets > BucketCount - 1 ) completedBuckets = BucketCount - 1;
+            currentBucket = bucket;
+            opened        = true;
+        }
+    }
+    lastTimestamp = timestamp;
+
+    uint32_t size = bytes > UINT32_MAX ? UINT32_MAX : (uint32_t)bytes;
+    tags += 1;
+    this->bytes += bytes;
+    if ( size > maxTagSize ) maxTagSize = size;
+    sizeHistogram[size_to_bucket( size )]++;
+
+    uint32_t index = currentBucket % BucketCount;
+    bucketBytes[index] += bytes;
+    bucketTags[index] += 1;
+    windowBytes += bytes;
+    windowTags += 1;
+    return opened;
+}
+
+void FlvStatsCollector::TrackCounter::fill( FlvTrackStats &stats ) const {
+    stats.tags            = tags;
+    stats.bytes           = bytes;
+    stats.firstTimestamp  = firstTimestamp;
+    stats.lastTimestamp   = lastTimestamp;
+    stats.maxTimestampGap = maxTimestampGap;
+    stats.timestampGaps   = timestampGaps;
+    stats.tagSizeMax      = maxTagSize;
+
+    // rates over the closed buckets only, the newest bucket is still filling
+    if ( completedBuckets > 0 ) {
+        uint32_t index    = currentBucket % BucketCount;
+        double   duration = completedBuckets * BucketMs; // ms
+        uint64_t sumBytes = windowBytes - bucketBytes[index];
+        uint32_t sumTags  = windowTags - bucketTags[index];
+        stats.bitrate     = sumBytes * 8 / duration; // bits per ms equals kbps
+        stats.framerate   = sumTags * 1000 / duration;
+    }
+    else {
+        stats.bitrate   = 0;
+        stats.framerate = 0;
+    }
+
+    // percentiles
+    {
+        uint64_t p50     = ( tags * 50 + 99 ) / 100;
+        uint64_t p90     = ( tags * 90 + 99 ) / 100;
+        uint64_t p99     = ( tags * 99 + 99 ) / 100;
+        uint64_t count   = 0;
+        stats.tagSizeP50 = stats.tagSizeP90 = stats.tagSizeP99 = 0;
+        for ( int i = 0; i < SizeHistogramBuckets && count < p99; i++ ) {
+            if ( !sizeHistogram[i] ) continue;
+            count += sizeHistogram[i];
+            uint32_t size = bucket_to_size( i );
+            if ( size > maxTagSize ) size = maxTagSize;
+            if ( !stats.tagSizeP50 && count >= p50 ) stats.tagSizeP50 = size;
+            if ( !stats.tagSizeP90 && count >= p90 ) stats.tagSizeP90 = size;
+            if ( !stats.tagSizeP99 && count >= p99 ) stats.tagSizeP99 = size;
+        }
+    }
+}
+
+static_assert( std::is_trivially_copyable<FlvStreamStats>::value, "FlvStreamStats is published as raw words" );
+
+FlvStatsCollector::FlvStatsCollector() {
+    sequence.store( 0, std::memory_order_relaxed );
+    store_published( FlvStreamStats() );
+}
+
+void FlvStatsCollector::store_published( const FlvStreamStats &stats ) {
+    uint64_t words[PublishedWords] = { 0 };
+    memcpy( words, &stats, sizeof( stats ) );
+    for ( size_t i = 0; i < PublishedWords; i++ ) {
+        published[i].store( words[i], std::memory_order_relaxed );
+    }
+}
+
+void FlvStatsCollector::on_audio_tag( uint32_t timestamp, size_t bytes ) {
+    if ( audio.add( timestamp, bytes ) ) publish();
+}
+
+void FlvStatsCollector::on_video_tag( uint32_t timestamp, size_t bytes, bool isKeyFrame ) {
+    if ( isKeyFrame ) {
+        if ( hasKeyFrame ) {
+            // close the gop
+            lastGopLength = framesInGop;
+            gopCount += 1;
+            gopFrames += framesInGop;
+            // key frame interval, Welford's online algorithm
+            double interval = timestamp > lastKeyTimestamp ? timestamp - lastKeyTimestamp : 0;
+            keyIntervalCount += 1;
+            double delta = interval - keyIntervalMean;
+            keyIntervalMean += delta / keyIntervalCount;
+            keyIntervalM2 += delta * ( interval - keyIntervalMean );
+        }
+        hasKeyFrame      = true;
+        lastKeyTimestamp = timestamp;
+        framesInGop      = 0;
+    }
+    framesInGop += 1;
+    if ( video.add( timestamp, bytes ) ) publish();
+}
+
+void FlvStatsCollector::on_video_drop( size_t bytes, bool gop ) {
+    if ( gop ) {
+        droppedGopFrames += 1;
+    }
+    else {
+        droppedDisposableFrames += 1;
+    }
+    droppedBytes += bytes;
+}
+
+void FlvStatsCollector::on_nalus_filtered( size_t count, size_t bytes ) {
+    filteredNalus += count;
+    filteredBytes += bytes;
+}
+
+void FlvStatsCollector::on_audio_skip() {
+    skippedAudioFrames += 1;
+}
+
+void FlvStatsCollector::publish() {
+    FlvStreamStats stats;
+    audio.fill( stats.audio );
+    video.fill( stats.video );
+    stats.gopLength               = lastGopLength;
+    stats.averageGopLength        = gopCount ? (double)gopFrames / gopCount : 0;
+    stats.keyFrameInterval        = keyIntervalMean;
+    stats.keyFrameIntervalJitter  = keyIntervalCount > 1 ? sqrt( keyIntervalM2 / ( keyIntervalCount - 1 ) ) : 0;
+    stats.droppedDisposableFrames = droppedDisposableFrames;
+    stats.droppedGopFrames        = droppedGopFrames;
+    stats.droppedBytes            = droppedBytes;
+    stats.filteredNalus           = filteredNalus;
+    stats.filteredBytes           = filteredBytes;
+    stats.skippedAudioFrames      = skippedAudioFrames;
+
+    // seqlock writer, odd sequence means the stats is being written
+    uint32_t seq = sequence.load( std::memory_order_relaxed );
+    sequence.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    store_published( stats );
+
+    sequence.store( seq + 2, std::memory_order_release );
+}
+
+void FlvStatsCollector::get_stats( FlvStreamStats &stats ) const {
+    // seqlock reader, retry while the writer is publishing
+    uint64_t words[PublishedWords];
+    while ( true ) {
+        uint32_t begin = sequence.load( std::memory_order_acquire );
+        if ( begin & 1 ) continue;
+        for ( size_t i = 0; i < PublishedWords; i++ ) {
+            words[i] = published[i].load( std::memory_order_relaxed );
+        }
+        std::atomic_thread_fence( std::memory_order_acquire );
+        uint32_t end = sequence.load( std::memory_order_relaxed );
+        if ( begin == end ) break;
+    }
+    memcpy( &stats, words, sizeof( stats ) );
+}
+
+}; // namespace nx
@@ -0,0 +1,167 @@
+#ifndef __FLV_STATS_H__
+#define __FLV_STATS_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace nx {
+
+/**
+ * @brief statistics of one track, audio or video.
+ * Rates are computed over the sliding window, totals over the whole stream.
+ */
+struct FlvTrackStats {
+    // total number of frame tags
+    uint64_t tags = 0;
+    // total bytes of frame tags, include tag header and tag size
+    uint64_t bytes = 0;
+    // first and last timestamp in milliseconds
+    uint32_t firstTimestamp = 0;
+    uint32_t lastTimestamp  = 0;
+    // bit rate in kilobits per second, over the sliding window
+    double bitrate = 0;
+    // tags per second, over the sliding window
+    double framerate = 0;
+    // largest delta between two consecutive tags in milliseconds
+    uint32_t maxTimestampGap = 0;
+    // number of deltas larger than FlvStatsCollector::GapThresholdMs
+    uint64_t timestampGaps = 0;
+    // tag size percentiles in bytes, upper bound of a histogram bucket, 12.5% precision
+    uint32_t tagSizeP50 = 0;
+    uint32_t tagSizeP90 = 0;
+    uint32_t tagSizeP99 = 0;
+    uint32_t tagSizeMax = 0;
+};
+
+struct FlvStreamStats {
+    FlvTrackStats audio;
+    FlvTrackStats video;
+    // number of frames in the last closed gop
+    uint32_t gopLength = 0;
+    // average number of frames per gop
+    double averageGopLength = 0;
+    // average key frame interval in milliseconds
+    double keyFrameInterval = 0;
+    // standard deviation of the key frame interval in milliseconds
+    double keyFrameIntervalJitter = 0;
+    // video frames dropped under backpressure, non-reference frames and gop remainders
+    uint64_t droppedDisposableFrames = 0;
+    uint64_t droppedGopFrames        = 0;
+    // input bytes of the dropped frames
+    uint64_t droppedBytes = 0;
+    // nal units removed by the nalu filter, and the output bytes they would have taken
+    uint64_t filteredNalus = 0;
+    uint64_t filteredBytes = 0;
+    // adts frames of several raw data blocks without crc, whose block boundaries are unknown, not muxed
+    uint64_t skippedAudioFrames = 0;
+};
+
+/**
+ * @brief collects per track statistics of a live stream.
+ * Updates are O(1) and only called from the muxing thread,
+ * get_stats can be called from any thread without locking.
+ */
+class FlvStatsCollector {
+public:
+    // sliding window, BucketCount buckets of BucketMs milliseconds each
+    static const uint32_t BucketMs    = 500;
+    static const uint32_t BucketCount = 8;
+    // timestamp deltas larger than this are counted as gaps
+    static const uint32_t GapThresholdMs = 1000;
+
+    FlvStatsCollector();
+
+    void on_audio_tag( uint32_t timestamp, size_t bytes );
+    void on_video_tag( uint32_t timestamp, size_t bytes, bool isKeyFrame );
+    /**
+     * @brief count a video frame dropped under backpressure.
+     *
+     * @param bytes  input bytes of the frame
+     * @param gop  dropped as part of a gop remainder, or as a non-reference frame
+     */
+    void on_video_drop( size_t bytes, bool gop );
+    /**
+     * @brief count nal units removed from a video tag by the nalu filter.
+     *
+     * @param bytes  output bytes of the nal units, with their length prefixes
+     */
+    void on_nalus_filtered( size_t count, size_t bytes );
+    /**
+     * @brief count an adts frame which is not muxed, see FlvStreamStats::skippedAudioFrames.
+     */
+    void on_audio_skip();
+    /**
+     * @brief publish the latest counters to readers,
+     * called automatically once per bucket, and should be called when the stream ends.
+     */
+    void publish();
+    /**
+     * @brief read the last published statistics, lock free.
+     *
+     * @param stats  filled with the statistics
+     */
+    void get_stats( FlvStreamStats &stats ) const;
+
+private:
+    // log-linear size histogram, 8 sub buckets for each power of 2
+    static const int SizeHistogramBuckets = 32 * 8;
+
+    struct TrackCounter {
+        bool     started         = false;
+        uint64_t tags            = 0;
+        uint64_t bytes           = 0;
+        uint32_t firstTimestamp  = 0;
+        uint32_t lastTimestamp   = 0;
+        uint32_t maxTimestampGap = 0;
+        uint64_t timestampGaps   = 0;
+        uint32_t maxTagSize      = 0;
+
+        // sliding window, ring of buckets indexed by timestamp / BucketMs
+        uint32_t currentBucket    = 0; // index of the newest bucket
+        uint32_t completedBuckets = 0; // number of closed buckets in the window
+        uint64_t bucketBytes[BucketCount] = { 0 };
+        uint32_t bucketTags[BucketCount]  = { 0 };
+        uint64_t windowBytes              = 0;
+        uint32_t windowTags               = 0;
+
+        uint64_t sizeHistogram[SizeHistogramBuckets] = { 0 };
+
+        // return true when a new bucket is opened
+        bool add( uint32_t timestamp, size_t bytes );
+        void fill( FlvTrackStats &stats ) const;
+    };
+
+    TrackCounter audio;
+    TrackCounter video;
+
+    // gop
+    uint32_t framesInGop      = 0;
+    uint32_t lastGopLength    = 0;
+    uint64_t gopCount         = 0;
+    uint64_t gopFrames        = 0;
+    bool     hasKeyFrame      = false;
+    uint32_t lastKeyTimestamp = 0;
+    // Welford running mean and variance of key frame interval
+    uint64_t keyIntervalCount = 0;
+    double   keyIntervalMean  = 0;
+    double   keyIntervalM2    = 0;
+    // drops
+    uint64_t droppedDisposableFrames = 0;
+    uint64_t droppedGopFrames        = 0;
+    uint64_t droppedBytes            = 0;
+    uint64_t filteredNalus           = 0;
+    uint64_t filteredBytes           = 0;
+    uint64_t skippedAudioFrames      = 0;
+
+    // seqlock protected published stats, a FlvStreamStats copied word by word with relaxed atomics,
+    // so a reader racing with publish reads torn words and retries, never a data race
+    static const size_t   PublishedWords = ( sizeof( FlvStreamStats ) + 7 ) / 8;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> published[PublishedWords];
+    void                  store_published( const FlvStreamStats &stats );
+};
+
+};     // namespace nx
+
+#endif // __FLV_STATS_H__
@@ -1,5 +1,6 @@
 
 #include "flvmuxer.h"
+#include <arpa/inet.h>
 #include <cassert>
 #include <cmath>
 #include <vector>
@@ -13,16 +14,10 @@ using namespace std;
 
 namespace nx {
 
-/**
- * @brief construct metadata tag buf, with 4 bytes tag size
- *
- * @param metaData  FlvMetaData
- * @return vector<uint8_t>  tag buf
- */
-static vector<uint8_t> metadata_to_buf( FlvMetaData &metaData ) {
-    vector<uint8_t> dst_buf;
+vector<uint8_t, FlvAllocator<uint8_t>> metadata_to_buf( FlvMetaData &metaData, FlvMemoryResource *resource ) {
+    vector<uint8_t, FlvAllocator<uint8_t>> dst_buf( resource );
 
-    AMF_BUFFER elems;
+    AMF_BUFFER elems( resource );
     uint32_t   count = 0;
     {
         amf_put_named_double( "duration", metaData.duration, elems );
@@ -37,17 +32,29 @@ static vector<uint8_t> metadata_to_buf( FlvMetaData &metaData ) {
         amf_put_named_double( "audiosamplerate", metaData.audiosamplerate, elems );
         amf_put_named_bool( "stereo", metaData.stereo, elems );
         amf_put_named_double( "audiodelay", metaData.audiodelay, elems );
-        count += 4;
+        amf_put_named_double( "audiodatarate", metaData.audiodatarate, elems );
+        count += 5;
     }
 
     if ( metaData.hasVideo ) {
         amf_put_named_double( "videocodecid", metaData.videocodecid, elems );
         amf_put_named_double( "width", metaData.width, elems );
         amf_put_named_double( "height", metaData.height, elems );
-        count += 3;
+        amf_put_named_double( "videodatarate", metaData.videodatarate, elems );
+        amf_put_named_double( "framerate", metaData.framerate, elems );
+        count += 5;
+    }
+
+    if ( !metaData.keyframeTimes.empty() ) {
+        AMF_BUFFER keyframes( resource );
+        amf_put_named_double_array( "filepositions", metaData.keyframeFilePositions, keyframes );
+        amf_put_named_double_array( "times", metaData.keyframeTimes, keyframes );
+        amf_put_obj_end( keyframes );
+        amf_put_named_object( "keyframes", keyframes, elems );
+        count += 1;
     }
 
-    AMF_BUFFER amf_buf;
+    AMF_BUFFER amf_buf( resource );
     {
         amf_put_named_ecma_array( "onMetadata", count, elems, amf_buf );
     }
@@ -74,17 +81,326 @@ static vector<uint8_t> metadata_to_buf( FlvMetaData &metaData ) {
     return dst_buf;
 }
 
+/**
+ * @brief FNV-1a hash, cheap fingerprint of parameter sets.
+ */
+static uint32_t fnv1a_hash( const uint8_t *data, size_t size ) {
+    uint32_t hash = 2166136261u;
+    for ( size_t i = 0; i < size; i++ ) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief whether a sps or pps is the current one, the hashes are a fast check, the bytes are compared when they match.
+ */
+static bool same_parameter_set( const uint8_t *nalu, size_t size, uint32_t hash, const uint8_t *current, size_t currentSize, uint32_t currentHash ) {
+    return hash == currentHash && size == currentSize && !memcmp( nalu, current, size );
+}
+
+/**
+ * @brief the adts fields which make up the AudioSpecificConfig,
+ * profile, sampling_frequency_index and channel_configuration, compared as is.
+ *
+ * @param adts  adts header, 7 bytes at least
+ */
+static uint32_t aac_config_key( const uint8_t *adts ) {
+    // profile(2), sampling_frequency_index(4), skip private_bit(1), channel_configuration high bit(1)
+    // channel_configuration low bits(2)
+    return (uint32_t)( adts[2] & 0xFD ) << 8 | ( adts[3] & 0xC0 );
+}
+
+/**
+ * @brief 7 bytes, or 9 bytes with the crc when protection_absent is 0.
+ */
+static size_t adts_header_size( const uint8_t *adts ) {
+    return ( adts[1] & 0x01 ) ? 7 : 9;
+}
+
+/**
+ * @brief number of raw data blocks of an adts frame, a flv tag holds one block.
+ */
+static int adts_raw_blocks( const uint8_t *adts ) {
+    return ( adts[6] & 0x03 ) + 1;
+}
+
+/**
+ * @brief find the raw data blocks of an adts frame with crc, from its raw_data_block_position table,
+ * the crc after each block is not part of its range.
+ *
+ * @return number of blocks, 0 when the frame has no crc, so no position table, or the table is out of the frame
+ */
+static int adts_block_ranges( const uint8_t *adts, size_t frameLength, size_t offsets[4], size_t sizes[4] ) {
+    if ( adts[1] & 0x01 ) return 0;
+    int blocks = adts_raw_blocks( adts );
+    // 7 bytes header, raw_data_block_position[1 .. blocks - 1], crc_check, positions count from the first block
+    size_t first = 7 + 2 * ( blocks - 1 ) + 2;
+    size_t begin = first;
+    for ( int i = 0; i < blocks; i++ ) {
+        size_t end = i + 1 < blocks ? first + ( adts[7 + 2 * i] << 8 | adts[8 + 2 * i] ) : frameLength;
+        // a raw_data_block of one byte at least, and its crc
+        if ( end > frameLength || end < begin + 3 ) return 0;
+        offsets[i] = begin;
+        sizes[i]   = end - 2 - begin;
+        begin      = end;
+    }
+    return blocks;
+}
+
+static const size_t AacSequenceHeaderBytes = 11 + 2 + 2 + 4;
+
+/**
+ * @brief write an aac sequence header tag from the adts header, with tag size, AacSequenceHeaderBytes bytes.
+ */
+static void put_aac_sequence_header( const uint8_t *adts, uint32_t timestamp, uint8_t *buf ) {
+    const int flvTagHeaderSize        = 11;
+    const int audioTagHeaderSize      = 2;
+    const int audioSpecificConfigSize = 2;
+    uint32_t  dataSize                = audioTagHeaderSize + audioSpecificConfigSize;
+    const int TagSize                 = flvTagHeaderSize + dataSize;
+    int       offset                  = 0;
+
+    flv_tag_header tagHeader = flv_tag_header( flv_tag_header::TagType::audio, dataSize, timestamp );
+    tagHeader.to_buf( buf + offset );
+    offset += flvTagHeaderSize;
+    // AAC sequence header
+    flv_aac_audio_tag_header audioTagHeader = flv_aac_audio_tag_header( flv_aac_audio_tag_header::AACSequenceHeader );
+    audioTagHeader.to_buf( buf + offset );
+    offset += audioTagHeaderSize;
+    // AudioSpecificConfig
+    AudioSpecificConfig config = AudioSpecificConfig( (uint8_t *)adts );
+    config.to_buf( buf + offset );
+    offset += audioSpecificConfigSize;
+    // write tag size, big endian
+    uint32_t size = htonl( TagSize );
+    memcpy( buf + offset, &size, 4 );
+}
+
+static void update_audio_metadata( FlvMetaData &metaData, const uint8_t *adts ) {
+    adts_header header       = adts_header::parse_adts_header( adts );
+    metaData.audiosamplerate = adts_header::sampleRate( header );
+    metaData.stereo          = adts_header::channelCount( header ) == 2 ? 1 : 0;
+}
+
+/**
+ * @brief bytes of the aac raw tag of an adts frame, with tag size.
+ */
+static size_t aac_tag_bytes( const uint8_t *adts, size_t length ) {
+    return 11 + 2 + ( length - adts_header_size( adts ) ) + 4;
+}
+
+/**
+ * @brief write the aac raw tag of an adts frame, with tag size, aac_tag_bytes bytes.
+ */
+static void put_aac_tag( const uint8_t *adts, size_t length, uint32_t timestamp, uint8_t *dst ) {
+    const size_t flvTagHeaderSize   = 11;
+    const size_t audioTagHeaderSize = 2;
+    size_t       adtsHeaderSize     = adts_header_size( adts );
+    size_t       aacRawSize         = length - adtsHeaderSize;
+    uint32_t     size               = htonl( (uint32_t)( flvTagHeaderSize + audioTagHeaderSize + aacRawSize ) );
+    // flv tag header, audio tag header, aac raw data, tag size
+    flv_tag_header( flv_tag_header::TagType::audio, (uint32_t)( audioTagHeaderSize + aacRawSize ), timestamp ).to_buf( dst );
+    dst += flvTagHeaderSize;
+    flv_aac_audio_tag_header( flv_aac_audio_tag_header::AACRaw ).to_buf( dst );
+    dst += audioTagHeaderSize;
+    memcpy( dst, adts + adtsHeaderSize, aacRawSize );
+    dst += aacRawSize;
+    memcpy( dst, &size, 4 );
+}
+
+bool FlvNaluFilter::drops( const uint8_t *nalu, uint32_t size ) const {
+    if ( !size ) return false;
+    uint8_t naluType = nalu[0] & 0x1F;
+    if ( naluType == 9 ) return dropAud;
+    if ( naluType == 12 ) return dropFiller;
+    if ( naluType != 6 || !filterSei ) return false;
+    // a sei is kept when one of its first messages is allowed, a malformed one is removed
+    const int     maxMessages = 16;
+    AvcSeiMessage messages[maxMessages];
+    int           count = avc_parse_sei( nalu, size, messages, maxMessages );
+    for ( int i = 0; i < count; i++ ) {
+        for ( size_t j = 0; j < seiAllowList.size(); j++ ) {
+            if ( messages[i].payloadType == seiAllowList[j] ) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief remove the nal units of the filter from the end of nalus, from begin on.
+ *
+ * @param bytes  set to the output bytes of the removed nal units, with their length prefixes
+ * @return number of removed nal units
+ */
+template <typename NaluList>
+static size_t filter_nalus( const FlvNaluFilter &filter, NaluList &nalus, size_t begin, size_t &bytes ) {
+    size_t kept = begin;
+    bytes       = 0;
+    for ( size_t i = begin; i < nalus.size(); i++ ) {
+        if ( filter.drops( nalus[i].buf, nalus[i].size ) ) {
+            bytes += nalus[i].size + 4;
+            continue;
+        }
+        if ( kept != i ) nalus[kept] = std::move( nalus[i] );
+        kept += 1;
+    }
+    size_t removed = nalus.size() - kept;
+    while ( nalus.size() > kept ) {
+        nalus.pop_back();
+    }
+    return removed;
+}
+
+/**
+ * @brief classify a video frame for the drop policy.
+ *
+ * @param idr  the frame has an idr slice, a decoder can start here
+ * @param disposable  every slice has nal_ref_idc 0, no other frame references it
+ */
+template <typename Nalu>
+static void classify_video_frame( const Nalu *nalus, size_t count, bool &idr, bool &disposable ) {
+    bool slices = false;
+    idr         = false;
+    disposable  = true;
+    for ( size_t i = 0; i < count; i++ ) {
+        if ( !nalus[i].size ) continue;
+        uint8_t naluType = nalus[i].buf[0] & 0x1F;
+        if ( naluType < 1 || naluType > 5 ) continue;
+        slices = true;
+        if ( naluType == 5 ) idr = true;
+        if ( ( nalus[i].buf[0] >> 5 ) & 0x03 ) disposable = false;
+    }
+    // sps, pps or sei only, nothing to drop
+    if ( !slices ) disposable = false;
+}
+
+/**
+ * @brief bytes of the avc tag of the nalus, with tag size.
+ */
+static size_t avc_tag_bytes( const NaluRange *nalus, size_t count ) {
+    size_t bytes = 11 + 5 + 4;
+    for ( size_t i = 0; i < count; i++ ) {
+        bytes += nalus[i].size + 4;
+    }
+    return bytes;
+}
+
+/**
+ * @brief write the avc tag of the nalus, with tag size, avc_tag_bytes bytes.
+ */
+static void put_avc_tag( const NaluRange *nalus, size_t count, uint32_t pts, uint32_t dts, bool isKeyFrame, uint8_t *dst ) {
+    const size_t flvTagHeaderSize = 11;
+    const size_t avcTagHeaderSize = 5;
+    size_t       bytes            = avc_tag_bytes( nalus, count );
+    uint32_t     size             = htonl( (uint32_t)( bytes - 4 ) );
+    // flv tag header, avc tag header, length prefixed nalus, tag size
+    flv_tag_header( flv_tag_header::TagType::video, (uint32_t)( bytes - flvTagHeaderSize - 4 ), dts ).to_buf( dst );
+    dst += flvTagHeaderSize;
+    flv_avc_tag_header( isKeyFrame ? flv_avc_tag_header::AVCKeyFrame : flv_avc_tag_header::AVCInterFrame, flv_avc_tag_header::AVCNALU, pts - dts ).to_buf( dst );
+    dst += avcTagHeaderSize;
+    for ( size_t i = 0; i < count; i++ ) {
+        uint32_t length = htonl( nalus[i].size );
+        memcpy( dst, &length, 4 );
+        memcpy( dst + 4, nalus[i].buf, nalus[i].size );
+        dst += 4 + nalus[i].size;
+    }
+    memcpy( dst, &size, 4 );
+}
+
+/**
+ * @brief write an avc sequence header tag of an AVCDecoderConfigurationRecord, with tag size, record size + 20 bytes.
+ */
+template <typename Record>
+static void put_avc_sequence_header( const Record &record, uint32_t pts, uint32_t dts, uint8_t *dst ) {
+    const uint32_t flv_tag_header_size = 11;
+    const uint32_t flv_avc_header_size = 5;
+    const uint32_t dataSize            = flv_avc_header_size + (uint32_t)record.size();
+    uint32_t       size                = htonl( flv_tag_header_size + dataSize );
+
+    flv_tag_header( flv_tag_header::TagType::video, dataSize, dts ).to_buf( dst );
+    dst += flv_tag_header_size;
+    flv_avc_tag_header( flv_avc_tag_header::AVCKeyFrame, flv_avc_tag_header::AVCSequenceHeader, pts - dts ).to_buf( dst );
+    dst += flv_avc_header_size;
+    memcpy( dst, &record[0], record.size() );
+    dst += record.size();
+    memcpy( dst, &size, 4 );
+}
+
+/**
+ * @brief write an avc end of sequence tag, with tag size, AvcEndOfSequenceBytes bytes.
+ */
+static void put_avc_end_of_sequence( uint32_t timestamp, uint8_t *dst ) {
+    const uint32_t     flv_tag_header_size = 11;
+    const uint32_t     flv_avc_header_size = 5;
+    const int          dataSize            = flv_avc_header_size;
+    const int          TagSize             = flv_tag_header_size + dataSize;
+    flv_avc_tag_header avcTagHeader        = flv_avc_tag_header( flv_avc_tag_header::FrameType::AVCKeyFrame, flv_avc_tag_header::AVCPacketType::AVCEndOfSequence, 0 );
+    flv_tag_header     tagHeader           = flv_tag_header( flv_tag_header::TagType::video, dataSize, timestamp );
+    int                offset              = 0;
+    // tag header
+    tagHeader.to_buf( dst + offset );
+    offset += flv_tag_header_size;
+    // avc tag header
+    avcTagHeader.to_buf( dst + offset );
+    offset += flv_avc_header_size;
+    // write tag size, big endian
+    uint32_t size = htonl( TagSize );
+    memcpy( dst + offset, &size, 4 );
+}
+
+static const size_t AvcEndOfSequenceBytes = 11 + 5 + 4;
+// smallest filler data nal unit, length prefix, nal unit header and rbsp_trailing_bits
+static const size_t FillerNaluMinBytes = 4 + 1 + 1;
+
+/**
+ * @brief duration, file size, data rates and frame rate at the end of the stream.
+ */
+static void finish_metadata( FlvMetaData &metaData, FlvStatsCollector &stats, uint32_t audioDuration, uint32_t videoDuration, int64_t totalBytes ) {
+    metaData.duration = ceil( std::max( videoDuration, audioDuration ) / 1000 );
+    // width and height are updated with every avc sequence header
+    metaData.filesize = totalBytes;
+    // data rates and frame rate, averaged over the whole stream
+    stats.publish();
+    FlvStreamStats streamStats;
+    stats.get_stats( streamStats );
+    const FlvTrackStats &audio = streamStats.audio;
+    const FlvTrackStats &video = streamStats.video;
+    if ( audio.lastTimestamp > audio.firstTimestamp ) {
+        metaData.audiodatarate = audio.bytes * 8.0 / ( audio.lastTimestamp - audio.firstTimestamp );
+    }
+    if ( video.lastTimestamp > video.firstTimestamp ) {
+        metaData.videodatarate = video.bytes * 8.0 / ( video.lastTimestamp - video.firstTimestamp );
+        metaData.framerate     = ( video.tags - 1 ) * 1000.0 / ( video.lastTimestamp - video.firstTimestamp );
+    }
+}
+
 }; // namespace nx
 
-FlvMuxer::~FlvMuxer() {
+template <typename Sink>
+BasicFlvMuxer<Sink>::~BasicFlvMuxer() {
     endMuxing();
-    if ( sps ) delete sps;
-    if ( pps ) delete pps;
+    flv_delete( resource, sps );
+    flv_delete( resource, pps );
 }
 
-FlvMuxer::FlvMuxer( bool hasAudio, bool hasVideo, std::weak_ptr<FlvMuxerDataHandler> dataHandler ) {
+template <typename Sink>
+BasicFlvMuxer<Sink>::BasicFlvMuxer( bool hasAudio, bool hasVideo, Sink sink, FlvMemoryResource *resource )
+    : sink( std::move( sink ) ) {
 
-    this->dataHandler = std::move( dataHandler );
+    this->resource     = resource;
+    this->batchHeaders = std::vector<uint8_t, FlvAllocator<uint8_t>>( resource );
+    this->batchBuffer  = std::vector<uint8_t, FlvAllocator<uint8_t>>( resource );
+    this->frameBuffer  = std::vector<uint8_t, FlvAllocator<uint8_t>>( resource );
+    this->heldBuffer   = std::vector<uint8_t, FlvAllocator<uint8_t>>( resource );
+    this->heldTags     = std::vector<FlvBatchTag, FlvAllocator<FlvBatchTag>>( resource );
+    this->batchItems   = std::vector<BatchItem, FlvAllocator<BatchItem>>( resource );
+    this->batchTags    = std::vector<FlvBatchTag, FlvAllocator<FlvBatchTag>>( resource );
+    this->batchNalus   = NaluRangeList( resource );
+    this->streamFrames = std::vector<FlvFrame, FlvAllocator<FlvFrame>>( resource );
+    this->streamBlocks = std::vector<uint8_t, FlvAllocator<uint8_t>>( resource );
+    this->interleaver  = std::unique_ptr<FlvInterleaver, FlvDeleter<FlvInterleaver>>( nullptr, resource );
 
     assert( hasAudio || hasVideo );
     if ( !hasAudio && !hasVideo ) return;
@@ -100,162 +416,144 @@ FlvMuxer::FlvMuxer( bool hasAudio, bool hasVideo, std::weak_ptr<FlvMuxerDataHand
     uint8_t    buf[buf_size] = { 0 };
     header.to_buf( buf );
     // callback
-    if ( auto handler = this->dataHandler.lock() ) {
-        handler->onMuxedFlvHeader( handler->context, buf, buf_size );
-    }
+    this->sink.onMuxedFlvHeader( buf, buf_size );
     totalBytes += buf_size;
 
     // write metadata
     mux_metadata();
 }
 
-void FlvMuxer::mux_aac( uint8_t *adts, size_t length, uint32_t timestamp ) {
+template <typename Sink>
+void BasicFlvMuxer<Sink>::mux_aac( uint8_t *adts, size_t length, uint32_t timestamp ) {
 
     if ( !this->hasAudio ) return;
+    FLV_PROFILE_SCOPE( profiler, EndToEnd );
 
     // update timestamp
     if ( !this->audioStartTimestamp ) this->audioStartTimestamp = timestamp;
     this->lastAudioTimestamp = timestamp;
 
-    const int adtsHeaderSize     = 7;
-    const int flvTagHeaderSize   = 11;
-    const int audioTagHeaderSize = 2;
+    const size_t adtsHeaderSize = adts_header_size( adts );
 
     assert( length > adtsHeaderSize );
-    if ( !aacSequenceHeaderFlag ) {
-        const int audioSpecificConfigSize = 2;
-        uint32_t  dataSize                = audioTagHeaderSize + audioSpecificConfigSize;
-        const int TagSize                 = flvTagHeaderSize + dataSize;
-        const int buf_size                = TagSize + 4;
-        int       offset                  = 0;
-
-        uint8_t *buf = (uint8_t *)calloc( buf_size, 1 );
-        if ( !buf ) return; // no memory
-        flv_tag_header tagHeader = flv_tag_header( flv_tag_header::TagType::audio, dataSize, timestamp );
-        tagHeader.to_buf( buf + offset );
-        offset += flvTagHeaderSize;
-        // AAC sequence header
-        flv_aac_audio_tag_header audioTagHeader = flv_aac_audio_tag_header( flv_aac_audio_tag_header::AACSequenceHeader );
-        audioTagHeader.to_buf( buf + offset );
-        offset += audioTagHeaderSize;
-        // AudioSpecificConfig
-        AudioSpecificConfig config = AudioSpecificConfig( adts );
-        config.to_buf( buf + offset );
-        offset += audioSpecificConfigSize;
-        // write tag size, big endian
-        uint32_t size = htonl( TagSize );
-        memcpy( buf + offset, &size, 4 );
-        // update flag
-        aacSequenceHeaderFlag = true;
-        // callback
-        this->onMuxedData( flv_tag_header::TagType::audio, buf, buf_size, timestamp );
-        free( buf );
-
-        // update metadata
-        {
-            adts_header header       = adts_header::parse_adts_header( adts );
-            metaData.audiosamplerate = adts_header::sampleRate( header );
-            metaData.stereo          = adts_header::channelCount( header ) == 2 ? 1 : 0;
+    if ( length <= adtsHeaderSize ) return;
+    if ( adts_raw_blocks( adts ) > 1 ) {
+        stats.on_audio_skip();
+        return;
+    }
+    // write aac sequence header on first frame, or when the adts config changes
+    {
+        uint32_t config = aac_config_key( adts );
+        if ( !aacSequenceHeaderFlag || config != aacConfig ) {
+            aacConfig = config;
+            mux_aac_sequence_header( adts, timestamp );
         }
     }
-    else {
-        // write aac raw
-        const int aacRawSize = (int)length - adtsHeaderSize;
-        uint32_t  dataSize   = audioTagHeaderSize + aacRawSize;
-        const int TagSize    = flvTagHeaderSize + dataSize;
-        const int buf_size   = TagSize + 4;
-        int       offset     = 0;
-
-        uint8_t *buf = (uint8_t *)calloc( buf_size, 1 );
-        if ( !buf ) return; // no memory
-        // flv tag header
-        flv_tag_header tagHeader = flv_tag_header( flv_tag_header::TagType::audio, dataSize, timestamp );
-        tagHeader.to_buf( buf + offset );
-        offset += flvTagHeaderSize;
-        // audio tag header
-        flv_aac_audio_tag_header audioTagHeader = flv_aac_audio_tag_header( flv_aac_audio_tag_header::AACRaw );
-        audioTagHeader.to_buf( buf + offset );
-        offset += audioTagHeaderSize;
-        // aac raw data
-        memcpy( buf + offset, adts + adtsHeaderSize, aacRawSize );
-        offset += aacRawSize;
-        // tag size, big endian
-        uint32_t size = htonl( TagSize );
-        memcpy( buf + offset, &size, 4 );
-        // callback
-        this->onMuxedData( flv_tag_header::TagType::audio, buf, buf_size, timestamp );
-        free( buf );
+    // write aac raw
+    const size_t buf_size = aac_tag_bytes( adts, length );
+    uint8_t     *buf      = (uint8_t *)resource->allocate( buf_size );
+    if ( !buf ) return; // no memory
+    FLV_PROFILE_ALLOC( profiler, buf_size );
+    {
+        FLV_PROFILE_SCOPE( profiler, AssembleTag );
+        put_aac_tag( adts, length, timestamp, buf );
+        FLV_PROFILE_COPY( profiler, length - adtsHeaderSize );
     }
+    // callback
+    this->onMuxedData( flv_tag_header::TagType::audio, buf, buf_size, timestamp );
+    resource->deallocate( buf, buf_size );
+    stats.on_audio_tag( timestamp, buf_size );
 }
 
-void FlvMuxer::mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame ) {
+template <typename Sink>
+void BasicFlvMuxer<Sink>::mux_aac_sequence_header( uint8_t *adts, uint32_t timestamp ) {
+    uint8_t buf[AacSequenceHeaderBytes] = { 0 };
+    build_aac_sequence_header( adts, timestamp, buf );
+    // callback
+    this->onMuxedData( flv_tag_header::TagType::audio, buf, AacSequenceHeaderBytes, timestamp );
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::build_aac_sequence_header( uint8_t *adts, uint32_t timestamp, uint8_t *buf ) {
+    put_aac_sequence_header( adts, timestamp, buf );
+    // update flag
+    aacSequenceHeaderFlag = true;
+    // update metadata
+    update_audio_metadata( metaData, adts );
+}
+
+template <typename Sink>
+int BasicFlvMuxer<Sink>::video_drop_decision( int backpressure, bool isKeyFrame, bool disposable ) {
+    if ( isKeyFrame ) {
+        // the decoder can start again here
+        droppingGop = false;
+        return FlvBackpressureNone;
+    }
+    if ( backpressure >= FlvBackpressureDropGop ) droppingGop = true;
+    if ( droppingGop ) return FlvBackpressureDropGop;
+    if ( backpressure >= FlvBackpressureDropDisposable && disposable ) return FlvBackpressureDropDisposable;
+    return FlvBackpressureNone;
+}
+
+template <typename Sink>
+bool BasicFlvMuxer<Sink>::drop_video_frame( int backpressure, bool isKeyFrame, bool disposable, size_t bytes ) {
+    int drop = video_drop_decision( backpressure, isKeyFrame, disposable );
+    if ( drop != FlvBackpressureNone ) stats.on_video_drop( bytes, drop == FlvBackpressureDropGop );
+    return drop != FlvBackpressureNone;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame ) {
 
     if ( !this->hasVideo ) return;
+    FLV_PROFILE_SCOPE( profiler, EndToEnd );
     /*
         1. seperate buf to nalus
         2. for each nalu, extract rbsp from nalu
         3. check nalu type to get sps, pps, generate avc sequence header
         4. write avc tags
     */
-    vector<NaluBuffer> nalus;
-    split_nalus( buf, (uint32_t)length, nalus );
+    NaluBufferList nalus( resource );
+    try {
+        FLV_PROFILE_SCOPE( profiler, SplitNalus );
+        split_nalus( buf, (uint32_t)length, nalus );
+    }
+    catch ( const std::bad_alloc & ) {
+        return; // no memory
+    }
     if ( nalus.empty() ) return;
+    for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
+        if ( !it->buf ) return; // no memory
+    }
+    // frames are only dropped once the stream has started
+    if ( avcSequenceHeaderFlag ) {
+        bool idr, disposable;
+        classify_video_frame( &nalus[0], nalus.size(), idr, disposable );
+        if ( drop_video_frame( sink.onBackpressure(), isKeyFrame || idr, disposable, length ) ) return;
+    }
+    if ( naluFilterEnabled ) {
+        size_t bytes   = 0;
+        size_t removed = filter_nalus( naluFilter, nalus, 0, bytes );
+        if ( removed ) stats.on_nalus_filtered( removed, bytes );
+        if ( nalus.empty() ) return;
+    }
+#if FLV_ENABLE_PROFILING
+    // every nalu is copied to its own buffer
+    for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
+        FLV_PROFILE_ALLOC( profiler, it->size );
+        FLV_PROFILE_COPY( profiler, it->size );
+    }
+#endif
     const uint32_t flv_tag_header_size = 11;
     const uint32_t flv_avc_header_size = 5;
-    if ( !avcSequenceHeaderFlag ) {
-        // write avc sequence header
+    if ( !avcSequenceHeaderFlag || isKeyFrame ) {
+        // compare sps, pps with the current ones, only changed parameter sets are copied and parsed.
+        bool changed = false;
         for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
-            uint8_t *nalu     = it->buf;
-            uint8_t  naluType = ( *nalu ) & 0x1F;
-            if ( naluType == NaluType::SPS ) {
-                if ( !this->sps ) {
-                    assert( buf != NULL );
-                    this->sps = new NaluBuffer( it->buf, it->size );
-                }
-            }
-            else if ( naluType == NaluType::PPS ) {
-                if ( !this->pps ) {
-                    this->pps = new NaluBuffer( it->buf, it->size );
-                }
-            }
+            if ( update_parameter_set( it->buf, it->size ) ) changed = true;
         }
-        if ( this->sps && this->pps ) {
-
-            AVCDecoderConfigurationRecord avcDecoderConfigurationRecord = AVCDecoderConfigurationRecord(
-                sps->buf, sps->size,
-                pps->buf, pps->size );
-            vector<uint8_t> avc_sequence_header_buf = avcDecoderConfigurationRecord.to_buf();
-
-            flv_avc_tag_header avc_tag_header                       = flv_avc_tag_header( flv_avc_tag_header::AVCKeyFrame, flv_avc_tag_header::AVCSequenceHeader, pts - dts );
-            uint8_t            avcTagHeaderBuf[flv_avc_header_size] = { 0 };
-            avc_tag_header.to_buf( avcTagHeaderBuf );
-
-            // flv tag header
-            const uint32_t dataSize                             = flv_avc_header_size + (uint32_t)avc_sequence_header_buf.size();
-            flv_tag_header flvTagHeader                         = flv_tag_header( flv_tag_header::TagType::video, dataSize, dts );
-            uint8_t        flvTagHeaderBuf[flv_tag_header_size] = { 0 };
-            flvTagHeader.to_buf( flvTagHeaderBuf );
-
-            const uint32_t TagSize  = flv_tag_header_size + dataSize;
-            const int      buf_size = TagSize + 4;
-            uint8_t       *buf      = (uint8_t *)calloc( buf_size, 1 );
-            if ( !buf ) return; // no memory
-
-            int offset = 0;
-            memcpy( buf + offset, flvTagHeaderBuf, flv_tag_header_size );
-            offset += flv_tag_header_size;
-            memcpy( buf + offset, avcTagHeaderBuf, flv_avc_header_size );
-            offset += flv_avc_header_size;
-            memcpy( buf + offset, &avc_sequence_header_buf[0], avc_sequence_header_buf.size() );
-            offset += avc_sequence_header_buf.size();
-            // write tag size, big endian
-            uint32_t size = htonl( TagSize );
-            memcpy( buf + offset, &size, 4 );
-            // update flag
-            avcSequenceHeaderFlag = true;
-            // callback
-            this->onMuxedData( flv_tag_header::TagType::video, buf, buf_size, dts );
-            free( buf );
+        if ( ( changed || !avcSequenceHeaderFlag ) && this->sps && this->pps ) {
+            mux_avc_sequence_header( pts, dts );
         }
     }
 
@@ -266,8 +564,7 @@ void FlvMuxer::mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts,
 
     {
         // write nalu,annex-b to mp4
-        vector<uint8_t> mp4_nulus;
-        uint32_t        frameSize = 0;
+        uint32_t frameSize = 0;
         for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
             frameSize += it->size + 4;
         }
@@ -276,113 +573,865 @@ void FlvMuxer::mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts,
         const uint32_t dataSize = flv_avc_header_size + frameSize;
         const uint32_t TagSize  = flv_tag_header_size + dataSize;
         const int      buf_size = TagSize + 4;
-        uint8_t       *buf      = (uint8_t *)calloc( buf_size, 1 );
+        uint8_t       *buf      = (uint8_t *)resource->allocate( buf_size );
         if ( !buf ) return; // no memory
+        FLV_PROFILE_ALLOC( profiler, buf_size );
+        {
+            FLV_PROFILE_SCOPE( profiler, AssembleTag );
+            int            offset                               = 0;
+            flv_tag_header flvTagHeader                         = flv_tag_header( flv_tag_header::TagType::video, dataSize, dts );
+            uint8_t        flvTagHeaderBuf[flv_tag_header_size] = { 0 };
+            flvTagHeader.to_buf( flvTagHeaderBuf );
 
-        int            offset                               = 0;
-        flv_tag_header flvTagHeader                         = flv_tag_header( flv_tag_header::TagType::video, dataSize, dts );
-        uint8_t        flvTagHeaderBuf[flv_tag_header_size] = { 0 };
-        flvTagHeader.to_buf( flvTagHeaderBuf );
-
-        memcpy( buf + offset, flvTagHeaderBuf, flv_tag_header_size );
-        offset += flv_tag_header_size;
+            memcpy( buf + offset, flvTagHeaderBuf, flv_tag_header_size );
+            offset += flv_tag_header_size;
 
-        // avc tag header
-        flv_avc_tag_header avc_tag_header                       = flv_avc_tag_header( isKeyFrame ? flv_avc_tag_header::AVCKeyFrame : flv_avc_tag_header::AVCInterFrame, flv_avc_tag_header::AVCNALU, pts - dts );
-        uint8_t            avcTagHeaderBuf[flv_avc_header_size] = { 0 };
-        avc_tag_header.to_buf( avcTagHeaderBuf );
+            // avc tag header
+            flv_avc_tag_header avc_tag_header                       = flv_avc_tag_header( isKeyFrame ? flv_avc_tag_header::AVCKeyFrame : flv_avc_tag_header::AVCInterFrame, flv_avc_tag_header::AVCNALU, pts - dts );
+            uint8_t            avcTagHeaderBuf[flv_avc_header_size] = { 0 };
+            avc_tag_header.to_buf( avcTagHeaderBuf );
 
-        memcpy( buf + offset, avcTagHeaderBuf, flv_avc_header_size );
-        offset += flv_avc_header_size;
+            memcpy( buf + offset, avcTagHeaderBuf, flv_avc_header_size );
+            offset += flv_avc_header_size;
 
-        // mp4 format nalus
-        for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
-            uint32_t size = htonl( it->size );
+            // mp4 format nalus
+            for ( auto it = nalus.begin(); it != nalus.end(); it++ ) {
+                uint32_t size = htonl( it->size );
+                memcpy( buf + offset, &size, 4 );
+                offset += 4;
+                memcpy( buf + offset, it->buf, it->size );
+                offset += it->size;
+            }
+            FLV_PROFILE_COPY( profiler, frameSize );
+            // write tag size, big endian
+            uint32_t size = htonl( TagSize );
             memcpy( buf + offset, &size, 4 );
-            offset += 4;
-            memcpy( buf + offset, it->buf, it->size );
-            offset += it->size;
         }
-        // write tag size, big endian
-        uint32_t size = htonl( TagSize );
-        memcpy( buf + offset, &size, 4 );
         // callback
         this->onMuxedData( flv_tag_header::TagType::video, buf, buf_size, dts );
-        free( buf );
+        resource->deallocate( buf, buf_size );
+        stats.on_video_tag( dts, buf_size, isKeyFrame );
+    }
+}
+
+template <typename Sink>
+bool BasicFlvMuxer<Sink>::update_parameter_set( const uint8_t *nalu, uint32_t size ) {
+    uint8_t      naluType = nalu[0] & 0x1F;
+    NaluBuffer **current  = nullptr;
+    uint32_t    *hash     = nullptr;
+    if ( naluType == NaluType::SPS ) {
+        current = &this->sps;
+        hash    = &this->spsHash;
+    }
+    else if ( naluType == NaluType::PPS ) {
+        current = &this->pps;
+        hash    = &this->ppsHash;
+    }
+    else {
+        return false;
+    }
+    uint32_t naluHash = fnv1a_hash( nalu, size );
+    if ( *current && ( *current )->buf && same_parameter_set( nalu, size, naluHash, ( *current )->buf, ( *current )->size, *hash ) ) return false;
+    // null when there is no memory, the next one is copied again
+    flv_delete( resource, *current );
+    *current = flv_new<NaluBuffer>( resource, nalu, size, resource );
+    *hash    = naluHash;
+    return true;
+}
+
+template <typename Sink>
+int BasicFlvMuxer<Sink>::begin_video_frame( uint32_t pts, uint32_t dts, bool isKeyFrame, size_t sizeHint ) {
+    if ( !this->hasVideo ) return -1;
+    if ( openFrame.open ) end_video_frame();
+    openFrame            = OpenFrame();
+    openFrame.open       = true;
+    openFrame.pts        = pts;
+    openFrame.dts        = dts;
+    openFrame.isKeyFrame = isKeyFrame;
+    openFrame.sizeHint   = sizeHint;
+    // room for the flv tag header and the avc tag header
+    frameBuffer.clear();
+    try {
+        frameBuffer.resize( 11 + 5 );
+    }
+    catch ( const std::bad_alloc & ) {
+        openFrame.dropped = true; // no memory
+    }
+    return 0;
+}
+
+template <typename Sink>
+int BasicFlvMuxer<Sink>::add_nalu( const uint8_t *nalu, size_t length ) {
+    if ( !openFrame.open ) return -1;
+    // skip a start code
+    if ( length >= 3 && !nalu[0] && !nalu[1] ) {
+        size_t startCode = nalu[2] == 1 ? 3 : length >= 4 && !nalu[2] && nalu[3] == 1 ? 4 : 0;
+        nalu += startCode;
+        length -= startCode;
+    }
+    if ( !length ) return 0;
+    openFrame.inputBytes += length;
+    if ( openFrame.dropped ) return 0;
+    if ( naluFilterEnabled && naluFilter.drops( nalu, (uint32_t)length ) ) {
+        stats.on_nalus_filtered( 1, length + 4 );
+        return 0;
+    }
+    if ( !openFrame.started ) {
+        uint8_t naluType = nalu[0] & 0x1F;
+        if ( naluType < 1 || naluType > 5 ) {
+            // parameter sets and sei are kept until the first slice, which decides on the sequence header
+            if ( !avcSequenceHeaderFlag || openFrame.isKeyFrame ) {
+                if ( update_parameter_set( nalu, (uint32_t)length ) ) openFrame.parameterSetsChanged = true;
+            }
+            return write_frame_nalu( nalu, length );
+        }
+        // all the slices of a picture have the same nal_ref_idc
+        start_video_tag( naluType == 5, !( ( nalu[0] >> 5 ) & 0x03 ) );
+        if ( openFrame.dropped ) return 0;
+    }
+    return write_frame_nalu( nalu, length );
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::start_video_tag( bool idr, bool disposable ) {
+    // as mux_avc, the drop policy once the stream has started, then the sequence header
+    openFrame.started = true;
+    if ( avcSequenceHeaderFlag ) {
+        openFrame.dropKind = video_drop_decision( sink.onBackpressure(), openFrame.isKeyFrame || idr, disposable );
+        if ( openFrame.dropKind != FlvBackpressureNone ) {
+            openFrame.dropped = true;
+            return;
+        }
+    }
+    if ( ( !avcSequenceHeaderFlag || openFrame.isKeyFrame ) && ( openFrame.parameterSetsChanged || !avcSequenceHeaderFlag ) && this->sps && this->pps ) {
+        mux_avc_sequence_header( openFrame.pts, openFrame.dts );
+    }
+    if ( !avcSequenceHeaderFlag ) {
+        openFrame.dropped = true;
+        return;
+    }
+    if ( !this->videoStartTimestamp ) this->videoStartTimestamp = openFrame.dts;
+    this->lastVideoTimestamp = openFrame.dts;
+
+    // the nal units before the first slice must leave room for a slice, or for the filler of a broken frame,
+    // in the announced size of an append only sink
+    int mode            = interleaver ? FlvSinkStreamingNone : sink.onStreamingSupport();
+    openFrame.seekable  = mode == FlvSinkStreamingSeekable;
+    openFrame.streaming = openFrame.seekable || ( mode == FlvSinkStreamingAppend && openFrame.nalusBytes + FillerNaluMinBytes <= openFrame.sizeHint );
+
+    uint32_t dataSize = openFrame.streaming ? (uint32_t)( 5 + openFrame.sizeHint ) : 0;
+    flv_tag_header( flv_tag_header::TagType::video, dataSize, openFrame.dts ).to_buf( &frameBuffer[0] );
+    flv_avc_tag_header( openFrame.isKeyFrame ? flv_avc_tag_header::AVCKeyFrame : flv_avc_tag_header::AVCInterFrame, flv_avc_tag_header::AVCNALU, openFrame.pts - openFrame.dts ).to_buf( &frameBuffer[11] );
+    if ( openFrame.streaming ) {
+        // the tag header and the nal units so far
+        openFrame.tagOffset = totalBytes;
+        write_tag_part( &frameBuffer[0], frameBuffer.size(), false );
+        frameBuffer.clear();
+    }
+}
+
+template <typename Sink>
+int BasicFlvMuxer<Sink>::write_frame_nalu( const uint8_t *nalu, size_t length ) {
+    uint32_t size = htonl( (uint32_t)length );
+    if ( openFrame.broken ) return -1;
+    if ( openFrame.started && openFrame.streaming ) {
+        // the rest of the announced size is padded with a filler nal unit
+        size_t nalusBytes = openFrame.nalusBytes + 4 + length;
+        if ( !openFrame.seekable && ( nalusBytes > openFrame.sizeHint || ( nalusBytes < openFrame.sizeHint && nalusBytes + FillerNaluMinBytes > openFrame.sizeHint ) ) ) {
+            openFrame.broken = true;
+            return -1;
+        }
+        write_tag_part( (const uint8_t *)&size, 4, false );
+        write_tag_part( nalu, length, false );
+    }
+    else {
+        try {
+            frameBuffer.insert( frameBuffer.end(), (const uint8_t *)&size, (const uint8_t *)&size + 4 );
+            frameBuffer.insert( frameBuffer.end(), nalu, nalu + length );
+        }
+        catch ( const std::bad_alloc & ) {
+            openFrame.dropped = true; // no memory
+            return -1;
+        }
+    }
+    openFrame.nalusBytes += 4 + length;
+    return 0;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::write_tag_part( const uint8_t *data, size_t bytes, bool last ) {
+    FLV_PROFILE_SCOPE( profiler, Handler );
+    sink.onMuxedDataPart( flv_tag_header::TagType::video, data, bytes, openFrame.dts, last );
+    totalBytes += bytes;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::finish_streamed_tag() {
+    if ( !openFrame.seekable && openFrame.nalusBytes < openFrame.sizeHint ) {
+        // up to the announced size with a filler data nal unit, ff bytes and the rbsp stop bit,
+        // write_frame_nalu leaves FillerNaluMinBytes at least
+        size_t padding = openFrame.sizeHint - openFrame.nalusBytes;
+        assert( padding >= FillerNaluMinBytes );
+        uint8_t  head[5] = { 0, 0, 0, 0, 12 };
+        uint32_t size    = htonl( (uint32_t)( padding - 4 ) );
+        memcpy( head, &size, 4 );
+        write_tag_part( head, sizeof( head ), false );
+        uint8_t ff[256];
+        memset( ff, 0xFF, sizeof( ff ) );
+        for ( size_t left = padding - FillerNaluMinBytes; left; ) {
+            size_t n = left < sizeof( ff ) ? left : sizeof( ff );
+            write_tag_part( ff, n, false );
+            left -= n;
+        }
+        uint8_t stop = 0x80;
+        write_tag_part( &stop, 1, false );
+        openFrame.nalusBytes += padding;
     }
+    uint32_t dataSize = (uint32_t)( 5 + openFrame.nalusBytes );
+    uint32_t tagSize  = htonl( 11 + dataSize );
+    write_tag_part( (const uint8_t *)&tagSize, 4, true );
+    if ( openFrame.seekable && openFrame.nalusBytes != openFrame.sizeHint ) {
+        uint8_t patch[3] = { (uint8_t)( dataSize >> 16 ), (uint8_t)( dataSize >> 8 ), (uint8_t)dataSize };
+        sink.onUpdateMuxedData( (size_t)openFrame.tagOffset + 1, patch, sizeof( patch ) );
+    }
+    stats.on_video_tag( openFrame.dts, 11 + dataSize + 4, openFrame.isKeyFrame );
 }
 
-void FlvMuxer::onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+template <typename Sink>
+int BasicFlvMuxer<Sink>::end_video_frame() {
+    if ( !openFrame.open ) return -1;
+    int result = 0;
+    // a frame without slice, e.g. sei only
+    if ( !openFrame.started && !openFrame.dropped && openFrame.nalusBytes ) start_video_tag( false, false );
+    if ( openFrame.dropped ) {
+        if ( openFrame.dropKind != FlvBackpressureNone ) stats.on_video_drop( openFrame.inputBytes, openFrame.dropKind == FlvBackpressureDropGop );
+    }
+    else if ( openFrame.started && openFrame.streaming ) {
+        finish_streamed_tag();
+        if ( openFrame.broken ) {
+            // the next frames may reference the missing slice, wait for a key frame
+            droppingGop = true;
+            result      = -1;
+        }
+    }
+    else if ( openFrame.started ) {
+        // the whole tag, its sizes are known now
+        uint32_t dataSize = (uint32_t)( 5 + openFrame.nalusBytes );
+        uint32_t tagSize  = htonl( 11 + dataSize );
+        try {
+            frameBuffer.insert( frameBuffer.end(), (const uint8_t *)&tagSize, (const uint8_t *)&tagSize + 4 );
+        }
+        catch ( const std::bad_alloc & ) {
+            result = -1; // no memory
+        }
+        if ( !result ) {
+            flv_tag_header( flv_tag_header::TagType::video, dataSize, openFrame.dts ).to_buf( &frameBuffer[0] );
+            this->onMuxedData( flv_tag_header::TagType::video, &frameBuffer[0], frameBuffer.size(), openFrame.dts );
+            stats.on_video_tag( openFrame.dts, frameBuffer.size(), openFrame.isKeyFrame );
+        }
+    }
+    openFrame.open = false;
+    frameBuffer.clear();
+    // the tags muxed meanwhile
+    for ( size_t i = 0; i < heldTags.size(); i++ ) {
+        const FlvBatchTag &tag = heldTags[i];
+        this->onMuxedData( tag.type, &heldBuffer[tag.offset], tag.bytes, tag.timestamp );
+    }
+    heldTags.clear();
+    heldBuffer.clear();
+    return result;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::mux_avc_sequence_header( uint32_t pts, uint32_t dts ) {
+    std::vector<uint8_t, FlvAllocator<uint8_t>> buf( resource );
+    try {
+        if ( !build_avc_sequence_header( pts, dts, buf ) ) return;
+    }
+    catch ( const std::bad_alloc & ) {
+        return; // no memory
+    }
     // callback
-    if ( auto handler = this->dataHandler.lock() ) {
-        handler->onMuxedData( handler->context, type, data, bytes, timestamp );
+    this->onMuxedData( flv_tag_header::TagType::video, &buf[0], buf.size(), dts );
+}
+
+template <typename Sink>
+bool BasicFlvMuxer<Sink>::build_avc_sequence_header( uint32_t pts, uint32_t dts, std::vector<uint8_t, FlvAllocator<uint8_t>> &tag ) {
+    const uint32_t flv_tag_header_size = 11;
+    const uint32_t flv_avc_header_size = 5;
+    if ( !sps->buf || !pps->buf ) return false;
+
+    // sps is parsed only here, once per parameter set change
+    vector<uint8_t> avc_sequence_header_buf;
+    {
+        FLV_PROFILE_SCOPE( profiler, ParseSps );
+        H264SPS h264sps;
+        if ( avc_decode_sps( &h264sps, sps->buf, sps->size ) < 0 ) return false;
+        {
+            uint32_t width  = 0;
+            uint32_t height = 0;
+            h264sps.get_resolution( width, height );
+            metaData.width  = width;
+            metaData.height = height;
+        }
+
+        AVCDecoderConfigurationRecord avcDecoderConfigurationRecord = AVCDecoderConfigurationRecord(
+            h264sps,
+            sps->buf, sps->size,
+            pps->buf, pps->size );
+        avc_sequence_header_buf = avcDecoderConfigurationRecord.to_buf();
     }
+
+    // flv tag header, avc tag header, AVCDecoderConfigurationRecord, tag size
+    size_t offset = tag.size();
+    tag.resize( offset + flv_tag_header_size + flv_avc_header_size + avc_sequence_header_buf.size() + 4 );
+    put_avc_sequence_header( avc_sequence_header_buf, pts, dts, &tag[offset] );
+    // update flag
+    avcSequenceHeaderFlag = true;
+    return true;
+}
+
+template <typename Sink>
+int BasicFlvMuxer<Sink>::mux_batch( const FlvFrame *frames, size_t count ) {
+    FLV_PROFILE_SCOPE( profiler, EndToEnd );
+    batchItems.clear();
+    batchTags.clear();
+    batchNalus.clear();
+    batchHeaders.clear();
+    // sequence headers planned in this batch, written again by the next frames if the batch fails
+    bool   audioHeader = false;
+    bool   videoHeader = false;
+    size_t total       = 0;
+    // polled once, the frames of a batch are queued together
+    int backpressure = hasVideo ? sink.onBackpressure() : FlvBackpressureNone;
+    try {
+        // first pass, the tags of each frame and their sizes, sequence headers are built here
+        for ( size_t i = 0; i < count; i++ ) {
+            const FlvFrame &frame = frames[i];
+            if ( frame.type == flv_tag_header::TagType::audio ) {
+                if ( !hasAudio || frame.length < 7 || frame.length <= adts_header_size( frame.data ) ) continue;
+                if ( adts_raw_blocks( frame.data ) > 1 ) {
+                    stats.on_audio_skip();
+                    continue;
+                }
+                uint32_t config = aac_config_key( frame.data );
+                if ( !aacSequenceHeaderFlag || config != aacConfig ) {
+                    aacConfig             = config;
+                    aacSequenceHeaderFlag = true;
+                    audioHeader           = true;
+                    batchItems.push_back( { &frame, true, 0, 0, 0 } );
+                    batchTags.push_back( { frame.type, total, AacSequenceHeaderBytes, frame.pts } );
+                    total += AacSequenceHeaderBytes;
+                }
+                size_t bytes = aac_tag_bytes( frame.data, frame.length );
+                batchItems.push_back( { &frame, false, 0, 0, 0 } );
+                batchTags.push_back( { frame.type, total, bytes, frame.pts } );
+                total += bytes;
+            }
+            else if ( frame.type == flv_tag_header::TagType::video ) {
+                if ( !hasVideo ) continue;
+                size_t nalusBegin = batchNalus.size();
+                find_nalus( frame.data, (uint32_t)frame.length, batchNalus );
+                size_t nalusEnd = batchNalus.size();
+                if ( nalusBegin == nalusEnd ) continue;
+                if ( avcSequenceHeaderFlag ) {
+                    bool idr, disposable;
+                    classify_video_frame( &batchNalus[nalusBegin], nalusEnd - nalusBegin, idr, disposable );
+                    if ( drop_video_frame( backpressure, frame.isKeyFrame || idr, disposable, frame.length ) ) {
+                        batchNalus.resize( nalusBegin );
+                        continue;
+                    }
+                }
+                if ( naluFilterEnabled ) {
+                    size_t bytes   = 0;
+                    size_t removed = filter_nalus( naluFilter, batchNalus, nalusBegin, bytes );
+                    if ( removed ) stats.on_nalus_filtered( removed, bytes );
+                    nalusEnd = batchNalus.size();
+                    if ( nalusBegin == nalusEnd ) continue;
+                }
+                if ( !avcSequenceHeaderFlag || frame.isKeyFrame ) {
+                    bool changed = false;
+                    for ( size_t j = nalusBegin; j < nalusEnd; j++ ) {
+                        if ( update_parameter_set( batchNalus[j].buf, batchNalus[j].size ) ) changed = true;
+                    }
+                    size_t headerOffset = batchHeaders.size();
+                    if ( ( changed || !avcSequenceHeaderFlag ) && this->sps && this->pps && build_avc_sequence_header( frame.pts, frame.dts, batchHeaders ) ) {
+                        size_t bytes = batchHeaders.size() - headerOffset;
+                        videoHeader  = true;
+                        batchItems.push_back( { &frame, true, 0, 0, headerOffset } );
+                        batchTags.push_back( { frame.type, total, bytes, frame.dts } );
+                        total += bytes;
+                    }
+                }
+                if ( !avcSequenceHeaderFlag ) continue;
+                size_t bytes = avc_tag_bytes( &batchNalus[nalusBegin], nalusEnd - nalusBegin );
+                batchItems.push_back( { &frame, false, nalusBegin, nalusEnd, 0 } );
+                batchTags.push_back( { frame.type, total, bytes, frame.dts } );
+                total += bytes;
+            }
+        }
+        if ( batchBuffer.size() < total ) {
+            FLV_PROFILE_ALLOC( profiler, total );
+            batchBuffer.resize( total );
+        }
+    }
+    catch ( const std::bad_alloc & ) {
+        // no memory
+        if ( audioHeader ) aacSequenceHeaderFlag = false;
+        if ( videoHeader ) avcSequenceHeaderFlag = false;
+        return -1;
+    }
+    if ( !total ) return 0;
+
+    // second pass, serialize the tags back to back
+    uint8_t *buf = &batchBuffer[0];
+    {
+        FLV_PROFILE_SCOPE( profiler, AssembleTag );
+        for ( size_t i = 0; i < batchItems.size(); i++ ) {
+            const BatchItem   &item  = batchItems[i];
+            const FlvBatchTag &tag   = batchTags[i];
+            const FlvFrame    &frame = *item.frame;
+            uint8_t           *dst   = buf + tag.offset;
+            if ( tag.type == flv_tag_header::TagType::audio ) {
+                if ( item.sequenceHeader ) {
+                    build_aac_sequence_header( frame.data, frame.pts, dst );
+                    continue;
+                }
+                if ( !this->audioStartTimestamp ) this->audioStartTimestamp = frame.pts;
+                this->lastAudioTimestamp = frame.pts;
+                put_aac_tag( frame.data, frame.length, frame.pts, dst );
+                FLV_PROFILE_COPY( profiler, tag.bytes );
+                stats.on_audio_tag( frame.pts, tag.bytes );
+            }
+            else {
+                if ( item.sequenceHeader ) {
+                    memcpy( dst, &batchHeaders[item.headerOffset], tag.bytes );
+                    continue;
+                }
+                if ( !this->videoStartTimestamp ) this->videoStartTimestamp = frame.dts;
+                this->lastVideoTimestamp = frame.dts;
+                put_avc_tag( &batchNalus[item.nalusBegin], item.nalusEnd - item.nalusBegin, frame.pts, frame.dts, frame.isKeyFrame, dst );
+                FLV_PROFILE_COPY( profiler, tag.bytes );
+                stats.on_video_tag( frame.dts, tag.bytes, frame.isKeyFrame );
+            }
+        }
+    }
+
+    // the interleaver takes the tags one by one, and they are held while a tag is being streamed
+    if ( interleaver || streaming_tag() ) {
+        for ( size_t i = 0; i < batchTags.size(); i++ ) {
+            const FlvBatchTag &tag = batchTags[i];
+            this->onMuxedData( tag.type, buf + tag.offset, tag.bytes, tag.timestamp );
+        }
+        return 0;
+    }
+    {
+        FLV_PROFILE_SCOPE( profiler, Handler );
+        sink.onMuxedBatch( buf, total, &batchTags[0], batchTags.size() );
+    }
+    totalBytes += total;
+    return 0;
+}
+
+template <typename Sink>
+int64_t BasicFlvMuxer<Sink>::mux_aac_stream( uint8_t *buf, size_t length, uint32_t startTimestamp, uint32_t *nextTimestamp ) {
+    const size_t adtsHeaderSize = 7;
+    const int    maxRateIndex   = 11; // 8000 Hz, the last rate of adts_header::sampleRate
+
+    // timestamp = base + samples * 1000 / sampleRate, base moves when the sample rate changes
+    size_t   offset     = 0;
+    uint32_t sampleRate = 0;
+    uint32_t base       = startTimestamp;
+    uint64_t samples    = 0;
+    // frames without crc of several raw data blocks, counted once the call succeeds
+    size_t skipped = 0;
+    if ( streamStarted && startTimestamp == streamNextTimestamp ) {
+        // continues the previous call, keep counting samples so the timestamps do not drift by rounding
+        sampleRate = streamSampleRate;
+        base       = streamBase;
+        samples    = streamSamples;
+    }
+    streamFrames.clear();
+    streamBlocks.clear();
+    while ( offset + adtsHeaderSize <= length ) {
+        uint8_t *adts = buf + offset;
+        // syncword and layer 0, otherwise look for the next syncword
+        if ( adts[0] != 0xFF || ( adts[1] & 0xF6 ) != 0xF0 ) {
+            offset += 1;
+            continue;
+        }
+        adts_header header      = adts_header::parse_adts_header( adts );
+        size_t      frameLength = header.variable_header.aac_frame_length;
+        if ( header.fixed_header.sampling_frequency_index > maxRateIndex || frameLength <= adts_header_size( adts ) ) {
+            offset += 1;
+            continue;
+        }
+        // a partial frame is left to the next call
+        if ( offset + frameLength > length ) break;
+
+        uint32_t rate = adts_header::sampleRate( header );
+        if ( rate != sampleRate ) {
+            if ( sampleRate ) base += (uint32_t)( samples * 1000 / sampleRate );
+            sampleRate = rate;
+            samples    = 0;
+        }
+        int    blocks = adts_raw_blocks( adts );
+        size_t blockOffsets[4];
+        size_t blockSizes[4];
+        if ( blocks > 1 && adts_block_ranges( adts, frameLength, blockOffsets, blockSizes ) != blocks ) {
+            // without crc the blocks can only be found by decoding them
+            skipped += 1;
+            samples += 1024 * blocks;
+            offset += frameLength;
+            continue;
+        }
+        size_t framesBefore = streamFrames.size();
+        size_t blocksBefore = streamBlocks.size();
+        try {
+            if ( blocks == 1 ) {
+                uint32_t timestamp = base + (uint32_t)( samples * 1000 / sampleRate );
+                streamFrames.push_back( { flv_tag_header::TagType::audio, adts, frameLength, timestamp, timestamp, false } );
+            }
+            for ( int i = 0; blocks > 1 && i < blocks; i++ ) {
+                // one adts frame of 7 bytes header per block, data is set once streamBlocks stops growing
+                uint32_t    timestamp   = base + (uint32_t)( ( samples + 1024 * i ) * 1000 / sampleRate );
+                adts_header blockHeader = header;
+                blockHeader.fixed_header.protection_absent                     = 1;
+                blockHeader.variable_header.aac_frame_length                   = (uint16_t)( 7 + blockSizes[i] );
+                blockHeader.variable_header.number_of_raw_data_blocks_in_frame = 0;
+                streamBlocks.resize( streamBlocks.size() + 7 );
+                adts_header::adts_header_to_buf( blockHeader, &streamBlocks[streamBlocks.size() - 7] );
+                streamBlocks.insert( streamBlocks.end(), adts + blockOffsets[i], adts + blockOffsets[i] + blockSizes[i] );
+                streamFrames.push_back( { flv_tag_header::TagType::audio, nullptr, 7 + blockSizes[i], timestamp, timestamp, false } );
+            }
+        }
+        catch ( const std::bad_alloc & ) {
+            // no memory, the frames so far are muxed, the rest is left to the next call
+            streamFrames.resize( framesBefore );
+            streamBlocks.resize( blocksBefore );
+            break;
+        }
+        samples += 1024 * blocks;
+        offset += frameLength;
+    }
+    size_t blockOffset = 0;
+    for ( size_t i = 0; i < streamFrames.size(); i++ ) {
+        if ( streamFrames[i].data ) continue;
+        streamFrames[i].data = &streamBlocks[blockOffset];
+        blockOffset += streamFrames[i].length;
+    }
+    if ( !streamFrames.empty() && mux_batch( &streamFrames[0], streamFrames.size() ) < 0 ) return -1;
+
+    for ( size_t i = 0; i < skipped; i++ ) {
+        stats.on_audio_skip();
+    }
+    streamStarted       = true;
+    streamSampleRate    = sampleRate;
+    streamBase          = base;
+    streamSamples       = samples;
+    streamNextTimestamp = sampleRate ? base + (uint32_t)( samples * 1000 / sampleRate ) : startTimestamp;
+    if ( nextTimestamp ) *nextTimestamp = streamNextTimestamp;
+    return (int64_t)offset;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+    if ( streaming_tag() ) {
+        // after the tag being streamed
+        try {
+            heldTags.push_back( { type, heldBuffer.size(), bytes, timestamp } );
+            heldBuffer.insert( heldBuffer.end(), data, data + bytes );
+        }
+        catch ( const std::bad_alloc & ) {
+            heldTags.resize( heldTags.size() - 1 );
+        }
+        return;
+    }
+    if ( interleaver && type != flv_tag_header::TagType::script_data ) {
+        try {
+            interleaver->push( type, data, bytes, timestamp );
+        }
+        catch ( const std::bad_alloc & ) {
+            return; // no memory, the tag is dropped
+        }
+        drainInterleaver( false );
+        return;
+    }
+    writeMuxedData( type, data, bytes, timestamp );
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::writeMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+    // callback
+    FLV_PROFILE_SCOPE( profiler, Handler );
+    sink.onMuxedData( type, data, bytes, timestamp );
     totalBytes += bytes;
 }
 
-void FlvMuxer::onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {
-    if ( auto handler = this->dataHandler.lock() ) {
-        handler->onUpdateMuxedData( handler->context, offsetFromStart, data, bytes );
+template <typename Sink>
+void BasicFlvMuxer<Sink>::drainInterleaver( bool flush ) {
+    FlvInterleaver::Tag tag;
+    while ( interleaver->pop( tag, flush ) ) {
+        writeMuxedData( tag.type, &tag.data[0], tag.data.size(), tag.timestamp );
     }
 }
 
-void FlvMuxer::mux_metadata() {
-    vector<uint8_t> buf = metadata_to_buf( metaData );
+template <typename Sink>
+void BasicFlvMuxer<Sink>::set_interleaving( bool enable, uint32_t maxLatencyMs ) {
+    if ( interleaver ) {
+        drainInterleaver( true );
+        interleaver.reset();
+    }
+    if ( enable ) {
+        // null when there is no memory, interleaving stays disabled
+        interleaver.reset( flv_new<FlvInterleaver>( resource, hasAudio, hasVideo, maxLatencyMs, 1024, resource ) );
+    }
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::get_interleaver_stats( FlvInterleaverStats &stats ) const {
+    if ( interleaver ) {
+        interleaver->get_stats( stats );
+    }
+    else {
+        stats = FlvInterleaverStats();
+    }
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::set_nalu_filter( bool enable, const FlvNaluFilter &filter ) {
+    naluFilterEnabled = enable;
+    naluFilter        = filter;
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {
+    sink.onUpdateMuxedData( offsetFromStart, data, bytes );
+}
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::mux_metadata() {
+    vector<uint8_t, FlvAllocator<uint8_t>> buf( resource );
+    try {
+        buf = metadata_to_buf( metaData, resource );
+    }
+    catch ( const std::bad_alloc & ) {
+        return; // no memory
+    }
     // callback
     this->onMuxedData( flv_tag_header::TagType::script_data, &buf[0], buf.size(), 0 );
 }
 
-void FlvMuxer::endMuxing() {
+template <typename Sink>
+void BasicFlvMuxer<Sink>::get_stats( FlvStreamStats &stats ) const {
+    this->stats.get_stats( stats );
+}
+
+#if FLV_ENABLE_PROFILING
+template <typename Sink>
+const FlvProfiler &BasicFlvMuxer<Sink>::get_profiler() const {
+    return profiler;
+}
+#endif
+
+template <typename Sink>
+void BasicFlvMuxer<Sink>::endMuxing() {
+    if ( openFrame.open ) end_video_frame();
+    // write held tags before eos, and stop interleaving
+    if ( interleaver ) {
+        drainInterleaver( true );
+        interleaver.reset();
+    }
     // write eos
     if ( this->hasVideo ) {
-        const uint32_t     flv_tag_header_size = 11;
-        const uint32_t     flv_avc_header_size = 5;
-        const int          dataSize            = flv_avc_header_size;
-        const int          TagSize             = flv_tag_header_size + dataSize;
-        flv_avc_tag_header avcTagHeader        = flv_avc_tag_header( flv_avc_tag_header::FrameType::AVCKeyFrame, flv_avc_tag_header::AVCPacketType::AVCEndOfSequence, 0 );
-        flv_tag_header     tagHeader           = flv_tag_header( flv_tag_header::TagType::video, dataSize, this->lastVideoTimestamp );
-
-        const int buf_size = TagSize + 4;
-        uint8_t  *buf      = (uint8_t *)calloc( buf_size, 1 );
-        int       offset   = 0;
-        // tag header
-        tagHeader.to_buf( buf + offset );
-        offset += flv_tag_header_size;
-        // avc tag header
-        avcTagHeader.to_buf( buf + offset );
-        offset += flv_avc_header_size;
-        // write tag size, big endian
-        uint32_t size = htonl( TagSize );
-        memcpy( buf + offset, &size, 4 );
+        // small enough for the stack
+        uint8_t buf[AvcEndOfSequenceBytes] = { 0 };
+        put_avc_end_of_sequence( this->lastVideoTimestamp, buf );
         // callback
-        this->onMuxedData( flv_tag_header::TagType::video, buf, buf_size, 0 );
-        free( buf );
+        this->onMuxedData( flv_tag_header::TagType::video, buf, AvcEndOfSequenceBytes, this->lastVideoTimestamp );
     }
     // update meta data
     {
-        {
-            uint32_t videoDuration = lastVideoTimestamp - videoStartTimestamp;
-            uint32_t audioDuration = lastAudioTimestamp - audioStartTimestamp;
-            metaData.duration      = ceil( std::max( videoDuration, audioDuration ) / 1000 );
-        }
-        metaData.filesize = totalBytes;
-        if ( this->sps ) {
-            uint32_t width  = 0;
-            uint32_t height = 0;
-            H264SPS  sps;
-            avc_decode_sps( &sps, this->sps->buf, this->sps->size );
-            sps.get_resolution( width, height );
-            metaData.width  = width;
-            metaData.height = height;
-        }
+        finish_metadata( metaData, stats, lastAudioTimestamp - audioStartTimestamp, lastVideoTimestamp - videoStartTimestamp, totalBytes );
         const long offsetOfScriptTag = 9 + 4;
 
-        vector<uint8_t> buf = metadata_to_buf( metaData );
-        onUpdateMuxedData( offsetOfScriptTag, &buf[0], buf.size() );
+        try {
+            vector<uint8_t, FlvAllocator<uint8_t>> buf = metadata_to_buf( metaData, resource );
+            onUpdateMuxedData( offsetOfScriptTag, &buf[0], buf.size() );
+        }
+        catch ( const std::bad_alloc & ) {
+            // no memory, the metadata of the header is kept
+        }
     }
 
     // call back end muxing
-    if ( auto handler = this->dataHandler.lock() ) {
-        handler->onEndMuxing();
+    sink.onEndMuxing();
+}
+
+template class nx::BasicFlvMuxer<VirtualHandlerSink>;
+template class nx::BasicFlvMuxer<FlvMemorySink>;
+template class nx::BasicFlvMuxer<FlvFileSink>;
+template class nx::BasicFlvMuxer<FlvDvrSink>;
+
+FlvPullMuxer::FlvPullMuxer( bool hasAudio, bool hasVideo, FlvMemoryResource *resource )
+    : resource( resource ), sps( resource ), pps( resource ), nalus( resource ), record( resource ) {
+    assert( hasAudio || hasVideo );
+    this->hasAudio    = hasAudio;
+    this->hasVideo    = hasVideo;
+    metaData.hasAudio = hasAudio;
+    metaData.hasVideo = hasVideo;
+}
+int64_t FlvPullMuxer::write_header( uint8_t *out, size_t capacity ) {
+    const size_t                           headerSize = 13; // 9 bytes header + 4 bytes tag size 0
+    vector<uint8_t, FlvAllocator<uint8_t>> buf        = metadata_to_buf( metaData, resource );
+    size_t                                 needed     = headerSize + buf.size();
+    if ( capacity < needed ) return -(int64_t)needed;
+
+    memset( out, 0, headerSize );
+    flv_header( hasAudio, hasVideo ).to_buf( out );
+    memcpy( out + headerSize, &buf[0], buf.size() );
+    totalBytes += needed;
+    return needed;
+}
+int64_t FlvPullMuxer::mux_aac( const uint8_t *adts, size_t length, uint32_t timestamp, uint8_t *out, size_t capacity ) {
+    if ( !this->hasAudio ) return 0;
+    if ( length <= adts_header_size( adts ) ) return 0;
+    if ( adts_raw_blocks( adts ) > 1 ) {
+        stats.on_audio_skip();
+        return 0;
     }
+
+    // aac sequence header on first frame, or when the adts config changes
+    uint32_t config         = aac_config_key( adts );
+    bool     sequenceHeader = !aacSequenceHeaderFlag || config != aacConfig;
+    size_t   tagBytes       = aac_tag_bytes( adts, length );
+    size_t   needed         = ( sequenceHeader ? AacSequenceHeaderBytes : 0 ) + tagBytes;
+    if ( capacity < needed ) return -(int64_t)needed;
+
+    if ( sequenceHeader ) {
+        put_aac_sequence_header( adts, timestamp, out );
+        update_audio_metadata( metaData, adts );
+        aacSequenceHeaderFlag = true;
+        aacConfig             = config;
+    }
+    put_aac_tag( adts, length, timestamp, out + needed - tagBytes );
+    // update timestamp
+    if ( !this->audioStartTimestamp ) this->audioStartTimestamp = timestamp;
+    this->lastAudioTimestamp = timestamp;
+    stats.on_audio_tag( timestamp, tagBytes );
+    totalBytes += needed;
+    return needed;
+}
+int64_t FlvPullMuxer::mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame, uint8_t *out, size_t capacity ) {
+    if ( !this->hasVideo ) return 0;
+    nalus.clear();
+    find_nalus( buf, (uint32_t)length, nalus );
+    // counted once the call succeeds
+    size_t filteredNalus = 0;
+    size_t filteredBytes = 0;
+    if ( naluFilterEnabled ) filteredNalus = filter_nalus( naluFilter, nalus, 0, filteredBytes );
+    if ( nalus.empty() ) {
+        if ( filteredNalus ) stats.on_nalus_filtered( filteredNalus, filteredBytes );
+        return 0;
+    }
+
+    // sps and pps of a key frame which differ from the current ones, they replace them only when the call succeeds
+    const NaluRange *newSps     = nullptr;
+    const NaluRange *newPps     = nullptr;
+    uint32_t         newSpsHash = spsHash;
+    uint32_t         newPpsHash = ppsHash;
+    if ( !avcSequenceHeaderFlag || isKeyFrame ) {
+        for ( size_t i = 0; i < nalus.size(); i++ ) {
+            const NaluRange &nalu     = nalus[i];
+            uint8_t          naluType = nalu.buf[0] & 0x1F;
+            if ( naluType == NaluType::SPS ) {
+                uint32_t hash = fnv1a_hash( nalu.buf, nalu.size );
+                if ( newSps ? !same_parameter_set( nalu.buf, nalu.size, hash, newSps->buf, newSps->size, newSpsHash )
+                            : sps.empty() || !same_parameter_set( nalu.buf, nalu.size, hash, sps.data(), sps.size(), spsHash ) ) {
+                    newSps     = &nalu;
+                    newSpsHash = hash;
+                }
+            }
+            else if ( naluType == NaluType::PPS ) {
+                uint32_t hash = fnv1a_hash( nalu.buf, nalu.size );
+                if ( newPps ? !same_parameter_set( nalu.buf, nalu.size, hash, newPps->buf, newPps->size, newPpsHash )
+                            : pps.empty() || !same_parameter_set( nalu.buf, nalu.size, hash, pps.data(), pps.size(), ppsHash ) ) {
+                    newPps     = &nalu;
+                    newPpsHash = hash;
+                }
+            }
+        }
+    }
+    const uint8_t *spsBuf  = newSps ? newSps->buf : sps.data();
+    uint32_t       spsSize = newSps ? newSps->size : (uint32_t)sps.size();
+    const uint8_t *ppsBuf  = newPps ? newPps->buf : pps.data();
+    uint32_t       ppsSize = newPps ? newPps->size : (uint32_t)pps.size();
+
+    // AVCDecoderConfigurationRecord of the new parameter sets, empty when no avc sequence header is written
+    record.clear();
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    if ( ( newSps || newPps || !avcSequenceHeaderFlag ) && spsSize && ppsSize ) {
+        H264SPS h264sps;
+        if ( avc_decode_sps( &h264sps, spsBuf, spsSize ) >= 0 ) {
+            h264sps.get_resolution( width, height );
+            vector<uint8_t> buf = AVCDecoderConfigurationRecord( h264sps, (uint8_t *)spsBuf, spsSize, (uint8_t *)ppsBuf, ppsSize ).to_buf();
+            record.assign( buf.begin(), buf.end() );
+        }
+    }
+    bool   sequenceHeader = !record.empty();
+    size_t headerBytes    = sequenceHeader ? 11 + 5 + record.size() + 4 : 0;
+    size_t tagBytes       = ( sequenceHeader || avcSequenceHeaderFlag ) ? avc_tag_bytes( &nalus[0], nalus.size() ) : 0;
+    size_t needed         = headerBytes + tagBytes;
+    if ( capacity < needed ) return -(int64_t)needed;
+
+    if ( filteredNalus ) stats.on_nalus_filtered( filteredNalus, filteredBytes );
+    if ( newSps ) {
+        sps.assign( newSps->buf, newSps->buf + newSps->size );
+        spsHash = newSpsHash;
+    }
+    if ( newPps ) {
+        pps.assign( newPps->buf, newPps->buf + newPps->size );
+        ppsHash = newPpsHash;
+    }
+    if ( sequenceHeader ) {
+        put_avc_sequence_header( record, pts, dts, out );
+        metaData.width        = width;
+        metaData.height       = height;
+        avcSequenceHeaderFlag = true;
+    }
+    // no avc sequence header yet, the frame is dropped
+    if ( !tagBytes ) return 0;
+
+    put_avc_tag( &nalus[0], nalus.size(), pts, dts, isKeyFrame, out + headerBytes );
+    // update timestamp
+    if ( !this->videoStartTimestamp ) this->videoStartTimestamp = dts;
+    this->lastVideoTimestamp = dts;
+    stats.on_video_tag( dts, tagBytes, isKeyFrame );
+    totalBytes += needed;
+    return needed;
+}
+int64_t FlvPullMuxer::write_end( uint8_t *out, size_t capacity ) {
+    if ( !this->hasVideo ) return 0;
+    if ( capacity < AvcEndOfSequenceBytes ) return -(int64_t)AvcEndOfSequenceBytes;
+
+    put_avc_end_of_sequence( this->lastVideoTimestamp, out );
+    totalBytes += AvcEndOfSequenceBytes;
+    return AvcEndOfSequenceBytes;
+}
+int64_t FlvPullMuxer::write_metadata( uint8_t *out, size_t capacity ) {
+    FlvMetaData finalMetaData = metaData;
+    finish_metadata( finalMetaData, stats, lastAudioTimestamp - audioStartTimestamp, lastVideoTimestamp - videoStartTimestamp, totalBytes );
+    vector<uint8_t, FlvAllocator<uint8_t>> buf = metadata_to_buf( finalMetaData, resource );
+    if ( capacity < buf.size() ) return -(int64_t)buf.size();
+
+    memcpy( out, &buf[0], buf.size() );
+    return buf.size();
+}
+void FlvPullMuxer::get_stats( FlvStreamStats &stats ) const {
+    this->stats.get_stats( stats );
+}
+void FlvPullMuxer::set_nalu_filter( bool enable, const FlvNaluFilter &filter ) {
+    naluFilterEnabled = enable;
+    naluFilter        = filter;
 }
@@ -2,6 +2,13 @@
 #define __FLVMUXER_H__
 
 #include "avc.h"
+#include "flv_dvr.h"
+#include "flv_interleaver.h"
+#include "flv_memory.h"
+#include "flv_profiler.h"
+#include "flv_sink.h"
+#include "flv_stats.h"
+#include <memory>
 namespace nx {
 
 struct FlvMetaData {
@@ -10,9 +17,9 @@ struct FlvMetaData {
     bool hasVideo = false;
 
     // Total duration of the file in seconds
-    double duration;
+    double duration = 0;
     // Total size of the file in bytes
-    double filesize;
+    double filesize = 0;
     /*
     0 = Linear PCM, platform endian
     1 = ADPCM
@@ -28,15 +35,15 @@ struct FlvMetaData {
     */
     double audiocodecid = 10;
     // Audio bit rate in kilobits per second
-    double audiodatarate;
+    double audiodatarate = 0;
     // Resolution of a single audio sample
-    double audiosamplesize;
+    double audiosamplesize = 16;
     // indicating stereo audio
-    bool stereo;
+    bool stereo = false;
     // Delay introduced by the audio codec in seconds
     double audiodelay = 0;
     // Frequency at which the audio stream is replayed
-    double audiosamplerate;
+    double audiosamplerate = 0;
     /*
     2 = Sorenson H.263
     3 = Screen video
@@ -46,13 +53,75 @@ struct FlvMetaData {
     */
     double videocodecid = 7;
     // Number of frames per second
-    double framerate;
+    double framerate = 0;
     // Width of the video in pixels
     double width = 0;
     // Height of the video in pixels
     double height = 0;
     // Video bit rate in kilobits per second
-    double videodatarate;
+    double videodatarate = 0;
+    /*
+    Optional keyframes index, written as keyframes object when not empty.
+    times in seconds, filepositions are offsets of the key frame tags from the start of the file.
+    */
+    std::vector<double> keyframeTimes;
+    std::vector<double> keyframeFilePositions;
+};
+
+/**
+ * @brief construct metadata tag buf, with 4 bytes tag size
+ *
+ * @param metaData  FlvMetaData
+ * @param resource  memory of the amf buffers and of the tag, throws std::bad_alloc when it fails
+ * @return the tag buf, allocated from resource
+ */
+std::vector<uint8_t, FlvAllocator<uint8_t>> metadata_to_buf( FlvMetaData &metaData, FlvMemoryResource *resource = flv_default_resource() );
+
+/**
+ * @brief a frame of FlvMuxer::mux_batch.
+ */
+struct FlvFrame {
+    // 8 - audio, aac with adts header, with or without crc, 9 - video, h264 annex-b
+    int      type;
+    uint8_t *data;
+    size_t   length;
+    // audio uses pts only
+    uint32_t pts;
+    uint32_t dts;
+    bool     isKeyFrame;
+};
+
+/**
+ * @brief backpressure of a sink, how much video the muxer may drop to catch up.
+ * Key frames, audio and sequence headers are never dropped.
+ */
+enum FlvBackpressure {
+    FlvBackpressureNone = 0,       // the sink keeps up
+    FlvBackpressureDropDisposable, // drop non-reference frames, nal_ref_idc 0, no other frame depends on them
+    FlvBackpressureDropGop,        // drop every frame until the next key frame, the decoder never sees a broken reference
+};
+
+/**
+ * @brief nal units removed from the video tags, which a flv player does not need.
+ * The default profile removes access unit delimiters and filler data, and keeps every sei.
+ * Parameter sets and slices are never removed.
+ */
+struct FlvNaluFilter {
+    // access unit delimiter, nal unit type 9
+    bool dropAud = true;
+    // filler data, nal unit type 12
+    bool dropFiller = true;
+    // keep a sei nal unit only if one of its messages has a payload type of seiAllowList,
+    // e.g. 5 user_data_unregistered, 4 user_data_registered_itu_t_t35 for closed captions
+    bool                  filterSei = false;
+    std::vector<uint32_t> seiAllowList;
+
+    /**
+     * @brief whether the nal unit is removed.
+     *
+     * @param nalu  nal unit with its header, without start code
+     */
+    bool drops( const uint8_t *nalu, uint32_t size ) const;
 };
 
 struct FlvMuxerDataHandler {
@@ -81,7 +150,8 @@ public:
     virtual void onMuxedData( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) = 0;
 
     /**
-     * @brief update muxed data, only for meta data now.
+     * @brief update muxed data, the onMetaData tag at the end of muxing,
+     * and the DataSize of a tag streamed with onMuxedDataPart to a FlvSinkStreamingSeekable sink.
      *
      * @param context binded context
      * @param offsetFromStart  offset from the start
@@ -91,9 +161,121 @@ public:
     virtual void onUpdateMuxedData( void *context, size_t offsetFromStart, const uint8_t *data, size_t bytes ) = 0;
 
     virtual void onEndMuxing() = 0;
+
+    /**
+     * @brief the tags of a FlvMuxer::mux_batch call, serialized back to back in one buffer.
+     * The default implementation calls onMuxedData for each tag,
+     * override it to write the whole batch at once.
+     *
+     * @param context  binded context
+     * @param data  the tags
+     * @param bytes  buf bytes
+     * @param tags  offset, size and timestamp of each tag in data
+     * @param count  number of tags
+     */
+    virtual void onMuxedBatch( void *context, const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+        for ( size_t i = 0; i < count; i++ ) {
+            onMuxedData( context, tags[i].type, data + tags[i].offset, tags[i].bytes, tags[i].timestamp );
+        }
+    }
+
+    /**
+     * @brief polled before each video frame of mux_avc, and once per mux_batch call,
+     * e.g. from the send queue depth of a live connection.
+     *
+     * @param context  binded context
+     * @return FlvBackpressure, the default never drops
+     */
+    virtual int onBackpressure( void *context ) {
+        return FlvBackpressureNone;
+    }
+
+    /**
+     * @brief how the video tags of FlvMuxer::begin_video_frame are taken, polled at the first slice of each frame.
+     *
+     * @param context  binded context
+     * @return FlvSinkStreaming, the default takes whole tags with onMuxedData
+     */
+    virtual int onStreamingSupport( void *context ) {
+        return FlvSinkStreamingNone;
+    }
+    /**
+     * @brief a part of a video tag of FlvMuxer::add_nalu, written as soon as the nal unit arrives.
+     * The parts of a tag are contiguous in the output, the first one starts with the tag header,
+     * the last one ends with the tag size. Only called when onStreamingSupport allows it.
+     *
+     * @param context  binded context
+     * @param type  9 - video
+     * @param data  the part
+     * @param bytes  bytes of the part
+     * @param timestamp  dts of the frame
+     * @param last  the tag is complete
+     */
+    virtual void onMuxedDataPart( void *context, int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) {}
+};
+
+/**
+ * @brief sink of FlvMuxer, forwards to a FlvMuxerDataHandler through a weak pointer and virtual calls.
+ * The handler is locked for every callback, the muxer does not keep it alive.
+ */
+struct VirtualHandlerSink {
+    std::weak_ptr<FlvMuxerDataHandler> handler;
+
+    VirtualHandlerSink( std::weak_ptr<FlvMuxerDataHandler> handler ) : handler( std::move( handler ) ) {}
+    template <typename Handler>
+    VirtualHandlerSink( const std::shared_ptr<Handler> &handler ) : handler( handler ) {}
+
+    void onMuxedFlvHeader( const uint8_t *data, size_t bytes ) {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onMuxedFlvHeader( handler->context, (uint8_t *)data, bytes );
+        }
+    }
+    void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp ) {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onMuxedData( handler->context, type, data, bytes, timestamp );
+        }
+    }
+    void onMuxedBatch( const uint8_t *data, size_t bytes, const FlvBatchTag *tags, size_t count ) {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onMuxedBatch( handler->context, data, bytes, tags, count );
+        }
+    }
+    void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes ) {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onUpdateMuxedData( handler->context, offsetFromStart, data, bytes );
+        }
+    }
+    void onEndMuxing() {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onEndMuxing();
+        }
+    }
+    int onBackpressure() {
+        if ( auto handler = this->handler.lock() ) {
+            return handler->onBackpressure( handler->context );
+        }
+        return FlvBackpressureNone;
+    }
+    int onStreamingSupport() {
+        if ( auto handler = this->handler.lock() ) {
+            return handler->onStreamingSupport( handler->context );
+        }
+        return FlvSinkStreamingNone;
+    }
+    void onMuxedDataPart( int type, const uint8_t *data, size_t bytes, uint32_t timestamp, bool last ) {
+        if ( auto handler = this->handler.lock() ) {
+            handler->onMuxedDataPart( handler->context, type, data, bytes, timestamp, last );
+        }
+    }
 };
 
-class FlvMuxer {
+/**
+ * @brief flv muxer writing to a Sink, a static output policy, see flv_sink.h.
+ * The sink is called directly, with an inline sink like FlvMemorySink or FlvFileSink the tag path has no virtual call.
+ * Instantiated in flvmuxer.cpp for VirtualHandlerSink, FlvMemorySink and FlvFileSink.
+ */
+template <typename Sink>
+class BasicFlvMuxer {
 private:
     FlvMetaData metaData;
 
@@ -108,11 +290,117 @@ private:
 
     int64_t totalBytes = 0;
 
+    // tag buffers, nalus and held tags are allocated from it, a failed allocation drops the frame
+    FlvMemoryResource *resource;
+
+    FlvStatsCollector stats;
+
+    // optional timestamp interleaving stage, null when disabled
+    std::unique_ptr<FlvInterleaver, FlvDeleter<FlvInterleaver>> interleaver;
+#if FLV_ENABLE_PROFILING
+    FlvProfiler profiler;
+#endif
+
     bool aacSequenceHeaderFlag = false;
     bool avcSequenceHeaderFlag = false;
 
+    // allocated from resource, null until the first one
     NaluBuffer *sps = nullptr;
     NaluBuffer *pps = nullptr;
+
+    // fingerprints of the current sps and pps, and the current aac config, used to detect mid-stream changes
+    uint32_t spsHash   = 0;
+    uint32_t ppsHash   = 0;
+    uint32_t aacConfig = 0;
+
+    // dropping the rest of the gop under backpressure, until the next key frame
+    bool droppingGop = false;
+
+    bool          naluFilterEnabled = false;
+    FlvNaluFilter naluFilter;
+    /**
+     * @brief apply the drop policy to a video frame.
+     *
+     * @param backpressure  FlvBackpressure of the sink
+     * @param isKeyFrame  key frame or idr nalu, never dropped
+     * @param disposable  every slice has nal_ref_idc 0
+     * @return true if the frame is dropped
+     */
+    bool drop_video_frame( int backpressure, bool isKeyFrame, bool disposable, size_t bytes );
+    /**
+     * @brief the drop policy without the statistics.
+     *
+     * @return FlvBackpressureNone if the frame is kept, else FlvBackpressureDropDisposable or FlvBackpressureDropGop
+     */
+    int video_drop_decision( int backpressure, bool isKeyFrame, bool disposable );
+
+    // video frame of begin_video_frame, add_nalu and end_video_frame
+    struct OpenFrame {
+        bool     open       = false;
+        uint32_t pts        = 0;
+        uint32_t dts        = 0;
+        bool     isKeyFrame = false;
+        // announced bytes of the nal units with their length prefixes, 0 if unknown
+        size_t sizeHint = 0;
+        // a parameter set before the first slice differs from the current one
+        bool parameterSetsChanged = false;
+        // the tag is started at the first slice, the nal units before it are kept in frameBuffer
+        bool started = false;
+        // dropped as FlvBackpressure, or FlvBackpressureNone before the first sequence header
+        bool dropped  = false;
+        int  dropKind = FlvBackpressureNone;
+        // the tag is written in parts as the nal units arrive, otherwise it is built in frameBuffer
+        bool streaming = false;
+        bool seekable  = false;
+        // a nal unit did not fit the sizeHint of an append only sink, the tag misses it
+        bool broken = false;
+        // bytes of the nal units in the tag, with their length prefixes, and input bytes of the frame
+        size_t nalusBytes = 0;
+        size_t inputBytes = 0;
+        // offset of the tag in the stream, for the DataSize patch
+        int64_t tagOffset = 0;
+    };
+    OpenFrame                                   openFrame;
+    std::vector<uint8_t, FlvAllocator<uint8_t>> frameBuffer;
+    // tags muxed while a tag is being streamed, written after it
+    std::vector<uint8_t, FlvAllocator<uint8_t>>         heldBuffer;
+    std::vector<FlvBatchTag, FlvAllocator<FlvBatchTag>> heldTags;
+    // a streamed tag is incomplete in the output
+    bool streaming_tag() const {
+        return openFrame.open && openFrame.started && openFrame.streaming && !openFrame.dropped;
+    }
+    // apply the drop policy and write the sequence header at the first slice, then the tag header
+    void start_video_tag( bool idr, bool disposable );
+    int  write_frame_nalu( const uint8_t *nalu, size_t length );
+    // write a part of the streamed tag
+    void write_tag_part( const uint8_t *data, size_t bytes, bool last );
+    // pad, end and patch the streamed tag
+    void finish_streamed_tag();
+
+    // a tag of the batch being serialized, the data comes from the frame or from batchHeaders
+    struct BatchItem {
+        const FlvFrame *frame;
+        bool            sequenceHeader;
+        // range of batchNalus, for video frames
+        size_t nalusBegin;
+        size_t nalusEnd;
+        // offset of an avc sequence header tag in batchHeaders
+        size_t headerOffset;
+    };
+    // scratch space of mux_batch, kept across calls
+    std::vector<BatchItem, FlvAllocator<BatchItem>>     batchItems;
+    std::vector<FlvBatchTag, FlvAllocator<FlvBatchTag>> batchTags;
+    NaluRangeList                                       batchNalus;
+    std::vector<uint8_t, FlvAllocator<uint8_t>>         batchHeaders;
+    std::vector<uint8_t, FlvAllocator<uint8_t>>         batchBuffer;
+    // adts frames of mux_aac_stream, the frames split per raw data block, and its sample count to continue at the next call
+    std::vector<FlvFrame, FlvAllocator<FlvFrame>> streamFrames;
+    std::vector<uint8_t, FlvAllocator<uint8_t>>   streamBlocks;
+    bool                                          streamStarted       = false;
+    uint32_t                                      streamSampleRate    = 0;
+    uint32_t                                      streamBase          = 0;
+    uint64_t                                      streamSamples       = 0;
+    uint32_t                                      streamNextTimestamp = 0;
     /**
      * @brief mux data call back
      *
@@ -122,30 +410,93 @@ private:
      * @param timestamp  timestamp, audio is pts, video is dts
      */
     void onMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp );
+    // deliver a tag to the data handler
+    void writeMuxedData( int type, const uint8_t *data, size_t bytes, uint32_t timestamp );
+    // release held tags of the interleaver, all of them when flush is true
+    void drainInterleaver( bool flush );
 
     void onUpdateMuxedData( size_t offsetFromStart, const uint8_t *data, size_t bytes );
 
     void mux_metadata();
+    /**
+     * @brief write aac sequence header from the adts header, and update audio metadata.
+     *
+     * @param adts  aac with adts header
+     * @param timestamp  timestamp of the sequence header
+     */
+    void mux_aac_sequence_header( uint8_t *adts, uint32_t timestamp );
+    /**
+     * @brief build the aac sequence header tag, with tag size, and update audio metadata.
+     *
+     * @param buf  11 + 2 + 2 + 4 bytes
+     */
+    void build_aac_sequence_header( uint8_t *adts, uint32_t timestamp, uint8_t *buf );
+    /**
+     * @brief write avc sequence header from the current sps and pps, and update video metadata.
+     *
+     * @param pts  pts of the key frame
+     * @param dts  dts of the key frame
+     */
+    void mux_avc_sequence_header( uint32_t pts, uint32_t dts );
+    /**
+     * @brief append the avc sequence header tag, with tag size, and update video metadata.
+     *
+     * @return false if the sps cannot be decoded
+     */
+    bool build_avc_sequence_header( uint32_t pts, uint32_t dts, std::vector<uint8_t, FlvAllocator<uint8_t>> &tag );
+    /**
+     * @brief keep a copy of a sps or pps nalu of a key frame.
+     *
+     * @return true if it differs from the current one
+     */
+    bool update_parameter_set( const uint8_t *nalu, uint32_t size );
 
     void endMuxing();
 
-    std::weak_ptr<FlvMuxerDataHandler> dataHandler;
+    Sink sink;
 
 public:
-    ~FlvMuxer();
+    ~BasicFlvMuxer();
+    BasicFlvMuxer( const BasicFlvMuxer & )            = delete;
+    BasicFlvMuxer &operator=( const BasicFlvMuxer & ) = delete;
 
-    FlvMuxer( bool hasAudio, bool hasVideo, std::weak_ptr<FlvMuxerDataHandler> dataHandler );
     /**
-     * @brief mux aac adts data
+     * @param sink  output of the muxer, the flv header and metadata are written to it here
+     * @param resource  memory of the muxer, e.g. a FlvPoolResource to reuse buffers,
+     *                  or a FlvBudgetResource to cap the memory of the stream. Not owned, must outlive the muxer.
+     */
+    BasicFlvMuxer( bool hasAudio, bool hasVideo, Sink sink, FlvMemoryResource *resource = flv_default_resource() );
+    /**
+     * @brief mux aac adts data, one adts frame, the crc is stripped when protection_absent is 0.
+     * When the adts config (profile, sample rate, channels) changes, a new aac sequence header is written.
+     * A flv tag holds one raw data block, a frame of several is skipped and counted in FlvStreamStats::skippedAudioFrames,
+     * mux_aac_stream splits them.
      *
      * @param adts  aac with adts header
      * @param length length of the adts buffer
      * @param timestamp  timestamp of this buffer
      */
     void mux_aac( uint8_t *adts, size_t length, uint32_t timestamp );
+    /**
+     * @brief mux concatenated adts frames, e.g. a large read of a .aac file, through mux_batch.
+     * Frames are walked with aac_frame_length, bytes which are not an adts header are skipped,
+     * and a frame of N raw data blocks advances the timestamps by N * 1024 samples at its sample rate.
+     * Such a frame is muxed as N tags when it has a crc, using its raw_data_block_position table, and is skipped
+     * and counted in FlvStreamStats::skippedAudioFrames without it, as the blocks can only be found by decoding them.
+     *
+     * @param buf  adts frames
+     * @param length  length of buf
+     * @param startTimestamp  timestamp of the first frame in buf
+     * @param nextTimestamp  if not null, set to the timestamp of the frame after the last consumed one,
+     *                       to pass as startTimestamp of the next call, which then continues the sample count without rounding drift
+     * @return bytes consumed, a partial frame at the end of buf is not consumed,
+     *         <0: no memory, nothing is written nor consumed, and the timestamps do not advance
+     */
+    int64_t mux_aac_stream( uint8_t *buf, size_t length, uint32_t startTimestamp, uint32_t *nextTimestamp = nullptr );
     /**
      * @brief mux h264 annex-b frame, which is seperated by start code 00 00 00 01.
      * The key frame should contain sps, pps, and IDR nalus.
+     * When sps or pps of a key frame changes, a new avc sequence header is written.
      *
      * @param buf h264 annex-b buffer, seperated by 00 00 00 01
      * @param length  length of the  h264 buf
@@ -154,6 +505,206 @@ public:
      * @param isKeyFrame  whether buf is keyFrame or not
      */
     void mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame );
+    /**
+     * @brief mux audio and video frames in one call, for offline pipelines.
+     * The tags of the whole batch are sized in one pass and serialized back to back in one buffer,
+     * which is given to FlvMuxerDataHandler::onMuxedBatch with the offset of each tag.
+     * Frames are muxed in array order, with the same rules as mux_aac and mux_avc.
+     * With interleaving enabled, the tags go through the interleaver and onMuxedData instead.
+     *
+     * @param frames  audio and video frames
+     * @param count  number of frames
+     * @return 0: success, <0: no memory, nothing is written
+     */
+    int mux_batch( const FlvFrame *frames, size_t count );
+    /**
+     * @brief start a video frame given nal unit by nal unit, for encoders emitting one slice at a time.
+     * With a sink supporting FlvSinkStreaming, every slice is written as soon as add_nalu is called,
+     * without waiting for the whole access unit nor copying it. The DataSize of the tag is
+     * the announced sizeHint, or patched by end_video_frame with onUpdateMuxedData on a seekable sink.
+     * Other sinks, an append only sink without sizeHint, and interleaving, get the whole tag at end_video_frame.
+     *
+     * Tags muxed while a tag is being streamed, e.g. audio, are held and written after it.
+     * A frame still open is ended by the next begin_video_frame and by the end of muxing.
+     *
+     * On an append only sink, a nal unit which exceeds the sizeHint, or leaves 1 to 5 bytes to it, too few for
+     * a filler nal unit, is rejected and the frame is broken: its tag is still padded to the sizeHint so the stream
+     * stays aligned, end_video_frame fails, and the next frames are dropped up to the next key frame,
+     * as they may reference the incomplete one.
+     *
+     * @param pts  pts of the frame
+     * @param dts  dts of the frame
+     * @param isKeyFrame  whether the frame is a key frame
+     * @param sizeHint  bytes of the nal units of the frame with 4 bytes length prefixes, the size of the frame
+     *                  in annex-b with 4 bytes start codes, 0 if unknown. Required for an append only sink,
+     *                  a smaller frame is padded with a filler data nal unit.
+     * @return 0: success, <0: no video
+     */
+    int begin_video_frame( uint32_t pts, uint32_t dts, bool isKeyFrame, size_t sizeHint = 0 );
+    /**
+     * @brief add a nal unit to the open frame, with or without its start code.
+     * The parameter sets of a key frame come before its first slice. The nal unit filter and the drop policy apply,
+     * a frame is dropped or kept as a whole, from its first slice.
+     *
+     * @return 0: success, <0: no open frame, no memory, or the frame is broken, see begin_video_frame
+     */
+    int add_nalu( const uint8_t *nalu, size_t length );
+    /**
+     * @brief end the open frame, the tag is completed.
+     *
+     * @return 0: success, <0: no open frame, no memory, or the frame is broken, see begin_video_frame
+     */
+    int end_video_frame();
+    /**
+     * @brief get live statistics of the stream, bitrate, framerate, gop, tag sizes and backpressure drops.
+     * Lock free, can be called from any thread while muxing.
+     *
+     * @param stats  filled with the last published statistics
+     */
+    void get_stats( FlvStreamStats &stats ) const;
+    /**
+     * @brief hold audio and video tags and write them in timestamp order,
+     * for encoders running on different threads with different delays.
+     * A tag is held until the other track reaches its timestamp, or until a tag maxLatencyMs newer is muxed.
+     *
+     * @param enable  enable or disable interleaving, disabling writes the held tags
+     * @param maxLatencyMs  latency budget in milliseconds of stream time
+     */
+    void set_interleaving( bool enable, uint32_t maxLatencyMs = 500 );
+    /**
+     * @brief get counters of the interleaving stage, reorders, forced releases and held tags.
+     */
+    void get_interleaver_stats( FlvInterleaverStats &stats ) const;
+    /**
+     * @brief remove nal units from the video tags, see FlvNaluFilter.
+     * Removed nal units are not copied, their count and bytes are in FlvStreamStats.
+     *
+     * @param enable  enable or disable filtering, disabled by default
+     * @param filter  the nal units to remove
+     */
+    void set_nalu_filter( bool enable, const FlvNaluFilter &filter = FlvNaluFilter() );
+#if FLV_ENABLE_PROFILING
+    /**
+     * @brief stage timers and allocation counters, only with FLV_ENABLE_PROFILING.
+     * Not thread safe, read it from the muxing thread.
+     */
+    const FlvProfiler &get_profiler() const;
+#endif
+};
+
+extern template class BasicFlvMuxer<VirtualHandlerSink>;
+extern template class BasicFlvMuxer<FlvMemorySink>;
+extern template class BasicFlvMuxer<FlvFileSink>;
+extern template class BasicFlvMuxer<FlvDvrSink>;
+
+/**
+ * @brief the muxer of FlvMuxerDataHandler callbacks.
+ */
+using FlvMuxer = BasicFlvMuxer<VirtualHandlerSink>;
+
+/**
+ * @brief pull mode muxer, zlib style, the caller gives the output buffer of every call.
+ * Tags are serialized once, straight into the caller's buffer, without callbacks or intermediate tag buffers.
+ *
+ * Every call returns the bytes written, or 0 when the input makes no tag (e.g. a video frame before the first sps and pps).
+ * When capacity is too small it returns the negative of the bytes needed, nothing is written and the muxer state is unchanged,
+ * so the same call can be retried with a larger buffer.
+ * The output is the same as FlvMuxer without interleaving. Not thread safe.
+ */
+class FlvPullMuxer {
+public:
+    // offset of the onMetaData tag in the file, write_metadata replaces it in place
+    static const size_t MetadataOffset = 9 + 4;
+
+    /**
+     * @param resource  memory of the parameter sets and the scratch buffers, std::bad_alloc is thrown when it fails.
+     *                  Not owned, must outlive the muxer.
+     */
+    FlvPullMuxer( bool hasAudio, bool hasVideo, FlvMemoryResource *resource = flv_default_resource() );
+    FlvPullMuxer( const FlvPullMuxer & )            = delete;
+    FlvPullMuxer &operator=( const FlvPullMuxer & ) = delete;
+
+    /**
+     * @brief write the flv header and the initial onMetaData tag, the first call.
+     */
+    int64_t write_header( uint8_t *out, size_t capacity );
+    /**
+     * @brief mux one adts frame, with an aac sequence header before it on the first frame or when the adts config changes.
+     *
+     * @param adts  aac with adts header, the crc is stripped when protection_absent is 0,
+     *              a frame of several raw data blocks is skipped and counted in FlvStreamStats::skippedAudioFrames
+     * @param length  length of the adts frame
+     * @param timestamp  timestamp of the frame
+     */
+    int64_t mux_aac( const uint8_t *adts, size_t length, uint32_t timestamp, uint8_t *out, size_t capacity );
+    /**
+     * @brief mux one h264 annex-b frame, with an avc sequence header before it when the sps or pps of a key frame changes.
+     *
+     * @param buf  h264 annex-b buffer
+     * @param length  length of buf
+     * @param pts  pts of the frame
+     * @param dts  dts of the frame
+     * @param isKeyFrame  whether the frame is a key frame
+     */
+    int64_t mux_avc( uint8_t *buf, size_t length, uint32_t pts, uint32_t dts, bool isKeyFrame, uint8_t *out, size_t capacity );
+    /**
+     * @brief write the avc end of sequence tag, the last tag of a stream with video.
+     */
+    int64_t write_end( uint8_t *out, size_t capacity );
+    /**
+     * @brief write the final onMetaData tag, with duration, file size and data rates,
+     * to be written over the initial one at MetadataOffset, it has the same size.
+     */
+    int64_t write_metadata( uint8_t *out, size_t capacity );
+    /**
+     * @brief bytes written so far, the file size.
+     */
+    int64_t bytes_written() const {
+        return totalBytes;
+    }
+    /**
+     * @brief get statistics of the stream, see FlvMuxer::get_stats.
+     */
+    void get_stats( FlvStreamStats &stats ) const;
+    /**
+     * @brief remove nal units from the video tags, see FlvMuxer::set_nalu_filter.
+     */
+    void set_nalu_filter( bool enable, const FlvNaluFilter &filter = FlvNaluFilter() );
+
+private:
+    FlvMetaData metaData;
+
+    bool hasVideo = false;
+    bool hasAudio = false;
+
+    uint32_t audioStartTimestamp = 0;
+    uint32_t lastAudioTimestamp  = 0;
+
+    uint32_t videoStartTimestamp = 0;
+    uint32_t lastVideoTimestamp  = 0;
+
+    int64_t totalBytes = 0;
+
+    FlvMemoryResource *resource;
+
+    FlvStatsCollector stats;
+
+    bool aacSequenceHeaderFlag = false;
+    bool avcSequenceHeaderFlag = false;
+
+    // current parameter sets and fingerprints, see FlvMuxer
+    std::vector<uint8_t, FlvAllocator<uint8_t>> sps;
+    std::vector<uint8_t, FlvAllocator<uint8_t>> pps;
+    uint32_t                                    spsHash   = 0;
+    uint32_t                                    ppsHash   = 0;
+    uint32_t                                    aacConfig = 0;
+
+    bool          naluFilterEnabled = false;
+    FlvNaluFilter naluFilter;
+
+    // scratch space of mux_avc, kept across calls
+    NaluRangeList                               nalus;
+    std::vector<uint8_t, FlvAllocator<uint8_t>> record;
 };
 
 } // namespace nx
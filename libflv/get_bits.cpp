@@ -2,56 +2,96 @@
 
 namespace nx {
 
-GetBitContext::GetBitContext( const uint8_t *buffer, int bytes ) {
-    this->buffer   = buffer;
-    this->bitCount = bytes * 8;
-    this->index    = 0;
+GetBitContext::GetBitContext( const uint8_t *buffer, int bytes, bool unescape ) {
+    this->current  = buffer;
+    this->end      = buffer + ( bytes > 0 ? bytes : 0 );
+    this->unescape = unescape;
+}
+
+uint32_t GetBitContext::load_byte() {
+    if ( current >= end ) {
+        error = true;
+        return 0;
+    }
+    uint32_t byte = *current++;
+    if ( unescape ) {
+        if ( zeros >= 2 && byte == 3 ) {
+            // emulation_prevention_three_byte
+            zeros = 0;
+            if ( current >= end ) {
+                error = true;
+                return 0;
+            }
+            byte = *current++;
+        }
+        zeros = byte ? 0 : zeros + 1;
+    }
+    return byte;
 }
 
 uint32_t GetBitContext::get_bit1() {
-    assert( this->index < this->bitCount );
-    int     byteIndex = this->index >> 3;
-    uint8_t tmp       = *( buffer + byteIndex );
-    int     bitIndex  = this->index % 8;
-    tmp <<= bitIndex;
-    tmp >>= 8 - 1;
-    this->index++;
-    return tmp;
+    if ( !cacheBits ) {
+        cache     = load_byte();
+        cacheBits = 8;
+    }
+    cacheBits -= 1;
+    return ( cache >> cacheBits ) & 1;
 }
 uint32_t GetBitContext::get_bits( int n ) {
     if ( n == 0 ) return 0;
     assert( n >= 1 && n <= 32 );
-    uint32_t ret = 0;
-    for ( int i = n - 1; i >= 0; i-- ) {
-        ret |= ( get_bit1() << i );
+    while ( cacheBits < n ) {
+        cache = ( cache << 8 ) | load_byte();
+        cacheBits += 8;
     }
-    return ret;
+    cacheBits -= n;
+    return (uint32_t)( ( cache >> cacheBits ) & ( 0xFFFFFFFFu >> ( 32 - n ) ) );
 }
 uint32_t GetBitContext::get_ue_golomb() {
     int count = 0;
-    while ( get_bit1() == 0 && count < 32 ) {
-        count++;
+    while ( get_bit1() == 0 ) {
+        // at most 31 leading zeros in 32 bits, also ends a read past the end
+        if ( ++count == 32 ) {
+            error = true;
+            return 0;
+        }
     }
-    uint32_t ret = get_bits( count ) + ( 1 << count ) - 1;
-    return ret;
+    return (uint32_t)( ( ( uint64_t )1 << count ) - 1 + get_bits( count ) );
 }
 
 int32_t GetBitContext::get_se_golomb() {
-    int r = get_ue_golomb();
+    uint32_t r = get_ue_golomb();
     if ( r & 0x01 ) {
-        r = ( r + 1 ) / 2;
-    }
-    else {
-        r = -( r / 2 );
+        return (int32_t)( ( r >> 1 ) + 1 );
     }
-    return r;
+    return -(int32_t)( r >> 1 );
 }
 
 void GetBitContext::skip_bits( int n ) {
-    assert( n > 0 && n < 32 );
-    if ( this->index + n < bitCount ) {
-        this->index += n;
+    while ( n > 0 ) {
+        int bits = n < 32 ? n : 32;
+        get_bits( bits );
+        n -= bits;
+    }
+}
+
+void GetBitContext::skip_bytes( uint32_t n ) {
+    assert( cacheBits % 8 == 0 );
+    for ( ; n > 0 && cacheBits; n-- ) {
+        cacheBits -= 8;
+    }
+    for ( ; n > 0 && !error; n-- ) {
+        load_byte();
+    }
+}
+
+const uint8_t *GetBitContext::position() {
+    assert( cacheBits == 0 );
+    if ( unescape && zeros >= 2 && current < end && *current == 3 ) {
+        zeros = 0;
+        current += 1;
     }
+    return current;
 }
 
 }; // namespace nx
@@ -1,28 +1,73 @@
 #ifndef __GET_BITS_H__
 #define __GET_BITS_H__
 
-#endif // __GET_BITS_H__
-
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 
 namespace nx {
 
+/**
+ * @brief msb first bit reader.
+ * Bytes are loaded lazily into a small cache, reads past the end return 0 bits and set an error,
+ * so a truncated or corrupt buffer ends the parse in bounded time instead of reading out of bounds.
+ * With unescape, emulation_prevention_three_byte (the 03 of 00 00 03) is skipped while reading,
+ * so h264 nal units are parsed in place, without an rbsp copy.
+ */
 class GetBitContext {
 private:
-    const uint8_t *buffer   = nullptr;
-    int            index    = 0;
-    int            bitCount = 0;
+    const uint8_t *current = nullptr; // next byte to load
+    const uint8_t *end     = nullptr;
+    // bits not read yet, in the low cacheBits bits
+    uint64_t cache     = 0;
+    int      cacheBits = 0;
+    // zero bytes loaded in a row, an 03 after two of them is an emulation prevention byte
+    int  zeros    = 0;
+    bool unescape = false;
+    bool error    = false;
+
+    uint32_t load_byte();
 
 public:
-    GetBitContext( const uint8_t *buffer, int bytes );
+    /**
+     * @param unescape  skip emulation prevention bytes, for h264 nal units
+     */
+    GetBitContext( const uint8_t *buffer, int bytes, bool unescape = false );
     ~GetBitContext() = default;
     uint32_t get_bit1();
+    /**
+     * @param n  0 to 32
+     */
     uint32_t get_bits( int n );
+    /**
+     * @brief exp-golomb code, a code longer than 32 bits is an error and reads as 0.
+     */
     uint32_t get_ue_golomb();
     int32_t  get_se_golomb();
     void     skip_bits( int n );
+    /**
+     * @brief skip n bytes, from a byte boundary.
+     */
+    void skip_bytes( uint32_t n );
+    /**
+     * @brief whether a read went past the end or an exp-golomb code was invalid.
+     */
+    bool has_error() const {
+        return error;
+    }
+    /**
+     * @brief the next unread byte of the buffer, after a pending emulation prevention byte.
+     * Only valid on a byte boundary, when every loaded byte has been read.
+     */
+    const uint8_t *position();
+    /**
+     * @brief bytes of the buffer not loaded yet, emulation prevention bytes included.
+     */
+    size_t bytes_left() const {
+        return end - current;
+    }
 };
 
-}; // namespace nx
+};     // namespace nx
+
+#endif // __GET_BITS_H__
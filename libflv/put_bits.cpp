@@ -44,4 +44,30 @@ void PutBitsContext::put_bits( int n, uint32_t value ) {
     }
 }
 
+void PutBitsContext::put_ue_golomb( uint32_t value ) {
+    // leading zeros, then value + 1 on bits + 1 bits
+    uint64_t v    = (uint64_t)value + 1;
+    int      bits = 0;
+    while ( ( v >> bits ) > 1 ) bits++;
+    put_bits( bits, 0 );
+    if ( bits == 32 ) {
+        put_bits( 1, 1 );
+        put_bits( 32, (uint32_t)v );
+    }
+    else {
+        put_bits( bits + 1, (uint32_t)v );
+    }
+}
+
+void PutBitsContext::put_se_golomb( int32_t value ) {
+    // 1 -> 1, -1 -> 2, 2 -> 3, -2 -> 4 ...
+    uint32_t code = value > 0 ? 2 * (uint32_t)value - 1 : 2 * ( 0 - (uint32_t)value );
+    put_ue_golomb( code );
+}
+
+void PutBitsContext::put_rbsp_trailing_bits() {
+    put_bits( 1, 1 );
+    if ( !byte_aligned() ) put_bits( bit_left, 0 );
+}
+
 } // namespace nx
@@ -31,6 +31,28 @@ public:
      * @param value  uint32_t value contains the source bits
      */
     void put_bits( int n, uint32_t value );
+    /**
+     * @brief put an unsigned Exp-Golomb code, ue(v)
+     */
+    void put_ue_golomb( uint32_t value );
+    /**
+     * @brief put a signed Exp-Golomb code, se(v)
+     */
+    void put_se_golomb( int32_t value );
+    /**
+     * @brief put rbsp_trailing_bits, the stop bit and zero bits up to the next byte
+     */
+    void put_rbsp_trailing_bits();
+    // the next bit starts a byte
+    bool byte_aligned() const {
+        return bit_left == 0 || bit_left == 8;
+    }
+    /**
+     * @brief bytes written so far, including a partial last byte
+     */
+    int size() const {
+        return index + ( bit_left < 8 ? 1 : 0 );
+    }
 };
 
 };     // namespace nx
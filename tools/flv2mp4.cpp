@@ -0,0 +1,36 @@
+/*
+ flv2mp4, remux a flv file with avc/aac to fragmented mp4, one fragment per gop.
+
+ usage: flv2mp4 input.flv output.mp4
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "flv_fmp4.h"
+
+using namespace nx;
+
+int main( int argc, char **argv ) {
+    if ( argc != 3 ) {
+        fprintf( stderr, "usage: %s input.flv output.mp4\n", argv[0] );
+        return 1;
+    }
+    FlvFmp4Options options;
+    FlvFmp4Report  report;
+    auto           begin = std::chrono::steady_clock::now();
+    if ( flv_remux_fmp4( argv[1], argv[2], options, &report ) < 0 ) {
+        fprintf( stderr, "failed to remux %s: %s\n", argv[1], errno ? strerror( errno ) : "unsupported input" );
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+    printf( "%" PRIu64 " fragments, %" PRIu64 " video samples, %" PRIu64 " audio samples\n",
+            report.fragments, report.videoSamples, report.audioSamples );
+    printf( "output %" PRIu64 " bytes, %.3f ms", report.bytes, seconds * 1000 );
+    if ( seconds > 0 ) printf( ", %.1f MB/s", report.bytes / seconds / 1e6 );
+    printf( "\n" );
+    return 0;
+}
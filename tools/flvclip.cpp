@@ -0,0 +1,65 @@
+/*
+ flvclip, cut a clip out of a flv recording at key frames.
+
+ usage: flvclip [-k] [-a] -f from_ms -t to_ms input.flv output.flv
+   -k  write a keyframes index to onMetaData
+   -a  keep the timestamps of the input, by default the clip starts at 0
+
+ The tags are moved with copy_file_range, on filesystems with reflinks the clip shares the extents of the input.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "flv_clip.h"
+
+using namespace nx;
+
+static void usage( const char *name ) {
+    fprintf( stderr, "usage: %s [-k] [-a] -f from_ms -t to_ms input.flv output.flv\n", name );
+}
+
+int main( int argc, char **argv ) {
+    FlvClipOptions options;
+    long long      fromMs = -1;
+    long long      toMs   = -1;
+    int            first  = 1;
+    for ( ; first < argc && argv[first][0] == '-'; first++ ) {
+        if ( !strcmp( argv[first], "-k" ) ) {
+            options.keyframeIndex = true;
+        }
+        else if ( !strcmp( argv[first], "-a" ) ) {
+            options.rebaseTimestamps = false;
+        }
+        else if ( !strcmp( argv[first], "-f" ) && first + 1 < argc ) {
+            fromMs = atoll( argv[++first] );
+        }
+        else if ( !strcmp( argv[first], "-t" ) && first + 1 < argc ) {
+            toMs = atoll( argv[++first] );
+        }
+        else {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+    if ( argc - first != 2 || fromMs < 0 || toMs < fromMs || toMs > UINT32_MAX ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    FlvClipReport report;
+    auto          begin = std::chrono::steady_clock::now();
+    if ( flv_clip_file( argv[first], argv[first + 1], (uint32_t)fromMs, (uint32_t)toMs, options, &report ) < 0 ) {
+        fprintf( stderr, "failed to clip %s: %s\n", argv[first], errno ? strerror( errno ) : "no key frame in range" );
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+    printf( "key frame %u ms, input bytes %" PRIu64 " - %" PRIu64 " (%s), clip %.3f s, %" PRIu64 " bytes, %.3f ms\n",
+            report.startTimestamp, report.startOffset, report.endOffset, report.usedIndex ? "keyframes index" : "scan",
+            report.duration, report.bytes, seconds * 1000 );
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ flvconcat, concatenate flv files with compatible codec configs.
+
+ usage: flvconcat [-k] [-c] -o output.flv input.flv...
+   -k  write a keyframes index to onMetaData
+   -c  keep an input whose codec config differs from the end of the previous input, by default the concatenation fails.
+       Config changes inside an input are always kept
+
+ Each input continues where the previous one ends, the tags are moved with copy_file_range.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "flv_concat.h"
+
+using namespace nx;
+
+static void usage( const char *name ) {
+    fprintf( stderr, "usage: %s [-k] [-c] -o output.flv input.flv...\n", name );
+}
+
+int main( int argc, char **argv ) {
+    FlvConcatOptions options;
+    const char      *output = nullptr;
+    int              first  = 1;
+    for ( ; first < argc && argv[first][0] == '-'; first++ ) {
+        if ( !strcmp( argv[first], "-k" ) ) {
+            options.keyframeIndex = true;
+        }
+        else if ( !strcmp( argv[first], "-c" ) ) {
+            options.allowConfigChange = true;
+        }
+        else if ( !strcmp( argv[first], "-o" ) && first + 1 < argc ) {
+            output = argv[++first];
+        }
+        else {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+    if ( !output || first >= argc ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    FlvConcatReport report;
+    auto            begin = std::chrono::steady_clock::now();
+    int             ret   = flv_concat_files( argv + first, argc - first, output, options, &report );
+    if ( ret == -2 ) {
+        fprintf( stderr, "the codec config of %s differs, use -c to keep it\n", argv[first + report.mismatchedInput] );
+        return 1;
+    }
+    if ( ret < 0 ) {
+        fprintf( stderr, "failed to concatenate to %s: %s\n", output, errno ? strerror( errno ) : "not a flv file" );
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+    printf( "video tags %" PRIu64 ", audio tags %" PRIu64 ", sequence headers dropped %" PRIu64 ", changed %" PRIu64 "\n",
+            report.videoTags, report.audioTags, report.droppedSequenceHeaders, report.changedSequenceHeaders );
+    printf( "duration %.3f s, %" PRIu64 " bytes, %.3f ms\n", report.duration, report.bytes, seconds * 1000 );
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ flvmux, mux a raw h264 annex-b file and/or an aac adts file to flv.
+
+ usage: flvmux [-v video.h264] [-a audio.aac] [-r fps] [-f] [-p] -o out.flv
+
+ -f removes access unit delimiters and filler data from the video tags.
+ -p preallocates the output with fallocate and paces its writeback, for long recordings.
+
+ Input files are mmap'ed, video access units and adts frames are interleaved by timestamp,
+ muxed in batches with mux_batch, and the flv is written through a large user space buffer
+ by BasicFlvMuxer<FlvFileSink>, without virtual calls on the tag path.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "aac.h"
+#include "avc.h"
+#include "flvmuxer.h"
+
+using namespace nx;
+
+namespace {
+
+struct MappedFile {
+    uint8_t *data = nullptr;
+    size_t   size = 0;
+
+    ~MappedFile() {
+        if ( data ) munmap( data, size );
+    }
+    int open( const char *path ) {
+        int fd = ::open( path, O_RDONLY );
+        if ( fd < 0 ) return -1;
+        struct stat st;
+        if ( fstat( fd, &st ) < 0 || st.st_size == 0 ) {
+            close( fd );
+            return -1;
+        }
+        void *p = mmap( nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+        if ( p == MAP_FAILED ) return -1;
+        madvise( p, st.st_size, MADV_SEQUENTIAL );
+        data = (uint8_t *)p;
+        size = st.st_size;
+        return 0;
+    }
+};
+
+// frames per mux_batch call
+const size_t BatchFrames = 256;
+
+struct AccessUnit {
+    uint8_t *data;
+    size_t   size;
+    bool     isKeyFrame;
+};
+
+bool is_vcl( uint8_t naluType ) {
+    return naluType >= 1 && naluType <= 5;
+}
+
+/**
+ * @brief split an annex-b stream to access units, see H.264 7.4.1.2.3.
+ * A new access unit starts at AUD, SPS, PPS or SEI following a slice,
+ * or at a slice with first_mb_in_slice equal to 0 following a slice.
+ */
+void split_access_units( uint8_t *buf, size_t size, std::vector<AccessUnit> &units ) {
+    uint8_t *end       = buf + size - 1;
+    uint8_t *startCode = avc_find_startcode( buf, end );
+    uint8_t *auStart   = nullptr;
+    bool     hasVcl    = false;
+    bool     key       = false;
+    while ( startCode ) {
+        uint8_t *nalu = startCode + 3;
+        if ( nalu > end ) break;
+        // a 4 bytes start code belongs to this nalu
+        uint8_t *naluStart = ( startCode > buf && startCode[-1] == 0 ) ? startCode - 1 : startCode;
+        uint8_t  naluType  = nalu[0] & 0x1F;
+        bool     boundary  = false;
+        if ( hasVcl ) {
+            if ( naluType == 9 || naluType == NaluType::SPS || naluType == NaluType::PPS || naluType == NaluType::SEI ) {
+                boundary = true;
+            }
+            else if ( is_vcl( naluType ) && nalu + 1 <= end && ( nalu[1] & 0x80 ) ) {
+                // first_mb_in_slice is ue(v) 0, a single 1 bit
+                boundary = true;
+            }
+        }
+        if ( boundary ) {
+            units.push_back( { auStart, (size_t)( naluStart - auStart ), key } );
+            auStart = nullptr;
+            hasVcl  = false;
+            key     = false;
+        }
+        if ( !auStart ) auStart = naluStart;
+        if ( is_vcl( naluType ) ) hasVcl = true;
+        if ( naluType == NaluType::IDR ) key = true;
+        startCode = avc_find_startcode( nalu, end );
+    }
+    if ( auStart && hasVcl ) {
+        units.push_back( { auStart, (size_t)( buf + size - auStart ), key } );
+    }
+}
+
+void usage( const char *name ) {
+    fprintf( stderr, "usage: %s [-v video.h264] [-a audio.aac] [-r fps] [-f] [-p] -o out.flv\n", name );
+}
+
+} // namespace
+
+int main( int argc, char **argv ) {
+    const char *videoPath   = nullptr;
+    const char *audioPath   = nullptr;
+    const char *outputPath  = nullptr;
+    double      fps         = 30;
+    bool        filter      = false;
+    bool        preallocate = false;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( !strcmp( argv[i], "-v" ) && i + 1 < argc ) {
+            videoPath = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "-a" ) && i + 1 < argc ) {
+            audioPath = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "-o" ) && i + 1 < argc ) {
+            outputPath = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "-r" ) && i + 1 < argc ) {
+            fps = atof( argv[++i] );
+        }
+        else if ( !strcmp( argv[i], "-f" ) ) {
+            filter = true;
+        }
+        else if ( !strcmp( argv[i], "-p" ) ) {
+            preallocate = true;
+        }
+        else {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+    if ( !outputPath || ( !videoPath && !audioPath ) || fps <= 0 ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    MappedFile video;
+    MappedFile audio;
+    if ( videoPath && video.open( videoPath ) < 0 ) {
+        fprintf( stderr, "failed to map %s: %s\n", videoPath, strerror( errno ) );
+        return 1;
+    }
+    if ( audioPath && audio.open( audioPath ) < 0 ) {
+        fprintf( stderr, "failed to map %s: %s\n", audioPath, strerror( errno ) );
+        return 1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<AccessUnit> units;
+    if ( video.data ) split_access_units( video.data, video.size, units );
+
+    FlvBufferedFile file;
+    if ( preallocate ) {
+        file.set_preallocation( true );
+        file.set_writeback_pacing( 8 << 20 );
+    }
+    if ( file.open( outputPath ) < 0 ) {
+        fprintf( stderr, "failed to create %s: %s\n", outputPath, strerror( file.error() ) );
+        return 1;
+    }
+
+    uint64_t       audioFrames = 0;
+    FlvStreamStats stats;
+    {
+        BasicFlvMuxer<FlvFileSink> muxer( audio.data != nullptr, !units.empty(), FlvFileSink( file ) );
+        std::vector<FlvFrame>      batch;
+        size_t                     videoIndex  = 0;
+        size_t                     audioOffset = 0;
+        uint32_t                   sampleRate  = 0;
+        batch.reserve( BatchFrames );
+        muxer.set_nalu_filter( filter );
+        while ( true ) {
+            // next audio frame
+            uint8_t *adts       = nullptr;
+            size_t   adtsLength = 0;
+            uint32_t audioTs    = UINT32_MAX;
+            if ( audio.data && audioOffset + 7 <= audio.size ) {
+                adts = audio.data + audioOffset;
+                if ( adts[0] != 0xFF || ( adts[1] & 0xF0 ) != 0xF0 ) {
+                    fprintf( stderr, "lost adts sync at offset %zu\n", audioOffset );
+                    adts = nullptr;
+                }
+                else {
+                    adts_header header = adts_header::parse_adts_header( adts );
+                    adtsLength         = header.variable_header.aac_frame_length;
+                    // 12 rates, 8000 Hz is the last one, the other indexes are reserved or explicit
+                    if ( header.fixed_header.sampling_frequency_index > 11 ) {
+                        fprintf( stderr, "bad adts sampling frequency index %d at offset %zu\n", header.fixed_header.sampling_frequency_index,
+                                 audioOffset );
+                        adts = nullptr;
+                    }
+                    else if ( !sampleRate ) {
+                        sampleRate = adts_header::sampleRate( header );
+                    }
+                    if ( !adts || adtsLength <= 7 || audioOffset + adtsLength > audio.size ) {
+                        adts = nullptr;
+                    }
+                    else {
+                        audioTs = (uint32_t)( audioFrames * 1024 * 1000 / sampleRate );
+                    }
+                }
+                if ( !adts ) audioOffset = audio.size;
+            }
+            // next video frame
+            uint32_t videoTs = videoIndex < units.size() ? (uint32_t)( videoIndex * 1000 / fps ) : UINT32_MAX;
+
+            if ( !adts && videoIndex >= units.size() ) break;
+            if ( adts && audioTs <= videoTs ) {
+                batch.push_back( { 8, adts, adtsLength, audioTs, audioTs, false } );
+                audioOffset += adtsLength;
+                audioFrames += 1;
+            }
+            else {
+                AccessUnit &unit = units[videoIndex];
+                batch.push_back( { 9, unit.data, unit.size, videoTs, videoTs, unit.isKeyFrame } );
+                videoIndex += 1;
+            }
+            if ( batch.size() == BatchFrames ) {
+                muxer.mux_batch( &batch[0], batch.size() );
+                batch.clear();
+            }
+        }
+        if ( !batch.empty() ) muxer.mux_batch( &batch[0], batch.size() );
+        muxer.get_stats( stats );
+    }
+    if ( file.error() ) {
+        fprintf( stderr, "failed to write %s: %s\n", outputPath, strerror( file.error() ) );
+        return 1;
+    }
+
+    double   seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+    uint64_t input   = video.size + audio.size;
+    printf( "video frames %zu, audio frames %" PRIu64 "\n", units.size(), audioFrames );
+    printf( "input %" PRIu64 " bytes, output %" PRIu64 " bytes, %.3f ms\n", input, file.size(), seconds * 1000 );
+    if ( filter ) {
+        printf( "filtered %" PRIu64 " nalus, %" PRIu64 " bytes\n", stats.filteredNalus, stats.filteredBytes );
+    }
+    if ( stats.skippedAudioFrames ) printf( "skipped %" PRIu64 " audio frames\n", stats.skippedAudioFrames );
+    if ( seconds > 0 ) {
+        printf( "throughput %.1f MB/s, %.0f frames/s\n", input / seconds / 1e6, ( units.size() + audioFrames ) / seconds );
+    }
+    return 0;
+}
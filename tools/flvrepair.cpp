@@ -0,0 +1,66 @@
+/*
+ flvrepair, repair flv recordings which were not finished, e.g. the recorder crashed.
+
+ usage: flvrepair [-k] [-n] file.flv...
+   -k  write a keyframes index to onMetaData
+   -n  dry run, only report what would be done
+
+ The torn tail is cut at the last valid tag, and onMetaData is recomputed,
+ in place when it fits, or by rewriting the file next to the original.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "flv_repair.h"
+
+using namespace nx;
+
+static void usage( const char *name ) {
+    fprintf( stderr, "usage: %s [-k] [-n] file.flv...\n", name );
+}
+
+int main( int argc, char **argv ) {
+    FlvRepairOptions options;
+    int              first = 1;
+    for ( ; first < argc && argv[first][0] == '-'; first++ ) {
+        if ( !strcmp( argv[first], "-k" ) ) {
+            options.keyframeIndex = true;
+        }
+        else if ( !strcmp( argv[first], "-n" ) ) {
+            options.dryRun = true;
+        }
+        else {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+    if ( first >= argc ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    int failures = 0;
+    for ( int i = first; i < argc; i++ ) {
+        FlvRepairReport report;
+        auto            begin = std::chrono::steady_clock::now();
+        if ( flv_repair_file( argv[i], options, &report ) < 0 ) {
+            fprintf( stderr, "%s: failed to repair: %s\n", argv[i], strerror( errno ) );
+            failures += 1;
+            continue;
+        }
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+        printf( "%s: %" PRIu64 " video tags (%" PRIu64 " key), %" PRIu64 " audio tags, %.3f s, %ux%u\n",
+                argv[i], report.videoTags, report.keyFrames, report.audioTags, report.duration, report.width, report.height );
+        printf( "  size %" PRIu64 " -> %" PRIu64 "%s, metadata %s, %.3f ms",
+                report.originalSize, report.repairedSize, report.truncated ? " (truncated)" : "",
+                options.dryRun ? "not written" : report.metadataInPlace ? "rewritten in place" : "rewritten with the file",
+                seconds * 1000 );
+        if ( seconds > 0 ) printf( ", %.1f MB/s", report.originalSize / seconds / 1e6 );
+        printf( "\n" );
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+/*
+ flvscan, validate and index flv files with one thread per core.
+
+ usage: flvscan [-j threads] [-k] file.flv...
+   -j  number of threads, default one per core
+   -k  print the keyframe index
+
+ Exits with 1 if a file is corrupted or has timestamps going backwards.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "flv_scanner.h"
+
+using namespace nx;
+
+static void usage( const char *name ) {
+    fprintf( stderr, "usage: %s [-j threads] [-k] file.flv...\n", name );
+}
+
+static void print_track( const char *name, const FlvScanTrack &track ) {
+    printf( "  %s: %" PRIu64 " tags, %" PRIu64 " bytes, timestamps %u - %u, %" PRIu64 " backwards\n",
+            name, track.tags, track.bytes, track.firstTimestamp, track.lastTimestamp, track.backwardTimestamps );
+}
+
+int main( int argc, char **argv ) {
+    FlvScanOptions options;
+    bool           printKeyframes = false;
+    int            first          = 1;
+    for ( ; first < argc && argv[first][0] == '-'; first++ ) {
+        if ( !strcmp( argv[first], "-j" ) && first + 1 < argc ) {
+            options.threads = atoi( argv[++first] );
+        }
+        else if ( !strcmp( argv[first], "-k" ) ) {
+            printKeyframes = true;
+        }
+        else {
+            usage( argv[0] );
+            return 1;
+        }
+    }
+    if ( first >= argc ) {
+        usage( argv[0] );
+        return 1;
+    }
+
+    int failures = 0;
+    for ( int i = first; i < argc; i++ ) {
+        FlvScanResult result;
+        auto          begin = std::chrono::steady_clock::now();
+        if ( flv_scan_file( argv[i], options, result ) < 0 ) {
+            fprintf( stderr, "%s: failed to scan: %s\n", argv[i], strerror( errno ) );
+            failures += 1;
+            continue;
+        }
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+        printf( "%s: %s, %" PRIu64 " bytes, valid up to %" PRIu64 ", %.3f ms",
+                argv[i], result.valid() ? "ok" : "invalid", result.fileSize, result.validEnd, seconds * 1000 );
+        if ( seconds > 0 ) printf( ", %.1f MB/s", result.fileSize / seconds / 1e6 );
+        printf( "\n" );
+        print_track( "audio", result.audio );
+        print_track( "video", result.video );
+        printf( "  %zu keyframes, %zu sequence headers, %" PRIu64 " script tags\n",
+                result.keyframes.size(), result.codecHeaders.size(), result.scriptTags );
+        for ( auto &header : result.codecHeaders ) {
+            printf( "  %s sequence header at %" PRIu64 ", timestamp %u, %zu bytes\n",
+                    header.type == 8 ? "audio" : "video", header.offset, header.timestamp, header.data.size() );
+        }
+        for ( auto &corruption : result.corruptions ) {
+            printf( "  corrupted %" PRIu64 " - %" PRIu64 "\n", corruption.offset, corruption.resyncOffset );
+        }
+        if ( printKeyframes ) {
+            for ( auto &keyframe : result.keyframes ) {
+                printf( "  keyframe %" PRIu64 " %u\n", keyframe.offset, keyframe.timestamp );
+            }
+        }
+        if ( !result.valid() ) failures += 1;
+    }
+    return failures ? 1 : 0;
+}